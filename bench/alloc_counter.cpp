@@ -0,0 +1,10 @@
+#include "alloc_counter.h"
+#include "../src/memory_stats.h"
+
+static_assert(memory_stats_enabled,
+              "bench binaries count allocations, build with "
+              "-DSNIP_ALLOC_STATS");
+
+std::size_t allocation_count() noexcept {
+  return memory_report().total.allocations;
+}
@@ -0,0 +1,10 @@
+#ifndef BENCH_ALLOC_COUNTER_H
+#define BENCH_ALLOC_COUNTER_H
+
+#include <cstddef>
+
+// every heap allocation a benchmark makes, counted by the operator new in
+// src/memory_stats.cpp. bench binaries are built with SNIP_ALLOC_STATS
+std::size_t allocation_count() noexcept;
+
+#endif // !BENCH_ALLOC_COUNTER_H
@@ -0,0 +1,134 @@
+#include "../src/fd_writer.h"
+#include "../src/flat_tree.h"
+#include "../src/lexer.h"
+#include "../src/memory_stats.h"
+#include "../src/parser.h"
+#include "../src/token_stream.h"
+#include "alloc_counter.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+static std::string make_input(std::size_t target_bytes) {
+  const std::string snippet = "int counter_1 = 42;\n"
+                              "char c = 'x';\n"
+                              "str s = \"text\";\n"
+                              "# generated comment\n"
+                              "if (counter_1) { counter_1 = 1 + 2 * 3; }\n"
+                              "counter_1 = counter_1 - 1;\n";
+  std::string input;
+  input.reserve(target_bytes + snippet.size());
+  while (input.size() < target_bytes) {
+    input += snippet;
+  }
+  return input + " ";
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t target_bytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                      : std::size_t{16} << 20;
+  std::string input = make_input(target_bytes);
+
+  std::size_t before = allocation_count();
+  auto start = std::chrono::steady_clock::now();
+  TokenArray token_stack = nullptr;
+  Lexer lex(input);
+  lex.tokenize(token_stack);
+  auto end = std::chrono::steady_clock::now();
+  std::size_t used = allocation_count() - before;
+
+  std::size_t num_tokens = 0;
+  while (token_stack[num_tokens].type != Token::END) {
+    num_tokens++;
+  }
+  num_tokens++;
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=lex bytes=%zu tokens=%zu allocations=%zu "
+              "allocs_per_token=%.6f seconds=%.3f\n",
+              input.size(), num_tokens, used,
+              static_cast<double>(used) / num_tokens, seconds);
+
+  // the same tokens in the compact layout the driver uses
+  before = allocation_count();
+  start = std::chrono::steady_clock::now();
+  TokenStream tokens;
+  Lexer stream_lex(input);
+  stream_lex.tokenize(tokens);
+  end = std::chrono::steady_clock::now();
+  used = allocation_count() - before;
+  seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=tokens array_bytes=%zu stream_bytes=%zu ratio=%.2f "
+              "stream_allocations=%zu stream_seconds=%.3f\n",
+              num_tokens * sizeof(TokenChunk), tokens.memory_bytes(),
+              static_cast<double>(num_tokens * sizeof(TokenChunk)) /
+                  tokens.memory_bytes(),
+              used, seconds);
+
+  before = allocation_count();
+  start = std::chrono::steady_clock::now();
+  auto parsed_tokens = std::make_unique<ParseTree>();
+  Parser parser(token_stack);
+  parser.parse(*parsed_tokens);
+  end = std::chrono::steady_clock::now();
+  used = allocation_count() - before;
+  seconds = std::chrono::duration<double>(end - start).count();
+  const ParseArena &arena = parsed_tokens->arena();
+  std::printf("phase=parse tokens=%zu nodes=%zu allocations=%zu "
+              "allocs_per_token=%.6f arena_bytes=%zu arena_blocks=%zu "
+              "seconds=%.3f\n",
+              num_tokens, parsed_tokens->node_count(), used,
+              static_cast<double>(used) / num_tokens, arena.bytes_reserved(),
+              arena.block_count(), seconds);
+
+  // every node visited once, following the node links and scanning the
+  // flat arrays
+  start = std::chrono::steady_clock::now();
+  std::size_t linked_identifiers = 0;
+  std::vector<PTNode *> pending{parsed_tokens->root()};
+  while (!pending.empty()) {
+    PTNode *node = pending.back();
+    pending.pop_back();
+    linked_identifiers += node->get_val()->type == ParserToken::IDENTIFIER;
+    if (node->get_next_sibling() != nullptr) {
+      pending.push_back(node->get_next_sibling());
+    }
+    if (node->get_first_child() != nullptr) {
+      pending.push_back(node->get_first_child());
+    }
+  }
+  end = std::chrono::steady_clock::now();
+  double linked_seconds = std::chrono::duration<double>(end - start).count();
+  start = std::chrono::steady_clock::now();
+  FlatTree flat(*parsed_tokens);
+  end = std::chrono::steady_clock::now();
+  double flatten_seconds = std::chrono::duration<double>(end - start).count();
+  start = std::chrono::steady_clock::now();
+  std::size_t flat_identifiers = 0;
+  for (std::uint32_t i = 0; i < flat.size(); i++) {
+    flat_identifiers += flat.kind(i) == ParserToken::IDENTIFIER;
+  }
+  end = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=traverse identifiers=%zu/%zu linked_seconds=%.3f "
+              "flatten_seconds=%.3f flat_seconds=%.3f\n",
+              linked_identifiers, flat_identifiers, linked_seconds,
+              flatten_seconds, seconds);
+
+  // the arena frees every node at once
+  start = std::chrono::steady_clock::now();
+  parsed_tokens.reset();
+  end = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=teardown seconds=%.6f\n", seconds);
+
+  // bytes and peaks of the whole run by the phase that allocated them
+  std::fflush(stdout);
+  MemoryReport report = memory_report();
+  FdWriter out(STDOUT_FILENO);
+  write_memory_report(out, report);
+  return 0;
+}
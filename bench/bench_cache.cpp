@@ -0,0 +1,93 @@
+#include "../src/fd_writer.h"
+#include "../src/flat_tree.h"
+#include "../src/lexer.h"
+#include "../src/parser.h"
+#include "../src/token_stream.h"
+#include "../src/tree_cache.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+static std::string make_input(std::size_t target_bytes) {
+  const std::string snippet = "int counter_1 = 42;\n"
+                              "char c = 'x';\n"
+                              "str s = \"text\";\n"
+                              "# generated comment\n"
+                              "if (counter_1) { counter_1 = 1 + 2 * 3; }\n"
+                              "counter_1 = counter_1 - 1;\n";
+  std::string input;
+  input.reserve(target_bytes + snippet.size());
+  while (input.size() < target_bytes) {
+    input += snippet;
+  }
+  return input + " ";
+}
+
+// what the driver does for one source with -c: a cold run lexes, parses,
+// dumps the tree and stores it, a warm run maps the stored tree and dumps
+// it. the dumps go to /dev/null so only the work itself is timed
+int main(int argc, char *argv[]) {
+  std::size_t target_bytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                      : std::size_t{16} << 20;
+  std::string input = make_input(target_bytes);
+  std::string dir = std::filesystem::temp_directory_path().string() +
+                    "/snip_bench_cache_" + std::to_string(getpid());
+  TreeCache cache(dir);
+  int null_fd = open("/dev/null", O_WRONLY);
+
+  auto start = std::chrono::steady_clock::now();
+  std::size_t nodes = 0;
+  {
+    TokenStream tokens;
+    Lexer lex(input);
+    lex.tokenize(tokens);
+    ParseTree parsed;
+    Parser parser(tokens);
+    parser.parse(parsed);
+    nodes = parsed.node_count();
+    cache.store(input, FlatTree(parsed));
+    FdWriter out(null_fd);
+    parsed.root()->write(out);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=cold bytes=%zu nodes=%zu seconds=%.3f\n", input.size(),
+              nodes, seconds);
+
+  start = std::chrono::steady_clock::now();
+  std::size_t entry_bytes = 0;
+  {
+    std::unique_ptr<TreeImage> image = cache.load(input);
+    if (image == nullptr) {
+      std::fprintf(stderr, "the tree wasn't cached in %s\n", dir.c_str());
+      return 1;
+    }
+    nodes = image->size();
+    entry_bytes =
+        std::filesystem::file_size(cache.path(TreeCache::hash(input)));
+    FdWriter out(null_fd);
+    image->write(out);
+  }
+  end = std::chrono::steady_clock::now();
+  double warm_seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=warm nodes=%zu entry_bytes=%zu seconds=%.3f "
+              "speedup=%.2f\n",
+              nodes, entry_bytes, warm_seconds, seconds / warm_seconds);
+
+  // a hit still hashes the whole source to find its entry
+  start = std::chrono::steady_clock::now();
+  std::uint64_t hash = TreeCache::hash(input);
+  end = std::chrono::steady_clock::now();
+  seconds = std::chrono::duration<double>(end - start).count();
+  std::printf("phase=hash hash=%016llx seconds=%.3f\n",
+              static_cast<unsigned long long>(hash), seconds);
+
+  close(null_fd);
+  std::filesystem::remove_all(dir);
+  return 0;
+}
@@ -0,0 +1,204 @@
+#include "../src/lexer.h"
+#include "../src/source.h"
+#include "../src/token_stream.h"
+#include "alloc_counter.h"
+#include "corpus.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// lexer throughput over generated or existing corpora, one record per
+// corpus in JSON lines or CSV:
+//
+//   bench_lex [--format json|csv] [--runs N] [--layout array|stream]
+//             [--seed N] corpus...
+//
+// a corpus is a .snip file, or <size>[:<mix>] to generate one in memory,
+// see corpus.h for the mixes. seconds is the best of the runs, the
+// allocation count is taken from the last one. every corpus is generated
+// and lexed in a child process of its own, so its peak RSS is its own and
+// not that of the corpora before it
+
+namespace {
+
+struct Options {
+  std::string format = "json";
+  std::string layout = "array";
+  int runs = 3;
+  std::uint64_t seed = 1;
+  std::vector<std::string> corpora;
+};
+
+struct Result {
+  std::string corpus;
+  std::size_t bytes;
+  std::size_t tokens;
+  double seconds;
+  std::size_t allocations;
+  long peak_rss_kb;
+  std::uint64_t hash;
+};
+
+Options parse_options(int argc, char *argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (std::strcmp(argv[i], "--format") == 0 && has_value) {
+      options.format = argv[++i];
+    } else if (std::strcmp(argv[i], "--runs") == 0 && has_value) {
+      options.runs = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--layout") == 0 && has_value) {
+      options.layout = argv[++i];
+    } else if (std::strcmp(argv[i], "--seed") == 0 && has_value) {
+      options.seed = std::strtoull(argv[++i], nullptr, 10);
+    } else {
+      options.corpora.push_back(argv[i]);
+    }
+  }
+  if (options.corpora.empty()) {
+    options.corpora = {"1M", "16M"};
+  }
+  if (options.runs < 1) {
+    options.runs = 1;
+  }
+  if (options.format != "json" && options.format != "csv") {
+    throw std::invalid_argument("--format takes json or csv");
+  }
+  if (options.layout != "array" && options.layout != "stream") {
+    throw std::invalid_argument("--layout takes array or stream");
+  }
+  return options;
+}
+
+bool is_file(const std::string &path) {
+  struct stat info;
+  return ::stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+// FNV-1a, so two runs can tell they lexed the same bytes
+std::uint64_t hash_bytes(std::string_view text) {
+  std::uint64_t hash = 0xCBF29CE484222325ull;
+  for (char c : text) {
+    hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+  }
+  return hash;
+}
+
+long peak_rss_kb() {
+  struct rusage usage;
+  ::getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+std::size_t lex_once(SourceBuffer &source, const std::string &layout) {
+  // a Lexer is consumed by tokenize(), every run gets a new one
+  Lexer lex(source);
+  if (layout == "stream") {
+    TokenStream tokens;
+    lex.tokenize(tokens);
+    return tokens.size();
+  }
+  TokenArray token_stack = nullptr;
+  lex.tokenize(token_stack);
+  std::size_t count = 0;
+  while (token_stack[count].type != Token::END) {
+    count++;
+  }
+  return count + 1;
+}
+
+Result run_corpus(const std::string &corpus, const Options &options) {
+  SourceBuffer source;
+  if (is_file(corpus)) {
+    source = SourceBuffer::open(corpus);
+  } else {
+    CorpusSpec spec = parse_corpus_spec(corpus);
+    source = SourceBuffer(make_corpus(spec.bytes, spec.mix, options.seed));
+  }
+  Result result{corpus, source.size(), 0, 0, 0, 0, hash_bytes(source.view())};
+  for (int run = 0; run < options.runs; run++) {
+    std::size_t before = allocation_count();
+    auto start = std::chrono::steady_clock::now();
+    result.tokens = lex_once(source, options.layout);
+    auto end = std::chrono::steady_clock::now();
+    result.allocations = allocation_count() - before;
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (run == 0 || seconds < result.seconds) {
+      result.seconds = seconds;
+    }
+  }
+  result.peak_rss_kb = peak_rss_kb();
+  return result;
+}
+
+void print_result(const Result &result, const Options &options) {
+  double mb = result.bytes / (1024.0 * 1024.0);
+  double mb_per_s = mb / result.seconds;
+  double tokens_per_s = result.tokens / result.seconds;
+  double allocs_per_token =
+      static_cast<double>(result.allocations) / result.tokens;
+  if (options.format == "csv") {
+    std::printf("%s,%s,%zu,%zu,%.6f,%.1f,%.0f,%zu,%.6f,%ld,%016llx\n",
+                result.corpus.c_str(), options.layout.c_str(), result.bytes,
+                result.tokens, result.seconds, mb_per_s, tokens_per_s,
+                result.allocations, allocs_per_token, result.peak_rss_kb,
+                static_cast<unsigned long long>(result.hash));
+    return;
+  }
+  std::printf("{\"corpus\": \"%s\", \"layout\": \"%s\", \"bytes\": %zu, "
+              "\"tokens\": %zu, \"seconds\": %.6f, \"mb_per_s\": %.1f, "
+              "\"tokens_per_s\": %.0f, \"allocations\": %zu, "
+              "\"allocs_per_token\": %.6f, \"peak_rss_kb\": %ld, "
+              "\"corpus_hash\": \"%016llx\"}\n",
+              result.corpus.c_str(), options.layout.c_str(), result.bytes,
+              result.tokens, result.seconds, mb_per_s, tokens_per_s,
+              result.allocations, allocs_per_token, result.peak_rss_kb,
+              static_cast<unsigned long long>(result.hash));
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  try {
+    Options options = parse_options(argc, argv);
+    if (options.format == "csv") {
+      std::printf("corpus,layout,bytes,tokens,seconds,mb_per_s,tokens_per_s,"
+                  "allocations,allocs_per_token,peak_rss_kb,corpus_hash\n");
+    }
+    std::fflush(stdout);
+    for (const std::string &corpus : options.corpora) {
+      pid_t child = ::fork();
+      if (child < 0) {
+        throw std::runtime_error("can't fork");
+      }
+      if (child == 0) {
+        int status = 0;
+        try {
+          print_result(run_corpus(corpus, options), options);
+        } catch (const std::exception &e) {
+          std::fprintf(stderr, "bench_lex: %s\n", e.what());
+          status = 1;
+        }
+        std::fflush(stdout);
+        ::_exit(status);
+      }
+      int status = 0;
+      ::waitpid(child, &status, 0);
+      if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return 1;
+      }
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "bench_lex: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include "../src/lexer.h"
+#include "../src/source.h"
+#include "../src/thread_pool.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+// multi-line strings and comments with quotes in them put chunk boundaries
+// where the fix-up pass has to relex
+static std::string make_input(std::size_t target_bytes) {
+  const std::string snippet = "int counter_1 = 42;\n"
+                              "char c = 'x';\n"
+                              "str s = \"text\nspanning\nlines\";\n"
+                              "# generated \" comment\n"
+                              "if (counter_1) { counter_1 = 1 + 2 * 3; }\n"
+                              "counter_1 = counter_1 - 1;\n";
+  std::string input;
+  input.reserve(target_bytes + snippet.size());
+  while (input.size() < target_bytes) {
+    input += snippet;
+  }
+  return input + " ";
+}
+
+static bool same_tokens(const TokenArray &a,
+                        const TokenArray &b) {
+  for (std::size_t i = 0;; i++) {
+    if (a[i].type != b[i].type || a[i].value != b[i].value) {
+      return false;
+    }
+    if (a[i].type == Token::END) {
+      return true;
+    }
+  }
+}
+
+// best of a few runs, the first one also faults the pages in
+template <typename F> static double time_best(F lex_once) {
+  double best = 0;
+  for (int run = 0; run < 3; run++) {
+    auto start = std::chrono::steady_clock::now();
+    lex_once();
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (run == 0 || seconds < best) {
+      best = seconds;
+    }
+  }
+  return best;
+}
+
+int main(int argc, char *argv[]) {
+  std::size_t target_bytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                      : std::size_t{64} << 20;
+  std::size_t max_threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10)
+                                     : std::thread::hardware_concurrency();
+  if (max_threads == 0) {
+    max_threads = 1;
+  }
+  // tokens view the source, so it has to outlive every Lexer below
+  SourceBuffer source(make_input(target_bytes));
+  TokenArray sequential = nullptr;
+  // a Lexer is consumed by tokenize(), every run gets a new one
+  double base = time_best([&] {
+    Lexer lex(source);
+    lex.tokenize(sequential);
+  });
+  double mb = source.size() / (1024.0 * 1024.0);
+  std::printf("threads=seq bytes=%zu seconds=%.3f mb_per_s=%.1f\n",
+              source.size(), base, mb / base);
+
+  for (std::size_t threads = 1; threads <= max_threads; threads++) {
+    ThreadPool pool(threads);
+    TokenArray parallel = nullptr;
+    double seconds = time_best([&] {
+      Lexer chunked(source);
+      chunked.tokenize(parallel, pool);
+    });
+    std::printf("threads=%zu seconds=%.3f mb_per_s=%.1f speedup=%.2f "
+                "identical=%s\n",
+                threads, seconds, mb / seconds, base / seconds,
+                same_tokens(sequential, parallel) ? "yes" : "no");
+  }
+  return 0;
+}
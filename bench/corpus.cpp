@@ -0,0 +1,261 @@
+#include "corpus.h"
+#include "../src/keywords.h"
+#include <cstdlib>
+#include <stdexcept>
+#include <string_view>
+
+namespace {
+
+constexpr std::string_view punctuation = "+-*/(){};,:.!";
+
+// reserved words as opposed to operator words
+constexpr bool is_word(std::string_view text) {
+  return (text[0] >= 'a' && text[0] <= 'z') ||
+         (text[0] >= 'A' && text[0] <= 'Z');
+}
+
+constexpr std::size_t count_keywords(bool words) {
+  std::size_t count = 0;
+  for (const Keyword &kw : keywords) {
+    count += is_word(kw.text) == words;
+  }
+  return count;
+}
+
+// the n-th reserved word or operator word in the keyword table
+std::string_view nth_keyword(bool words, std::size_t n) {
+  for (const Keyword &kw : keywords) {
+    if (is_word(kw.text) == words && n-- == 0) {
+      return kw.text;
+    }
+  }
+  return keywords[0].text;
+}
+
+unsigned *mix_field(CorpusMix &mix, std::string_view name) {
+  if (name == "identifiers") {
+    return &mix.identifiers;
+  } else if (name == "keywords") {
+    return &mix.keywords;
+  } else if (name == "ints") {
+    return &mix.ints;
+  } else if (name == "doubles") {
+    return &mix.doubles;
+  } else if (name == "strings") {
+    return &mix.strings;
+  } else if (name == "chars") {
+    return &mix.chars;
+  } else if (name == "comments") {
+    return &mix.comments;
+  } else if (name == "operators") {
+    return &mix.operators;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+CorpusMix parse_mix(const std::string &spec) {
+  if (spec.empty() || spec == "balanced") {
+    return CorpusMix();
+  }
+  CorpusMix mix{0, 0, 0, 0, 0, 0, 0, 0};
+  if (spec == "identifiers") {
+    mix.identifiers = 8;
+    mix.operators = 2;
+    return mix;
+  } else if (spec == "literals") {
+    mix.ints = 2;
+    mix.doubles = 2;
+    mix.strings = 2;
+    mix.chars = 1;
+    mix.operators = 1;
+    return mix;
+  } else if (spec == "comments") {
+    mix.comments = 4;
+    mix.identifiers = 2;
+    mix.operators = 1;
+    return mix;
+  } else if (spec == "operators") {
+    mix.operators = 8;
+    mix.identifiers = 1;
+    return mix;
+  }
+  std::size_t pos = 0;
+  while (pos < spec.size()) {
+    std::size_t end = spec.find(',', pos);
+    if (end == std::string::npos) {
+      end = spec.size();
+    }
+    std::string item = spec.substr(pos, end - pos);
+    std::size_t eq = item.find('=');
+    unsigned *field =
+        eq == std::string::npos ? nullptr : mix_field(mix, item.substr(0, eq));
+    if (field == nullptr) {
+      throw std::invalid_argument("unknown corpus mix: " + spec);
+    }
+    *field = static_cast<unsigned>(std::strtoul(item.c_str() + eq + 1,
+                                                nullptr, 10));
+    pos = end + 1;
+  }
+  return mix;
+}
+
+std::size_t parse_size(const std::string &spec) {
+  char *end = nullptr;
+  std::size_t size = std::strtoull(spec.c_str(), &end, 10);
+  switch (*end) {
+  case 'G':
+  case 'g':
+    size <<= 10;
+    [[fallthrough]];
+  case 'M':
+  case 'm':
+    size <<= 10;
+    [[fallthrough]];
+  case 'K':
+  case 'k':
+    size <<= 10;
+    end++;
+    break;
+  default:
+    break;
+  }
+  if (end == spec.c_str() || *end != '\0') {
+    throw std::invalid_argument("not a size: " + spec);
+  }
+  return size;
+}
+
+CorpusSpec parse_corpus_spec(const std::string &spec) {
+  std::size_t colon = spec.find(':');
+  std::string mix = colon == std::string::npos ? "" : spec.substr(colon + 1);
+  return {parse_size(spec.substr(0, colon)), parse_mix(mix)};
+}
+
+CorpusGenerator::CorpusGenerator(const CorpusMix &mix, std::uint64_t seed)
+    : mix(mix), state(seed) {
+  this->total_weight = mix.identifiers + mix.keywords + mix.ints +
+                       mix.doubles + mix.strings + mix.chars + mix.comments +
+                       mix.operators;
+  if (this->total_weight == 0) {
+    throw std::invalid_argument("corpus mix has no weights");
+  }
+}
+
+// splitmix64
+std::uint64_t CorpusGenerator::next() noexcept {
+  std::uint64_t z = (this->state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+std::uint64_t CorpusGenerator::below(std::uint64_t bound) noexcept {
+  return this->next() % bound;
+}
+
+void CorpusGenerator::append_word(std::string &out, std::size_t min_len,
+                                  std::size_t max_len) {
+  std::size_t len = min_len + this->below(max_len - min_len + 1);
+  for (std::size_t i = 0; i < len; i++) {
+    out += static_cast<char>('a' + this->below(26));
+  }
+}
+
+bool CorpusGenerator::append_token(std::string &out) {
+  unsigned pick = static_cast<unsigned>(this->below(this->total_weight));
+  if (pick < this->mix.identifiers) {
+    // a few thousand names, reused the way variables are. no keyword
+    // starts with v
+    std::uint64_t id = this->below(4096);
+    out += 'v';
+    for (std::uint64_t name = id; name != 0; name /= 26) {
+      out += static_cast<char>('a' + name % 26);
+    }
+    if (id % 3 == 0) {
+      out += "_count";
+    }
+    return false;
+  }
+  pick -= this->mix.identifiers;
+  if (pick < this->mix.keywords) {
+    out += nth_keyword(true, this->below(count_keywords(true)));
+    return false;
+  }
+  pick -= this->mix.keywords;
+  if (pick < this->mix.ints) {
+    out += std::to_string(this->below(100000));
+    return false;
+  }
+  pick -= this->mix.ints;
+  if (pick < this->mix.doubles) {
+    out += std::to_string(this->below(10000));
+    out += '.';
+    out += std::to_string(this->below(1000));
+    return false;
+  }
+  pick -= this->mix.doubles;
+  if (pick < this->mix.strings) {
+    out += '"';
+    this->append_word(out, 1, 8);
+    for (std::uint64_t words = this->below(4); words > 0; words--) {
+      out += ' ';
+      this->append_word(out, 1, 8);
+    }
+    out += '"';
+    return false;
+  }
+  pick -= this->mix.strings;
+  if (pick < this->mix.chars) {
+    out += '\'';
+    out += static_cast<char>('a' + this->below(26));
+    out += '\'';
+    return false;
+  }
+  pick -= this->mix.chars;
+  if (pick < this->mix.comments) {
+    out += "#";
+    for (std::uint64_t words = 1 + this->below(8); words > 0; words--) {
+      out += ' ';
+      this->append_word(out, 1, 8);
+    }
+    return true;
+  }
+  std::size_t operators = count_keywords(false) + punctuation.size();
+  std::size_t op = this->below(operators);
+  if (op < punctuation.size()) {
+    out += punctuation[op];
+  } else {
+    out += nth_keyword(false, op - punctuation.size());
+  }
+  return false;
+}
+
+void CorpusGenerator::append(std::string &out, std::size_t bytes) {
+  std::size_t target = out.size() + bytes;
+  while (out.size() < target) {
+    if (this->below(4) == 0) {
+      out += "  ";
+    }
+    for (std::uint64_t tokens = 4 + this->below(12); tokens > 0; tokens--) {
+      // a comment runs to the end of the line
+      if (this->append_token(out)) {
+        break;
+      }
+      out += ' ';
+    }
+    if (out[out.size() - 1] == ' ') {
+      out.pop_back();
+    }
+    out += '\n';
+  }
+}
+
+std::string make_corpus(std::size_t bytes, const CorpusMix &mix,
+                        std::uint64_t seed) {
+  std::string corpus;
+  corpus.reserve(bytes + 256);
+  CorpusGenerator(mix, seed).append(corpus, bytes);
+  return corpus;
+}
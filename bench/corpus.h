@@ -0,0 +1,61 @@
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// relative weights of what the generated source is made of. tokens are
+// picked one at a time with these weights, so a mix of {1, 1, ...} gives
+// about as many of each
+struct CorpusMix {
+  unsigned identifiers{6};
+  unsigned keywords{3};
+  unsigned ints{2};
+  unsigned doubles{1};
+  unsigned strings{1};
+  unsigned chars{1};
+  unsigned comments{1};
+  unsigned operators{5};
+};
+
+// a preset name (balanced, identifiers, literals, comments, operators) or a
+// list like "identifiers=4,ints=2,comments=1", unnamed kinds get 0. throws
+// std::invalid_argument for anything else
+CorpusMix parse_mix(const std::string &spec);
+// bytes with an optional K, M or G suffix, powers of 1024
+std::size_t parse_size(const std::string &spec);
+
+// <size>[:<mix>], how BENCH_CORPORA, bench_lex and gen_corpus name a
+// generated corpus
+struct CorpusSpec {
+  std::size_t bytes;
+  CorpusMix mix;
+};
+CorpusSpec parse_corpus_spec(const std::string &spec);
+
+// the same mix and seed always give the same bytes, on every platform: the
+// generator only uses its own integer PRNG. everything it emits lexes
+// without errors
+class CorpusGenerator {
+public:
+  CorpusGenerator(const CorpusMix &mix, std::uint64_t seed);
+  // appends whole lines until out has grown by at least bytes
+  void append(std::string &out, std::size_t bytes);
+
+private:
+  std::uint64_t next() noexcept;
+  std::uint64_t below(std::uint64_t bound) noexcept;
+  // true when the token runs to the end of the line
+  bool append_token(std::string &out);
+  void append_word(std::string &out, std::size_t min_len, std::size_t max_len);
+  CorpusMix mix;
+  unsigned total_weight;
+  std::uint64_t state;
+};
+
+// a corpus of at least bytes, ending in a newline
+std::string make_corpus(std::size_t bytes, const CorpusMix &mix,
+                        std::uint64_t seed = 1);
+
+#endif // !BENCH_CORPUS_H
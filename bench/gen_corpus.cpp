@@ -0,0 +1,65 @@
+#include "corpus.h"
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+// writes a generated corpus to a file or stdout, a block at a time so GB
+// sizes never have to fit in memory:
+//
+//   gen_corpus <size>[:<mix>] [seed] [-o file]
+//   gen_corpus <size> [mix] [seed] [-o file]
+//
+// the first is the corpus spec bench_lex and BENCH_CORPORA take. the same
+// arguments always produce the same bytes
+int main(int argc, char *argv[]) {
+  std::string args[3] = {"", "", "1"};
+  std::string output = "-";
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "-o" && i + 1 < argc) {
+      output = argv[++i];
+    } else if (positional < 3) {
+      args[positional++] = argv[i];
+      // a mix given in the spec leaves only the seed to follow
+      if (positional == 1 && args[0].find(':') != std::string::npos) {
+        positional++;
+      }
+    }
+  }
+  if (positional == 0) {
+    std::fprintf(stderr, "usage: gen_corpus <size>[:<mix>] [seed] [-o file]\n"
+                         "       gen_corpus <size> [mix] [seed] [-o file]\n");
+    return 1;
+  }
+  try {
+    CorpusSpec spec = parse_corpus_spec(args[0]);
+    if (!args[1].empty()) {
+      spec.mix = parse_mix(args[1]);
+    }
+    std::size_t remaining = spec.bytes;
+    CorpusGenerator generator(spec.mix,
+                              std::strtoull(args[2].c_str(), nullptr, 10));
+    std::FILE *out = output == "-" ? stdout : std::fopen(output.c_str(), "wb");
+    if (out == nullptr) {
+      std::fprintf(stderr, "gen_corpus: can't open %s\n", output.c_str());
+      return 1;
+    }
+    std::string block;
+    const std::size_t block_bytes = std::size_t{1} << 20;
+    while (remaining > 0) {
+      block.clear();
+      std::size_t bytes = remaining < block_bytes ? remaining : block_bytes;
+      generator.append(block, bytes);
+      std::fwrite(block.data(), 1, block.size(), out);
+      remaining -= remaining < block.size() ? remaining : block.size();
+    }
+    if (out != stdout) {
+      std::fclose(out);
+    }
+  } catch (const std::exception &e) {
+    std::fprintf(stderr, "gen_corpus: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
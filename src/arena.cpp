@@ -0,0 +1,75 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace {
+
+// blocks double from the first size up to the largest, a small parse
+// stays small and a large one needs few blocks
+constexpr std::size_t arena_first_block = std::size_t{64} << 10;
+constexpr std::size_t arena_max_block = std::size_t{4} << 20;
+
+} // namespace
+
+ParseArena::ParseArena(ParseArena &&other) noexcept {
+  *this = std::move(other);
+}
+
+ParseArena &ParseArena::operator=(ParseArena &&other) noexcept {
+  if (this != &other) {
+    this->blocks = std::move(other.blocks);
+    this->cursor = std::exchange(other.cursor, nullptr);
+    this->limit = std::exchange(other.limit, nullptr);
+    this->used = std::exchange(other.used, 0);
+    this->reserved = std::exchange(other.reserved, 0);
+    other.blocks.clear();
+  }
+  return *this;
+}
+
+void *ParseArena::allocate(std::size_t size, std::size_t align) {
+  std::uintptr_t at = reinterpret_cast<std::uintptr_t>(this->cursor);
+  std::size_t padding = (align - at % align) % align;
+  if (this->cursor == nullptr ||
+      size + padding > static_cast<std::size_t>(this->limit - this->cursor)) {
+    std::size_t block = this->blocks.empty()
+                            ? arena_first_block
+                            : std::min(this->reserved, arena_max_block);
+    // oversized objects get a block of their own
+    block = std::max(block, size + align);
+    this->blocks.emplace_back(new char[block]);
+    this->cursor = this->blocks.back().get();
+    this->limit = this->cursor + block;
+    this->reserved += block;
+    at = reinterpret_cast<std::uintptr_t>(this->cursor);
+    padding = (align - at % align) % align;
+  }
+  char *result = this->cursor + padding;
+  this->cursor = result + size;
+  this->used += size;
+  return result;
+}
+
+void ParseArena::reset() noexcept {
+  if (this->blocks.empty()) {
+    return;
+  }
+  std::unique_ptr<char[]> newest = std::move(this->blocks.back());
+  // clear() keeps the capacity, push_back doesn't allocate
+  this->blocks.clear();
+  this->blocks.push_back(std::move(newest));
+  this->cursor = this->blocks[0].get();
+  this->reserved = static_cast<std::size_t>(this->limit - this->cursor);
+  this->used = 0;
+}
+
+std::size_t ParseArena::bytes_used() const noexcept { return this->used; }
+
+std::size_t ParseArena::bytes_reserved() const noexcept {
+  return this->reserved;
+}
+
+std::size_t ParseArena::block_count() const noexcept {
+  return this->blocks.size();
+}
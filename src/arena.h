@@ -0,0 +1,49 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// bump allocator: objects are carved out of large blocks one after the
+// other and are never freed one by one, all blocks go at once when the
+// arena does. destructors never run, so only trivially destructible types
+// can live in it
+class ParseArena {
+public:
+  ParseArena() = default;
+  ParseArena(const ParseArena &) = delete;
+  ParseArena &operator=(const ParseArena &) = delete;
+  // the moved-from arena is left empty
+  ParseArena(ParseArena &&other) noexcept;
+  ParseArena &operator=(ParseArena &&other) noexcept;
+
+  // align has to be a power of two
+  void *allocate(std::size_t size, std::size_t align);
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "arena objects are never destroyed");
+    return new (this->allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+  }
+  // drops everything allocated so far but keeps the newest block, the
+  // largest, to allocate from again. an arena reused for one parse after
+  // another stops going back to the system once it has grown
+  void reset() noexcept;
+  // bytes handed out, and what the blocks holding them take
+  std::size_t bytes_used() const noexcept;
+  std::size_t bytes_reserved() const noexcept;
+  std::size_t block_count() const noexcept;
+
+private:
+  std::vector<std::unique_ptr<char[]>> blocks;
+  char *cursor{nullptr};
+  char *limit{nullptr};
+  std::size_t used{0};
+  std::size_t reserved{0};
+};
+
+#endif // !ARENA_H
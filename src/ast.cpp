@@ -1,10 +1,333 @@
 #include "ast.h"
-#include <cassert>
+#include "expr_pool.h"
+#include "flat_tree.h"
 #include "globals.h"
+#include "helper.h"
+#include <sstream>
+#include <stdexcept>
+#include <utility>
 
-extern bool is_type(const Token tok);
-extern Token parser_token_to_token(const ParserToken& tok);
-extern void get_variant_value_and_assign_to(ParserTokenChunk& tok,
-																						SymbolTableEntryValue& var_to_assign);
+// lowers one parse tree. statements and expressions recurse as deep as the
+// parser did to build them, the ids of a list being built wait on pending
+// until the list is done, so nested lists don't interleave. a fn body asked
+// for or an expression read back from the pool is a tree of its own, tree
+// points at it while it is lowered
+class Lowering {
+public:
+  Lowering(const FlatTree &tree, const FnBodies &bodies, const ExprPool *exprs)
+      : tree(&tree), bodies(bodies), exprs(exprs) {}
 
+  ASTRoot run() {
+    if (this->tree->empty() || this->tree->kind(0) != ParserToken::START) {
+      throw std::runtime_error("lower: root node is not of type START");
+    }
+    std::size_t mark = this->pending.size();
+    for (std::uint32_t stmt = this->tree->first_child(0);
+         stmt != FlatTree::none; stmt = this->tree->next_sibling(stmt)) {
+      this->pending.push_back(this->statement(stmt));
+    }
+    this->close_list(mark, this->ast.first_statement,
+                     this->ast.statements_size);
+    // the AST outlives the parse, it keeps no room to grow
+    this->ast.nodes.shrink_to_fit();
+    this->ast.lists.shrink_to_fit();
+    return std::move(this->ast);
+  }
 
+private:
+  // the n-th child of node, none when there are fewer
+  std::uint32_t child(std::uint32_t node, std::size_t n) const {
+    std::uint32_t child = this->tree->first_child(node);
+    for (; n > 0 && child != FlatTree::none; n--) {
+      child = this->tree->next_sibling(child);
+    }
+    return child;
+  }
+
+  ASTId add(ASTNode node) {
+    this->ast.nodes.push_back(std::move(node));
+    return static_cast<ASTId>(this->ast.nodes.size() - 1);
+  }
+
+  // moves the ids pending since mark into a list
+  void close_list(std::size_t mark, std::uint32_t &first,
+                  std::uint32_t &count) {
+    first = static_cast<std::uint32_t>(this->ast.lists.size());
+    count = static_cast<std::uint32_t>(this->pending.size() - mark);
+    this->ast.lists.insert(this->ast.lists.end(), this->pending.begin() + mark,
+                           this->pending.end());
+    this->pending.resize(mark);
+  }
+
+  // the STMT children of a STMTS node's left brace, a body that wasn't
+  // parsed is asked for first
+  void block(std::uint32_t stmts) {
+    if (this->tree->kind(stmts) == ParserToken::LAZYBODY) {
+      if (!this->bodies) {
+        throw std::runtime_error("lower: a fn body wasn't parsed");
+      }
+      FlatTree body =
+          this->bodies(std::get<int>(this->tree->token(stmts).value));
+      const FlatTree *tree = this->tree;
+      this->tree = &body;
+      this->block(0);
+      this->tree = tree;
+      return;
+    }
+    std::uint32_t brace = this->tree->first_child(stmts);
+    if (brace == FlatTree::none) {
+      return;
+    }
+    for (std::uint32_t stmt = this->tree->first_child(brace);
+         stmt != FlatTree::none; stmt = this->tree->next_sibling(stmt)) {
+      this->pending.push_back(this->statement(stmt));
+    }
+  }
+
+  ASTId statement(std::uint32_t stmt) {
+    std::uint32_t node = this->tree->first_child(stmt);
+    ParserToken kind =
+        node == FlatTree::none ? ParserToken::UNDEFINED : this->tree->kind(node);
+    switch (kind) {
+    case ParserToken::VARDECL:
+      return this->var_decl(node);
+    case ParserToken::ASSIGNSTMT: {
+      ParserTokenChunk name = this->tree->token(this->child(node, 0));
+      ASTNode assign{ASTKind::ASSIGN, ParserToken::UNDEFINED, name.sym};
+      assign.value = name.value;
+      assign.lhs = this->expression(this->child(node, 2));
+      return this->add(std::move(assign));
+    }
+    case ParserToken::IFSTMT:
+    case ParserToken::WHILESTMT: {
+      // a while keeps its keyword as the first child
+      std::size_t at = kind == ParserToken::WHILESTMT ? 1 : 0;
+      ASTNode loop{kind == ParserToken::IFSTMT ? ASTKind::IF : ASTKind::WHILE};
+      loop.lhs = this->expression(this->child(node, at));
+      std::size_t mark = this->pending.size();
+      this->block(this->child(node, at + 1));
+      this->close_list(mark, loop.first, loop.count);
+      return this->add(std::move(loop));
+    }
+    case ParserToken::FNDECL:
+      return this->fn_decl(node);
+    case ParserToken::FNCALL: {
+      ParserTokenChunk name = this->tree->token(this->child(node, 1));
+      ASTNode call{ASTKind::CALL, ParserToken::UNDEFINED, name.sym};
+      call.value = name.value;
+      std::size_t mark = this->pending.size();
+      std::uint32_t factor = this->child(node, 2);
+      for (std::uint32_t arg = this->tree->first_child(factor);
+           arg != FlatTree::none; arg = this->tree->next_sibling(arg)) {
+        if (this->tree->kind(arg) == ParserToken::EXPR) {
+          this->pending.push_back(this->expression(arg));
+        }
+      }
+      this->close_list(mark, call.first, call.count);
+      return this->add(std::move(call));
+    }
+    default:
+      throw std::runtime_error("lower: unexpected statement " +
+                               token_to_string(kind));
+    }
+  }
+
+  // <type> <identifier> [= <expr>] ; and parameters, <type> <identifier>
+  ASTId var_decl(std::uint32_t node) {
+    ParserTokenChunk name = this->tree->token(this->child(node, 1));
+    ASTNode decl{ASTKind::VAR_DECL, this->tree->kind(this->child(node, 0)),
+                 name.sym};
+    decl.value = name.value;
+    std::uint32_t init = this->child(node, 3);
+    if (init != FlatTree::none && this->tree->kind(init) == ParserToken::EXPR) {
+      decl.lhs = this->expression(init);
+    }
+    return this->add(std::move(decl));
+  }
+
+  // FN IDENTIFIER COLON <type> FORMAL STMTS
+  ASTId fn_decl(std::uint32_t node) {
+    ParserTokenChunk name = this->tree->token(this->child(node, 1));
+    ASTNode fn{ASTKind::FN_DECL, this->tree->kind(this->child(node, 3)),
+               name.sym};
+    fn.value = name.value;
+    std::size_t mark = this->pending.size();
+    for (std::uint32_t param = this->tree->first_child(this->child(node, 4));
+         param != FlatTree::none; param = this->tree->next_sibling(param)) {
+      if (this->tree->kind(param) == ParserToken::VARIABLE) {
+        this->pending.push_back(this->var_decl(param));
+      }
+    }
+    fn.rhs = static_cast<ASTId>(this->pending.size() - mark);
+    this->block(this->child(node, 5));
+    this->close_list(mark, fn.first, fn.count);
+    return this->add(std::move(fn));
+  }
+
+  ASTId expression(std::uint32_t node) {
+    ParserToken kind = this->tree->kind(node);
+    switch (kind) {
+    case ParserToken::EXPR: {
+      std::uint32_t inner = this->tree->first_child(node);
+      if (inner == FlatTree::none) {
+        return this->pooled(
+            static_cast<ExprId>(std::get<int>(this->tree->token(node).value)));
+      }
+      // a parenthesized group is the expression inside it
+      if (this->tree->kind(inner) == ParserToken::LEFTPARENTHESIS) {
+        inner = this->tree->first_child(inner);
+      }
+      return this->expression(inner);
+    }
+    case ParserToken::BINOP: {
+      ASTNode binary{ASTKind::BINARY, this->tree->kind(this->child(node, 2))};
+      binary.lhs = this->expression(this->child(node, 0));
+      binary.rhs = this->expression(this->child(node, 1));
+      return this->add(std::move(binary));
+    }
+    case ParserToken::UNOP: {
+      ASTNode unary{ASTKind::UNARY, this->tree->kind(this->child(node, 0))};
+      unary.lhs = this->expression(this->child(node, 1));
+      return this->add(std::move(unary));
+    }
+    case ParserToken::IDENTIFIER: {
+      ParserTokenChunk name = this->tree->token(node);
+      ASTNode ref{ASTKind::NAME, ParserToken::UNDEFINED, name.sym};
+      ref.value = name.value;
+      return this->add(std::move(ref));
+    }
+    case ParserToken::INT:
+    case ParserToken::DOUBLE:
+    case ParserToken::STRING:
+    case ParserToken::CHAR:
+    case ParserToken::TRUEK:
+    case ParserToken::FALSEK: {
+      ParserTokenChunk tok = this->tree->token(node);
+      ASTNode literal{ASTKind::LITERAL, kind, tok.sym};
+      literal.value = tok.value;
+      return this->add(std::move(literal));
+    }
+    default:
+      throw std::runtime_error("lower: unexpected expression " +
+                               token_to_string(kind));
+    }
+  }
+
+  // an EXPR leaf standing for a pooled expression, whose subtree is
+  // expanded from the pool and lowered like any other
+  ASTId pooled(ExprId id) {
+    if (this->exprs == nullptr) {
+      throw std::runtime_error("lower: expressions were parsed into an "
+                               "ExprPool");
+    }
+    FlatTree expr;
+    std::vector<std::pair<ExprId, std::uint32_t>> pending{{id, FlatTree::none}};
+    while (!pending.empty()) {
+      auto [expr_id, parent] = pending.back();
+      pending.pop_back();
+      std::uint32_t node = expr.add_node(this->exprs->token(expr_id), parent);
+      // operands in reverse, so the first is added first
+      for (std::size_t i = this->exprs->operand_count(expr_id); i > 0; i--) {
+        pending.push_back({this->exprs->operand(expr_id, i - 1), node});
+      }
+    }
+    const FlatTree *tree = this->tree;
+    this->tree = &expr;
+    ASTId lowered = this->expression(0);
+    this->tree = tree;
+    return lowered;
+  }
+
+  const FlatTree *tree;
+  const FnBodies &bodies;
+  const ExprPool *exprs;
+  ASTRoot ast;
+  std::vector<ASTId> pending;
+};
+
+ASTRoot lower(const FlatTree &tree, const FnBodies &bodies,
+              const ExprPool *exprs) {
+  return Lowering(tree, bodies, exprs).run();
+}
+
+const ASTNode &ASTRoot::node(ASTId id) const { return this->nodes.at(id); }
+
+std::size_t ASTRoot::size() const noexcept { return this->nodes.size(); }
+
+const ASTId *ASTRoot::statements() const noexcept {
+  return this->lists.data() + this->first_statement;
+}
+
+std::size_t ASTRoot::statement_count() const noexcept {
+  return this->statements_size;
+}
+
+const ASTId *ASTRoot::list(const ASTNode &node) const noexcept {
+  return this->lists.data() + node.first;
+}
+
+std::size_t ASTRoot::memory_bytes() const noexcept {
+  return this->nodes.capacity() * sizeof(ASTNode) +
+         this->lists.capacity() * sizeof(ASTId);
+}
+
+static const char *kind_name(ASTKind kind) {
+  switch (kind) {
+  case ASTKind::VAR_DECL:
+    return "VAR_DECL";
+  case ASTKind::ASSIGN:
+    return "ASSIGN";
+  case ASTKind::IF:
+    return "IF";
+  case ASTKind::WHILE:
+    return "WHILE";
+  case ASTKind::FN_DECL:
+    return "FN_DECL";
+  case ASTKind::CALL:
+    return "CALL";
+  case ASTKind::BINARY:
+    return "BINARY";
+  case ASTKind::UNARY:
+    return "UNARY";
+  case ASTKind::LITERAL:
+    return "LITERAL";
+  default:
+    return "NAME";
+  }
+}
+
+// pre-order with an explicit stack: operands, then the list
+std::string ASTRoot::output() const {
+  std::ostringstream out;
+  std::vector<std::pair<ASTId, std::size_t>> pending;
+  for (std::size_t i = this->statements_size; i > 0; i--) {
+    pending.push_back({this->statements()[i - 1], 0});
+  }
+  while (!pending.empty()) {
+    auto [id, depth] = pending.back();
+    pending.pop_back();
+    const ASTNode &node = this->nodes[id];
+    out << std::string(2 * depth, ' ') << kind_name(node.kind);
+    if (node.type != ParserToken::UNDEFINED) {
+      out << " " << token_to_string(node.type);
+    }
+    if (node.kind != ASTKind::IF && node.kind != ASTKind::WHILE &&
+        node.kind != ASTKind::BINARY && node.kind != ASTKind::UNARY) {
+      out << " " << node.value;
+    }
+    out << "\n";
+    for (std::size_t i = node.count; i > 0; i--) {
+      pending.push_back({this->list(node)[i - 1], depth + 1});
+    }
+    if (node.kind == ASTKind::FN_DECL) {
+      continue;
+    }
+    if (node.rhs != no_ast) {
+      pending.push_back({node.rhs, depth + 1});
+    }
+    if (node.lhs != no_ast) {
+      pending.push_back({node.lhs, depth + 1});
+    }
+  }
+  return out.str();
+}
@@ -1,22 +1,92 @@
 #ifndef AST_H
 #define AST_H
 
-#include "semantic.h"
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
 
+class ExprPool;
+class FlatTree;
+
+using ASTId = std::uint32_t;
+inline constexpr ASTId no_ast = UINT32_MAX;
+
+enum class ASTKind : std::uint8_t {
+  VAR_DECL,
+  ASSIGN,
+  IF,
+  WHILE,
+  FN_DECL,
+  CALL,
+  BINARY,
+  UNARY,
+  LITERAL,
+  NAME,
+};
+
+// one node of the typed AST, operands are ids of other nodes and variable
+// length operands are a span of ASTRoot::list(). by kind:
+//   VAR_DECL  type, name, lhs the initializer or no_ast. also a parameter
+//   ASSIGN    name, lhs the value
+//   IF, WHILE lhs the condition, the list the body
+//   FN_DECL   type returned, name, the list the parameters (rhs of them)
+//             and then the body
+//   CALL      name, the list the arguments
+//   BINARY    type the operator, lhs and rhs
+//   UNARY     type the operator, lhs
+//   LITERAL   type and value
+//   NAME      name
+// a name is value and sym
+struct ASTNode {
+  ASTKind kind;
+  ParserToken type = ParserToken::UNDEFINED;
+  std::uint32_t sym = no_symbol;
+  ASTId lhs = no_ast;
+  ASTId rhs = no_ast;
+  std::uint32_t first = 0;
+  std::uint32_t count = 0;
+  TokenVariant value{};
+};
+
+// a program lowered from its parse tree: only statements and expressions,
+// none of the punctuation, braces or wrapper nodes the grammar needs. nodes
+// are one array and own no memory, a lowered program doesn't need its
+// parse tree any more. names and strings are views into the source
 class ASTRoot {
 public:
-  ASTRoot();
-  ~ASTRoot();
-  void add_child(PTNode *);
-  void print(const int);
-  std::string output();
-  PTNode *get_first_child();
-  PTNode *get_next_sibling();
+  ASTRoot() = default;
+
+  const ASTNode &node(ASTId id) const;
+  std::size_t size() const noexcept;
+  // the top-level statements
+  const ASTId *statements() const noexcept;
+  std::size_t statement_count() const noexcept;
+  // the span of node's list
+  const ASTId *list(const ASTNode &node) const noexcept;
+  std::size_t memory_bytes() const noexcept;
+  // one line per node, the kind and then its type, name or value
+  std::string output() const;
+
 private:
-  PTNode *first_child = nullptr;
-  PTNode *last_child = nullptr;
-  PTNode *next_sibling = nullptr;
-  PTNode *prev_sibling = nullptr;
+  friend class Lowering;
+  std::vector<ASTNode> nodes;
+  std::vector<ASTId> lists;
+  std::uint32_t first_statement{0};
+  std::uint32_t statements_size{0};
 };
 
+// the body of a fn left unparsed (see Parser::set_lazy_fn_bodies), given
+// the value of its LAZYBODY node, as a tree whose root is the STMTS node
+using FnBodies = std::function<FlatTree(int body)>;
+
+// bodies are asked for as lowering reaches them, and the expressions of a
+// tree parsed with Parser::set_expr_pool are read from exprs. throws
+// std::runtime_error for a tree it can't lower: an unparsed body without
+// bodies, or a pooled expression without exprs
+ASTRoot lower(const FlatTree &tree, const FnBodies &bodies = nullptr,
+              const ExprPool *exprs = nullptr);
+
 #endif
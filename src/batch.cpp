@@ -0,0 +1,230 @@
+#include "batch.h"
+#include "fd_writer.h"
+#include "lexer.h"
+#include "parser.h"
+#include "source.h"
+#include "thread_pool.h"
+#include "token_stream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+#include <utility>
+
+namespace {
+
+bool is_source_name(const std::string &name) {
+  for (const char *suffix : {".snip", ".snip.gz", ".snip.zst"}) {
+    std::size_t len = std::char_traits<char>::length(suffix);
+    if (name.size() > len &&
+        name.compare(name.size() - len, len, suffix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the files one thread has left. the owner takes from the front, where
+// the larger ones are, and thieves from the back
+struct WorkQueue {
+  std::mutex lock;
+  std::deque<std::size_t> files;
+};
+
+bool take(WorkQueue &queue, std::size_t &file, bool steal) {
+  std::lock_guard<std::mutex> guard(queue.lock);
+  if (queue.files.empty()) {
+    return false;
+  }
+  if (steal) {
+    file = queue.files.back();
+    queue.files.pop_back();
+  } else {
+    file = queue.files.front();
+    queue.files.pop_front();
+  }
+  return true;
+}
+
+Diagnostic file_error(std::string message) {
+  Diagnostic diagnostic;
+  diagnostic.message = std::move(message);
+  return diagnostic;
+}
+
+// errors from reading and lexing are exceptions, they end up as the
+// file's one diagnostic
+void parse_file(FileReport &report, ParseTree &tree) {
+  if (::access(report.path.c_str(), R_OK) != 0) {
+    report.diagnostics.add(file_error("can't read the file"));
+    return;
+  }
+  try {
+    SourceBuffer source = SourceBuffer::open(report.path);
+    report.bytes = source.size();
+    if (source.empty()) {
+      return;
+    }
+    TokenStream tokens;
+    Lexer lex(source);
+    lex.tokenize(tokens);
+    report.tokens = tokens.size();
+    tree.clear();
+    Parser parser(tokens);
+    parser.parse(tree, report.diagnostics);
+    report.nodes = tree.node_count();
+  } catch (const std::exception &e) {
+    report.diagnostics.add(file_error(e.what()));
+  }
+}
+
+} // namespace
+
+FileReport::FileReport(std::string path)
+    : path(path), diagnostics(std::move(path)) {}
+
+std::size_t BatchReport::bytes() const noexcept {
+  std::size_t total = 0;
+  for (const FileReport &file : this->files) {
+    total += file.bytes;
+  }
+  return total;
+}
+
+std::size_t BatchReport::tokens() const noexcept {
+  std::size_t total = 0;
+  for (const FileReport &file : this->files) {
+    total += file.tokens;
+  }
+  return total;
+}
+
+std::size_t BatchReport::nodes() const noexcept {
+  std::size_t total = 0;
+  for (const FileReport &file : this->files) {
+    total += file.nodes;
+  }
+  return total;
+}
+
+std::size_t BatchReport::error_count() const noexcept {
+  std::size_t total = 0;
+  for (const FileReport &file : this->files) {
+    total += file.diagnostics.error_count();
+  }
+  return total;
+}
+
+std::vector<std::string>
+collect_sources(const std::vector<std::string> &paths) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> sources;
+  for (const std::string &path : paths) {
+    std::error_code error;
+    if (!fs::is_directory(path, error)) {
+      sources.push_back(path);
+      continue;
+    }
+    std::vector<std::string> found;
+    for (fs::recursive_directory_iterator it(path, error), end;
+         !error && it != end; it.increment(error)) {
+      if (it->is_regular_file(error) &&
+          is_source_name(it->path().filename().string())) {
+        found.push_back(it->path().string());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    sources.insert(sources.end(), found.begin(), found.end());
+  }
+  return sources;
+}
+
+BatchReport parse_files(const std::vector<std::string> &paths,
+                        ThreadPool &pool) {
+  BatchReport report;
+  report.files.reserve(paths.size());
+  for (const std::string &path : paths) {
+    report.files.emplace_back(path);
+  }
+
+  // dealt out largest first, so the big files start early and the small
+  // ones at the end of every queue even the threads out
+  std::vector<std::pair<std::uintmax_t, std::size_t>> by_size;
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    std::error_code error;
+    std::uintmax_t size = std::filesystem::file_size(paths[i], error);
+    by_size.emplace_back(error ? 0 : size, i);
+  }
+  std::sort(by_size.begin(), by_size.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+  std::vector<WorkQueue> queues(pool.size());
+  for (std::size_t i = 0; i < by_size.size(); i++) {
+    queues[i % queues.size()].files.push_back(by_size[i].second);
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  pool.run(queues.size(), [&](std::size_t self) {
+    ParseTree tree;
+    std::size_t file;
+    for (;;) {
+      bool found = take(queues[self], file, false);
+      for (std::size_t i = 1; !found && i < queues.size(); i++) {
+        found = take(queues[(self + i) % queues.size()], file, true);
+      }
+      if (!found) {
+        return;
+      }
+      parse_file(report.files[file], tree);
+    }
+  });
+  auto end = std::chrono::steady_clock::now();
+  report.seconds = std::chrono::duration<double>(end - start).count();
+  return report;
+}
+
+void write_report(const BatchReport &report, FdWriter &out,
+                  DiagnosticFormat format) {
+  char line[256];
+  for (const FileReport &file : report.files) {
+    if (format == DiagnosticFormat::JSON) {
+      out.write("{\"file\": " + json_quote(file.path));
+      std::snprintf(line, sizeof(line),
+                    ", \"bytes\": %zu, \"tokens\": %zu, \"nodes\": %zu, "
+                    "\"errors\": %zu}\n",
+                    file.bytes, file.tokens, file.nodes,
+                    file.diagnostics.error_count());
+    } else {
+      out.write(file.path);
+      std::snprintf(line, sizeof(line),
+                    ": %zu bytes, %zu tokens, %zu nodes, %zu errors\n",
+                    file.bytes, file.tokens, file.nodes,
+                    file.diagnostics.error_count());
+    }
+    out.write(line);
+    file.diagnostics.emit(out, format);
+  }
+  double mb = report.bytes() / (1024.0 * 1024.0);
+  double mb_per_s = report.seconds > 0 ? mb / report.seconds : 0;
+  if (format == DiagnosticFormat::JSON) {
+    std::snprintf(line, sizeof(line),
+                  "{\"files\": %zu, \"bytes\": %zu, \"tokens\": %zu, "
+                  "\"nodes\": %zu, \"errors\": %zu, \"seconds\": %.6f, "
+                  "\"mb_per_s\": %.1f}\n",
+                  report.files.size(), report.bytes(), report.tokens(),
+                  report.nodes(), report.error_count(), report.seconds,
+                  mb_per_s);
+  } else {
+    std::snprintf(line, sizeof(line),
+                  "%zu files, %zu bytes, %zu tokens, %zu nodes, %zu errors "
+                  "in %.3fs, %.1f MB/s\n",
+                  report.files.size(), report.bytes(), report.tokens(),
+                  report.nodes(), report.error_count(), report.seconds,
+                  mb_per_s);
+  }
+  out.write(line);
+}
@@ -0,0 +1,50 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "diagnostics.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class FdWriter;
+class ThreadPool;
+
+// what lexing and parsing one file of a batch came to
+struct FileReport {
+  explicit FileReport(std::string path);
+
+  std::string path;
+  std::size_t bytes{0};
+  std::size_t tokens{0};
+  std::size_t nodes{0};
+  // syntax errors, and a file that can't be read or lexed
+  DiagnosticBuffer diagnostics;
+};
+
+struct BatchReport {
+  // in the order the paths were given
+  std::vector<FileReport> files;
+  double seconds{0};
+  std::size_t bytes() const noexcept;
+  std::size_t tokens() const noexcept;
+  std::size_t nodes() const noexcept;
+  std::size_t error_count() const noexcept;
+};
+
+// the files named by paths, with each directory replaced by the .snip
+// files under it (.snip.gz and .snip.zst too) in sorted order
+std::vector<std::string> collect_sources(const std::vector<std::string> &paths);
+
+// lexes and parses every file on its own, recovering from syntax errors.
+// the pool's threads each start on a share of the files, largest first,
+// and steal from the others once theirs run out. each thread parses into
+// one arena it resets between files
+BatchReport parse_files(const std::vector<std::string> &paths,
+                        ThreadPool &pool);
+
+// a line and the diagnostics per file in file order, then the totals and
+// throughput. json writes an object per line for each of those
+void write_report(const BatchReport &report, FdWriter &out,
+                  DiagnosticFormat format);
+
+#endif // !BATCH_H
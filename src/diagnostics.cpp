@@ -0,0 +1,116 @@
+#include "diagnostics.h"
+#include "fd_writer.h"
+#include <cstdio>
+
+namespace {
+
+const char *severity_name(Severity severity) {
+  switch (severity) {
+  case Severity::WARN:
+    return "warning";
+  case Severity::CRITICAL:
+    return "critical";
+  default:
+    return "error";
+  }
+}
+
+void append_diagnostic(std::string &out, const std::string &file,
+                       const Diagnostic &diagnostic, DiagnosticFormat format) {
+  if (format == DiagnosticFormat::JSON) {
+    out += "{\"file\": ";
+    out += json_quote(file);
+    out += ", \"line\": " + std::to_string(diagnostic.line);
+    out += ", \"column\": " + std::to_string(diagnostic.column);
+    out += ", \"severity\": \"";
+    out += severity_name(diagnostic.severity);
+    out += "\", \"message\": ";
+    out += json_quote(diagnostic.message);
+    out += "}\n";
+    return;
+  }
+  if (!file.empty()) {
+    out += file + ":";
+  }
+  if (diagnostic.line != 0) {
+    out += std::to_string(diagnostic.line) + ":" +
+           std::to_string(diagnostic.column) + ":";
+  }
+  if (!file.empty() || diagnostic.line != 0) {
+    out += ' ';
+  }
+  out += severity_name(diagnostic.severity);
+  out += ": " + diagnostic.message + "\n";
+}
+
+} // namespace
+
+// quotes, backslashes and control characters are escaped, the rest is
+// copied as is
+std::string json_quote(const std::string &text) {
+  std::string out = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+std::string to_string(const Diagnostic &diagnostic) {
+  if (diagnostic.line == 0) {
+    return diagnostic.message;
+  }
+  return std::to_string(diagnostic.line) + ":" +
+         std::to_string(diagnostic.column) + ": " + diagnostic.message;
+}
+
+DiagnosticBuffer::DiagnosticBuffer(std::string file) : file(std::move(file)) {}
+
+void DiagnosticBuffer::add(Diagnostic diagnostic) {
+  this->diagnostics.push_back(std::move(diagnostic));
+}
+
+std::size_t DiagnosticBuffer::size() const noexcept {
+  return this->diagnostics.size();
+}
+
+bool DiagnosticBuffer::empty() const noexcept {
+  return this->diagnostics.empty();
+}
+
+std::size_t DiagnosticBuffer::error_count() const noexcept {
+  std::size_t errors = 0;
+  for (const Diagnostic &diagnostic : this->diagnostics) {
+    errors += diagnostic.severity != Severity::WARN;
+  }
+  return errors;
+}
+
+const std::vector<Diagnostic> &DiagnosticBuffer::all() const noexcept {
+  return this->diagnostics;
+}
+
+std::string DiagnosticBuffer::format(DiagnosticFormat format) const {
+  std::string out;
+  for (const Diagnostic &diagnostic : this->diagnostics) {
+    append_diagnostic(out, this->file, diagnostic, format);
+  }
+  return out;
+}
+
+void DiagnosticBuffer::emit(FdWriter &out, DiagnosticFormat format) const {
+  std::string line;
+  for (const Diagnostic &diagnostic : this->diagnostics) {
+    line.clear();
+    append_diagnostic(line, this->file, diagnostic, format);
+    out.write(line);
+  }
+}
@@ -0,0 +1,85 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include "error.h"
+#include <cstddef>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+class FdWriter;
+
+// a problem found in a source. line and column are 1-based, both are 0
+// when there was no source text to locate it in
+struct Diagnostic {
+  Severity severity = Severity::ERROR;
+  std::size_t line = 0;
+  std::size_t column = 0;
+  std::string message;
+};
+
+// "line:column: message", or the message alone without a location
+std::string to_string(const Diagnostic &diagnostic);
+// text as a JSON string, quotes included
+std::string json_quote(const std::string &text);
+
+// the error side of an Expected, made by unexpected()
+template <typename E> struct Unexpected {
+  E error;
+};
+
+template <typename E> Unexpected<std::decay_t<E>> unexpected(E &&error) {
+  return {std::forward<E>(error)};
+}
+
+// a value or the error that kept it from being produced, for code that
+// reports failure by returning instead of throwing. a C++17 stand-in for
+// std::expected with only what the parser uses
+template <typename T, typename E = Diagnostic> class Expected {
+public:
+  Expected(T value) : result(std::in_place_index<0>, std::move(value)) {}
+  Expected(Unexpected<E> error)
+      : result(std::in_place_index<1>, std::move(error.error)) {}
+
+  bool has_value() const noexcept { return this->result.index() == 0; }
+  explicit operator bool() const noexcept { return this->has_value(); }
+  T &value() { return std::get<0>(this->result); }
+  const T &value() const { return std::get<0>(this->result); }
+  T &operator*() { return this->value(); }
+  E &error() { return std::get<1>(this->result); }
+  const E &error() const { return std::get<1>(this->result); }
+
+private:
+  std::variant<T, E> result;
+};
+
+enum class DiagnosticFormat { TEXT, JSON };
+
+// diagnostics collected over a run and written out together at the end,
+// rather than one unbuffered write per problem as it is found
+class DiagnosticBuffer {
+public:
+  // file names the source in the output, it can be empty
+  explicit DiagnosticBuffer(std::string file = "");
+
+  void add(Diagnostic diagnostic);
+  std::size_t size() const noexcept;
+  bool empty() const noexcept;
+  // errors and critical errors, warnings aren't counted
+  std::size_t error_count() const noexcept;
+  const std::vector<Diagnostic> &all() const noexcept;
+
+  // one line per diagnostic. text is "file:line:column: error: message",
+  // json is an object per line with file, line, column, severity and
+  // message
+  std::string format(DiagnosticFormat format) const;
+  void emit(FdWriter &out, DiagnosticFormat format) const;
+
+private:
+  std::string file;
+  std::vector<Diagnostic> diagnostics;
+};
+
+#endif // !DIAGNOSTICS_H
@@ -1,3 +1,6 @@
+#ifndef ERROR_H
+#define ERROR_H
+
 #include <iostream>
 #include <string>
 
@@ -31,3 +34,5 @@ private:
   std::string file_;
   int line_;
 };
+
+#endif // !ERROR_H
@@ -0,0 +1,171 @@
+#include "expr_pool.h"
+#include "fd_writer.h"
+#include "helper.h"
+#include "parser.h"
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+std::uint64_t mix(std::uint64_t hash, std::uint64_t value) noexcept {
+  hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+  return hash;
+}
+
+std::uint64_t hash_value(const TokenVariant &value) {
+  std::uint64_t hash = value.index();
+  if (const int *i = std::get_if<int>(&value)) {
+    return mix(hash, static_cast<std::uint64_t>(*i));
+  } else if (const std::string_view *text =
+                 std::get_if<std::string_view>(&value)) {
+    return mix(hash, std::hash<std::string_view>()(*text));
+  } else if (const double *d = std::get_if<double>(&value)) {
+    return mix(hash, std::hash<double>()(*d));
+  } else if (const bool *b = std::get_if<bool>(&value)) {
+    return mix(hash, *b);
+  }
+  return mix(hash, static_cast<unsigned char>(std::get<char>(value)));
+}
+
+} // namespace
+
+// operands are interned before the node that owns them, the walk keeps a
+// frame per level of nesting instead of recursing
+ExprId ExprPool::intern(PTNode *node) {
+  std::vector<Frame> &frames = this->frames;
+  frames.clear();
+  this->pending.clear();
+  frames.push_back({node, node->get_first_child(), 0});
+  for (;;) {
+    Frame &top = frames.back();
+    if (top.next_child != nullptr) {
+      PTNode *child = top.next_child;
+      top.next_child = child->get_next_sibling();
+      frames.push_back({child, child->get_first_child(), this->pending.size()});
+      continue;
+    }
+    ExprId id = this->intern(*top.node->get_val(),
+                             this->pending.data() + top.operands,
+                             this->pending.size() - top.operands);
+    this->pending.resize(top.operands);
+    frames.pop_back();
+    if (frames.empty()) {
+      return id;
+    }
+    this->pending.push_back(id);
+  }
+}
+
+ExprId ExprPool::intern(const ParserTokenChunk &tok, const ExprId *operands,
+                        std::size_t count) {
+  this->submitted++;
+  std::uint64_t hash = mix(static_cast<std::uint64_t>(tok.type), tok.sym);
+  hash = mix(hash, hash_value(tok.value));
+  for (std::size_t i = 0; i < count; i++) {
+    hash = mix(hash, operands[i]);
+  }
+  if (2 * (this->entries.size() + 1) > this->slots.size()) {
+    this->grow();
+  }
+  std::size_t mask = this->slots.size() - 1;
+  for (std::size_t i = hash & mask;; i = (i + 1) & mask) {
+    ExprId id = this->slots[i];
+    if (id == none) {
+      id = static_cast<ExprId>(this->entries.size());
+      this->entries.push_back(
+          {tok, hash, static_cast<std::uint32_t>(this->operands.size()),
+           static_cast<std::uint32_t>(count)});
+      this->operands.insert(this->operands.end(), operands, operands + count);
+      this->slots[i] = id;
+      return id;
+    }
+    if (this->entries[id].hash == hash &&
+        this->same(this->entries[id], tok, operands, count)) {
+      return id;
+    }
+  }
+}
+
+bool ExprPool::same(const Entry &entry, const ParserTokenChunk &tok,
+                    const ExprId *operands, std::size_t count) const {
+  if (entry.tok.type != tok.type || entry.tok.sym != tok.sym ||
+      entry.operand_count != count || !(entry.tok.value == tok.value)) {
+    return false;
+  }
+  const ExprId *own = this->operands.data() + entry.first_operand;
+  return std::equal(own, own + count, operands);
+}
+
+void ExprPool::grow() {
+  std::size_t size = this->slots.empty() ? 64 : 2 * this->slots.size();
+  this->slots.assign(size, none);
+  std::size_t mask = size - 1;
+  for (ExprId id = 0; id < this->entries.size(); id++) {
+    std::size_t i = this->entries[id].hash & mask;
+    while (this->slots[i] != none) {
+      i = (i + 1) & mask;
+    }
+    this->slots[i] = id;
+  }
+}
+
+const ParserTokenChunk &ExprPool::token(ExprId id) const {
+  return this->entries.at(id).tok;
+}
+
+std::size_t ExprPool::operand_count(ExprId id) const {
+  return this->entries.at(id).operand_count;
+}
+
+ExprId ExprPool::operand(ExprId id, std::size_t i) const {
+  return this->operands.at(this->entries.at(id).first_operand + i);
+}
+
+std::string ExprPool::output(ExprId id) const {
+  std::string out;
+  std::vector<std::pair<ExprId, std::size_t>> pending{{id, 0}};
+  while (!pending.empty()) {
+    auto [next, depth] = pending.back();
+    pending.pop_back();
+    out.append(2 * depth, ' ');
+    out += token_to_string(this->token(next).type);
+    out += '\n';
+    for (std::size_t i = this->operand_count(next); i > 0; i--) {
+      pending.push_back({this->operand(next, i - 1), depth + 1});
+    }
+  }
+  return out;
+}
+
+std::size_t ExprPool::size() const noexcept { return this->entries.size(); }
+
+std::size_t ExprPool::interned() const noexcept { return this->submitted; }
+
+double ExprPool::dedup_ratio() const noexcept {
+  return this->entries.empty()
+             ? 1.0
+             : static_cast<double>(this->submitted) / this->entries.size();
+}
+
+std::size_t ExprPool::tree_bytes() const noexcept {
+  return this->submitted * sizeof(PTNode);
+}
+
+std::size_t ExprPool::memory_bytes() const noexcept {
+  return this->entries.capacity() * sizeof(Entry) +
+         this->operands.capacity() * sizeof(ExprId) +
+         this->slots.capacity() * sizeof(ExprId);
+}
+
+void ExprPool::write_stats(FdWriter &out) const {
+  char line[256];
+  int n = std::snprintf(line, sizeof(line),
+                        "exprs interned=%zu unique=%zu dedup_ratio=%.2f "
+                        "tree_bytes=%zu pool_bytes=%zu\n",
+                        this->interned(), this->size(), this->dedup_ratio(),
+                        this->tree_bytes(), this->memory_bytes());
+  out.write(std::string_view(line, n));
+}
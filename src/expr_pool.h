@@ -0,0 +1,107 @@
+#ifndef EXPR_POOL_H
+#define EXPR_POOL_H
+
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+class FdWriter;
+class PTNode;
+
+using ExprId = std::uint32_t;
+
+// expression subtrees hash-consed into a DAG: each structurally distinct
+// subtree, its kind, payload and operands, is stored once under a dense
+// id, so identical subexpressions share one node. an operand always has a
+// smaller id than the expressions using it. string payloads are views into
+// the source, which has to outlive the pool
+class ExprPool {
+public:
+  ExprPool() = default;
+  ExprPool(const ExprPool &) = delete;
+  ExprPool &operator=(const ExprPool &) = delete;
+
+  // the id of the subtree under node, node included. any depth
+  ExprId intern(PTNode *node);
+  ExprId intern(const ParserTokenChunk &tok, const ExprId *operands,
+                std::size_t count);
+
+  const ParserTokenChunk &token(ExprId id) const;
+  std::size_t operand_count(ExprId id) const;
+  ExprId operand(ExprId id, std::size_t i) const;
+  // the text PTNode::output() gives for the subtree
+  std::string output(ExprId id) const;
+
+  // distinct subtrees
+  std::size_t size() const noexcept;
+  // nodes passed to intern(), shared or not
+  std::size_t interned() const noexcept;
+  // interned() per distinct subtree
+  double dedup_ratio() const noexcept;
+  // what the interned nodes would take as PTNodes, and what the pool takes
+  std::size_t tree_bytes() const noexcept;
+  std::size_t memory_bytes() const noexcept;
+  // exprs interned=... unique=... dedup_ratio=... and the two sizes
+  void write_stats(FdWriter &out) const;
+
+private:
+  static constexpr ExprId none = UINT32_MAX;
+  struct Entry {
+    ParserTokenChunk tok;
+    std::uint64_t hash;
+    std::uint32_t first_operand;
+    std::uint32_t operand_count;
+  };
+  bool same(const Entry &entry, const ParserTokenChunk &tok,
+            const ExprId *operands, std::size_t count) const;
+  void grow();
+
+  std::vector<Entry> entries;
+  // operand ids of every entry, back to back
+  std::vector<ExprId> operands;
+  // open addressing, ids of entries or none, a power of two long
+  std::vector<ExprId> slots;
+  // intern(PTNode *) keeps one frame per level of the subtree it walks,
+  // and the ids of the operands it has finished. both are reused
+  struct Frame {
+    PTNode *node;
+    PTNode *next_child;
+    std::size_t operands;
+  };
+  std::vector<Frame> frames;
+  std::vector<ExprId> pending;
+  std::size_t submitted{0};
+};
+
+// per-subtree results for a pass over a pool, each computed once however
+// many times its subtree occurs. compute(id) may ask for its operands'
+// results. a reference stays valid until the next get()
+template <typename T> class ExprMemo {
+public:
+  explicit ExprMemo(const ExprPool &pool) : pool(pool) {}
+
+  template <typename Compute> const T &get(ExprId id, Compute compute) {
+    if (id >= this->results.size()) {
+      this->results.resize(this->pool.size());
+    }
+    if (!this->results[id]) {
+      T result = compute(id);
+      this->results[id] = std::move(result);
+      this->computed++;
+    }
+    return *this->results[id];
+  }
+  // how many results were computed
+  std::size_t computed_count() const noexcept { return this->computed; }
+
+private:
+  const ExprPool &pool;
+  std::vector<std::optional<T>> results;
+  std::size_t computed{0};
+};
+
+#endif // !EXPR_POOL_H
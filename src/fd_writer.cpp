@@ -0,0 +1,73 @@
+#include "fd_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+
+FdWriter::FdWriter(int fd) : fd(fd), buffer(new char[buffer_size]) {}
+
+FdWriter::~FdWriter() {
+  try {
+    this->flush();
+  } catch (const std::runtime_error &) {
+  }
+}
+
+void FdWriter::write(std::string_view text) {
+  while (!text.empty()) {
+    if (this->used == buffer_size) {
+      this->flush();
+    }
+    std::size_t n = std::min(text.size(), buffer_size - this->used);
+    std::memcpy(this->buffer.get() + this->used, text.data(), n);
+    this->used += n;
+    text.remove_prefix(n);
+  }
+}
+
+void FdWriter::put(char c) {
+  if (this->used == buffer_size) {
+    this->flush();
+  }
+  this->buffer[this->used++] = c;
+}
+
+void FdWriter::fill(char c, std::size_t count) {
+  while (count != 0) {
+    if (this->used == buffer_size) {
+      this->flush();
+    }
+    std::size_t n = std::min(count, buffer_size - this->used);
+    std::memset(this->buffer.get() + this->used, c, n);
+    this->used += n;
+    count -= n;
+  }
+}
+
+// write(2) may take less than it is given, the rest is retried
+void FdWriter::flush() {
+  std::size_t done = 0;
+  while (done < this->used) {
+    ssize_t put = ::write(this->fd, this->buffer.get() + done,
+                          this->used - done);
+    if (put < 0 && errno == EINTR) {
+      continue;
+    }
+    if (put <= 0) {
+      // what didn't go out is dropped, the next flush doesn't retry it
+      this->flushed += done;
+      this->used = 0;
+      throw std::runtime_error(std::string("write failed: ") +
+                               std::strerror(errno));
+    }
+    done += static_cast<std::size_t>(put);
+  }
+  this->flushed += done;
+  this->used = 0;
+}
+
+std::size_t FdWriter::bytes_written() const noexcept {
+  return this->flushed + this->used;
+}
@@ -0,0 +1,37 @@
+#ifndef FD_WRITER_H
+#define FD_WRITER_H
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+// buffered output to a file descriptor. bytes are handed to write(2) a
+// buffer at a time, so a dump of any size holds at most buffer_size of it in
+// memory. throws std::runtime_error when the descriptor won't take them
+class FdWriter {
+public:
+  static constexpr std::size_t buffer_size = std::size_t{1} << 20;
+
+  // fd stays open and owned by the caller
+  explicit FdWriter(int fd);
+  FdWriter(const FdWriter &) = delete;
+  FdWriter &operator=(const FdWriter &) = delete;
+  // flushes, a failure at that point is dropped
+  ~FdWriter();
+
+  void write(std::string_view text);
+  void put(char c);
+  // count copies of c, for indentation
+  void fill(char c, std::size_t count);
+  void flush();
+  // everything passed in so far, flushed or not
+  std::size_t bytes_written() const noexcept;
+
+private:
+  int fd;
+  std::unique_ptr<char[]> buffer;
+  std::size_t used{0};
+  std::size_t flushed{0};
+};
+
+#endif // !FD_WRITER_H
@@ -0,0 +1,141 @@
+#include "flat_tree.h"
+#include "helper.h"
+#include "parser.h"
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+namespace {
+
+// nodes made from the parser's constant chunks carry only a kind
+bool has_payload(const ParserTokenChunk &tok) {
+  const std::string_view *text = std::get_if<std::string_view>(&tok.value);
+  return tok.sym != no_symbol || text == nullptr || !text->empty();
+}
+
+} // namespace
+
+// an explicit stack instead of recursion, the sibling chains of a long
+// statement list would otherwise be as deep as the list is long
+FlatTree::FlatTree(const ParseTree &tree) {
+  this->reserve(tree.node_count());
+  // END follows START at the top level
+  this->add_subtree(tree.root(), true);
+}
+
+FlatTree::FlatTree(PTNode *root) { this->add_subtree(root, false); }
+
+void FlatTree::add_subtree(PTNode *root, bool with_siblings) {
+  std::vector<std::pair<PTNode *, std::uint32_t>> pending;
+  if (root != nullptr) {
+    pending.emplace_back(root, none);
+  }
+  while (!pending.empty()) {
+    auto [node, parent] = pending.back();
+    pending.pop_back();
+    std::uint32_t index = this->add_node(*node->get_val(), parent);
+    // the sibling is visited after the whole subtree below node
+    if ((with_siblings || node != root) &&
+        node->get_next_sibling() != nullptr) {
+      pending.emplace_back(node->get_next_sibling(), parent);
+    }
+    if (node->get_first_child() != nullptr) {
+      pending.emplace_back(node->get_first_child(), index);
+    }
+  }
+}
+
+void FlatTree::reserve(std::size_t nodes) {
+  this->kinds.reserve(nodes);
+  this->depths.reserve(nodes);
+  this->parents.reserve(nodes);
+  this->first_children.reserve(nodes);
+  this->last_children.reserve(nodes);
+  this->next_siblings.reserve(nodes);
+  this->payloads.reserve(nodes);
+  // pages reserved and never written cost nothing, most nodes have no
+  // payload
+  this->values.reserve(nodes);
+  this->syms.reserve(nodes);
+}
+
+std::uint32_t FlatTree::add_node(const ParserTokenChunk &tok,
+                                 std::uint32_t parent) {
+  if (this->kinds.size() >= none) {
+    throw std::length_error("too many parse tree nodes");
+  }
+  std::uint32_t index = static_cast<std::uint32_t>(this->kinds.size());
+  std::uint32_t payload = none;
+  if (has_payload(tok)) {
+    payload = static_cast<std::uint32_t>(this->values.size());
+    this->values.push_back(tok.value);
+    this->syms.push_back(tok.sym);
+  }
+  this->kinds.push_back(tok.type);
+  this->depths.push_back(parent == none ? 0 : this->depths[parent] + 1);
+  this->parents.push_back(parent);
+  this->first_children.push_back(none);
+  this->last_children.push_back(none);
+  this->next_siblings.push_back(none);
+  this->payloads.push_back(payload);
+  std::uint32_t &previous =
+      parent == none ? this->last_top_level : this->last_children[parent];
+  if (previous != none) {
+    this->next_siblings[previous] = index;
+  } else if (parent != none) {
+    this->first_children[parent] = index;
+  }
+  previous = index;
+  return index;
+}
+
+std::size_t FlatTree::size() const noexcept { return this->kinds.size(); }
+
+bool FlatTree::empty() const noexcept { return this->kinds.empty(); }
+
+ParserToken FlatTree::kind(std::uint32_t node) const noexcept {
+  return this->kinds[node];
+}
+
+std::uint32_t FlatTree::depth(std::uint32_t node) const noexcept {
+  return this->depths[node];
+}
+
+std::uint32_t FlatTree::parent(std::uint32_t node) const noexcept {
+  return this->parents[node];
+}
+
+std::uint32_t FlatTree::first_child(std::uint32_t node) const noexcept {
+  return this->first_children[node];
+}
+
+std::uint32_t FlatTree::next_sibling(std::uint32_t node) const noexcept {
+  return this->next_siblings[node];
+}
+
+ParserTokenChunk FlatTree::token(std::uint32_t node) const {
+  std::uint32_t payload = this->payloads[node];
+  if (payload == none) {
+    return {this->kinds[node], ""};
+  }
+  return {this->kinds[node], this->values[payload], this->syms[payload]};
+}
+
+std::string FlatTree::output() const {
+  std::stringstream ss;
+  for (std::uint32_t i = 0; i < this->size(); i++) {
+    ss << std::string(2 * this->depths[i], ' ')
+       << token_to_string(this->kinds[i]) << std::endl;
+  }
+  return ss.str();
+}
+
+void FlatTree::print(std::ostream &out) const {
+  for (std::uint32_t i = 0; i < this->size(); i++) {
+    out << std::string(2 * this->depths[i], ' ')
+        << token_to_string(this->kinds[i]) << " " << this->token(i).value
+        << std::endl;
+  }
+}
@@ -0,0 +1,65 @@
+#ifndef FLAT_TREE_H
+#define FLAT_TREE_H
+
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+class ParseTree;
+class PTNode;
+
+// a parse tree as parallel arrays indexed by node. links are 32-bit
+// indices and append is O(1) through a last-child array. when every subtree
+// is finished before its next sibling is added, as in the one made from a
+// ParseTree, the nodes are in pre-order and printing the tree or visiting
+// every node is a scan from 0 to size(). only nodes carrying a literal or a
+// name have a payload entry
+class FlatTree {
+public:
+  static constexpr std::uint32_t none = UINT32_MAX;
+
+  FlatTree() = default;
+  // flattens tree in pre-order
+  explicit FlatTree(const ParseTree &tree);
+  // the subtree under root, root included and its siblings left out
+  explicit FlatTree(PTNode *root);
+  void reserve(std::size_t nodes);
+  // appends tok as the last child of parent, or after the last top-level
+  // node when parent is none. returns the new node's index
+  std::uint32_t add_node(const ParserTokenChunk &tok,
+                         std::uint32_t parent = none);
+
+  std::size_t size() const noexcept;
+  bool empty() const noexcept;
+  ParserToken kind(std::uint32_t node) const noexcept;
+  std::uint32_t depth(std::uint32_t node) const noexcept;
+  std::uint32_t parent(std::uint32_t node) const noexcept;
+  std::uint32_t first_child(std::uint32_t node) const noexcept;
+  std::uint32_t next_sibling(std::uint32_t node) const noexcept;
+  // kind, value and id of a node, value is "" without a payload
+  ParserTokenChunk token(std::uint32_t node) const;
+
+  // the same text as PTNode::output() and PTNode::print() on the root,
+  // for a tree in pre-order
+  std::string output() const;
+  void print(std::ostream &out) const;
+
+private:
+  void add_subtree(PTNode *root, bool with_siblings);
+  std::vector<ParserToken> kinds;
+  std::vector<std::uint32_t> depths;
+  std::vector<std::uint32_t> parents;
+  std::vector<std::uint32_t> first_children;
+  std::vector<std::uint32_t> last_children;
+  std::vector<std::uint32_t> next_siblings;
+  // index into values and syms, none for nodes without a payload
+  std::vector<std::uint32_t> payloads;
+  std::vector<TokenVariant> values;
+  std::vector<std::uint32_t> syms;
+  std::uint32_t last_top_level{none};
+};
+
+#endif // !FLAT_TREE_H
@@ -1,7 +1,10 @@
 #ifndef GLOBAL_H
 #define GLOBAL_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <variant>
 #include <stdexcept>
 
@@ -136,6 +139,10 @@ enum class ParserToken {
   DIGIT = 53,
   TYPE = 54,
   ASSIGNSTMT = 55,
+  UNOP = 56,
+  // a fn body that was brace-matched but not parsed yet, see
+  // Parser::set_lazy_fn_bodies
+  LAZYBODY = 57,
 };
 
 union TokenValue {
@@ -144,14 +151,35 @@ union TokenValue {
   char literal;
 };
 
+// part of the key of every cached parse tree (see tree_cache.h), a new
+// release never reads trees an older one wrote
+inline constexpr const char snip_version[] = "0.1.0";
+// the shape of the trees the parser builds, also part of the key. bumped
+// with every change to it, so a tree cached before the change isn't read
+// back: 2 keeps the callee IDENTIFIER under FNCALL
+inline constexpr std::uint32_t tree_schema = 2;
+
+// names, punctuation and string literals are views into the source buffer
+// owned by the Lexer, so tokens never copy text and stay valid only as long
+// as that Lexer does
+typedef std::variant<int, std::string_view, double, bool, char> TokenVariant;
+
+// identifiers and string literals also carry their interned id (see
+// interner.h), every other token has no_symbol
+inline constexpr std::uint32_t no_symbol = UINT32_MAX;
+
 struct TokenChunk {
   Token type = Token::UNDEFINED;
-  std::variant<int, std::string, double, bool, char> value;
+  TokenVariant value;
+  std::uint32_t sym = no_symbol;
+  // byte offset of the token's first character in the source
+  std::size_t offset = 0;
 };
 
 struct ParserTokenChunk {
   ParserToken type = ParserToken::UNDEFINED;
-  std::variant<int, std::string, double, bool, char> value;
+  TokenVariant value;
+  std::uint32_t sym = no_symbol;
 };
 
 typedef std::variant<int, std::string, double, bool, char>
@@ -1,11 +1,21 @@
+#include "fd_writer.h"
 #include "globals.h"
+#include "helper.h"
+#include "memory_stats.h"
 #include "parser.h"
+#include "source.h"
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <type_traits>
+#include <unistd.h>
+#include <variant>
 
 const std::string token_to_string(const Token &tok) {
   switch (tok) {
@@ -208,6 +218,10 @@ const std::string token_to_string(const ParserToken &tok) {
     return "STMT";
   case ParserToken::ASSIGNSTMT:
     return "ASSIGNSTMT";
+  case ParserToken::UNOP:
+    return "UNOP";
+  case ParserToken::LAZYBODY:
+    return "LAZYBODY";
   case ParserToken::STMTS:
     return "STMTS";
   case ParserToken::EXPR:
@@ -241,52 +255,93 @@ const std::string token_to_string(const ParserToken &tok) {
   }
 }
 
-void print_lexed_tokens(std::unique_ptr<TokenChunk[]> &token_stack) {
-  int i{0};
+std::ostream &operator<<(std::ostream &os, const TokenVariant &value) {
+  std::visit([&os](const auto &v) { os << v; }, value);
+  return os;
+}
+
+void write_token_value(FdWriter &out, const TokenVariant &value) {
+  char digits[32];
+  if (const int *i = std::get_if<int>(&value)) {
+    char *end = std::to_chars(digits, digits + sizeof(digits), *i).ptr;
+    out.write(std::string_view(digits, end - digits));
+  } else if (const std::string_view *text =
+                 std::get_if<std::string_view>(&value)) {
+    out.write(*text);
+  } else if (const double *d = std::get_if<double>(&value)) {
+    int n = std::snprintf(digits, sizeof(digits), "%g", *d);
+    out.write(std::string_view(digits, n));
+  } else if (const bool *b = std::get_if<bool>(&value)) {
+    out.put(*b ? '1' : '0');
+  } else {
+    out.put(std::get<char>(value));
+  }
+}
+
+void print_lexed_tokens(TokenArray &token_stack) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  std::size_t i{0};
   while (token_stack[i].type != Token::END) {
-    std::string s = token_to_string(token_stack[i].type);
-    if (token_stack[i].type == Token::DOUBLE) {
-      std::cout << token_to_string(token_stack[i].type) << " "
-                << std::get<std::string>(token_stack[i].value) << std::endl;
-    } else if (token_stack[i].type == Token::INT) {
-      std::cout << token_to_string(token_stack[i].type) << " "
-                << std::get<int>(token_stack[i].value) << std::endl;
-    } else
-      std::cout << token_to_string(token_stack[i].type) << " "
-                << std::get<std::string>(token_stack[i].value) << std::endl;
+    std::cout << token_to_string(token_stack[i].type) << " "
+              << token_stack[i].value << std::endl;
     i++;
   }
   std::cout << token_to_string(token_stack[i].type) << std::endl;
 }
 
-void print_parsed_tokens(std::unique_ptr<PTNode> &token_stack) {
-  token_stack->print(0);
+void print_lexed_tokens(const TokenStream &tokens) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  std::size_t payload{0};
+  for (std::size_t i = 0; i < tokens.size(); i++) {
+    TokenChunk tok = tokens.token(i, payload);
+    payload += token_has_payload(tok.type);
+    if (tok.type == Token::END) {
+      std::cout << token_to_string(tok.type) << std::endl;
+      break;
+    }
+    std::cout << token_to_string(tok.type) << " " << tok.value << std::endl;
+  }
+}
+
+// streamed straight to stdout, the dump isn't built up in memory first
+void print_parsed_tokens(const ParseTree &tree) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  if (tree.root() == nullptr) {
+    return;
+  }
+  std::cout.flush();
+  FdWriter out(STDOUT_FILENO);
+  tree.root()->write(out);
+  out.flush();
 }
 
 std::string
-print_lexed_tokens_test(std::unique_ptr<TokenChunk[]> &token_stack) {
+print_lexed_tokens_test(TokenArray &token_stack) {
   std::stringstream ss;
-  int i{0};
+  std::size_t i{0};
   while (token_stack[i].type != Token::END) {
-    std::string s = token_to_string(token_stack[i].type);
     ss << token_to_string(token_stack[i].type) << std::endl;
     i++;
   }
   return ss.str();
 }
 
-std::string readFile(const std::string &filename) {
-  std::ifstream file(filename);
-  if (!file.is_open()) {
-    std::cerr << "Unable to open source file" << std::endl;
+std::string print_lexed_tokens_test(const TokenStream &tokens) {
+  std::stringstream ss;
+  for (std::size_t i = 0; tokens.kind(i) != Token::END; i++) {
+    ss << token_to_string(tokens.kind(i)) << std::endl;
   }
-  std::string source((std::istreambuf_iterator<char>(file)),
-                     std::istreambuf_iterator<char>());
-  file.close();
-  return source;
+  return ss.str();
+}
+
+// prefer SourceBuffer::open(), which maps the file instead of copying it
+std::string readFile(const std::string &filename) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  return std::string(SourceBuffer::open(filename).view());
 }
 
 void writeFile(const std::string &filename, const std::string &output) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
   std::ofstream file(filename);
   if (!file.is_open()) {
     std::cerr << "Unable to open output file" << std::endl;
@@ -295,42 +350,66 @@ void writeFile(const std::string &filename, const std::string &output) {
   file.close();
 }
 
-bool get_flags(const int &argc, char *argv[], std::string &filename,
-               std::string &parseString, std::string &test_string) {
-  if (argc == 1)
-    return 0;
-  if (argc == 2) {
-    filename = argv[1];
-    return 0;
-  } else if (argc == 3) {
-    if (std::strcmp(argv[1], "-e")) {
-      parseString = argv[2];
-    }
-  }
-  char *currentFlag;
-  bool isTest{false};
-  for (int count{0}; count < argc; count++) {
-    if (count % 2) {
-      currentFlag = argv[count];
-    } else {
-      if (strcmp(currentFlag, "-e") == 0) {
-        parseString = argv[count];
-      } else if (strcmp(currentFlag, "-t") == 0) {
-        isTest = true;
-        test_string = argv[count];
+// -e <source> lexes the string instead of a file, -t <file> writes the
+// lexed token types to file, -s parses while lexing without keeping the
+// token array, -j <threads> lexes on that many threads. -k parses past
+// syntax errors and reports all of them at the end, -d text|json picks how
+// and implies -k. -c <dir> caches parse trees in dir and -C <dir> empties
+// that cache. -m reports heap use by phase on exit, -l leaves fn bodies
+// unparsed, -x shares identical expressions, -a prints the typed AST.
+// anything else is a source file, or a directory of them. arguments that
+// can't be used leave a message in flags.error
+Flags get_flags(const int &argc, char *argv[]) {
+  Flags flags;
+  for (int count{1}; count < argc; count++) {
+    bool has_value = count + 1 < argc;
+    if (std::strcmp(argv[count], "-e") == 0 && has_value) {
+      flags.parse_string = argv[++count];
+    } else if (std::strcmp(argv[count], "-t") == 0 && has_value) {
+      flags.is_test = true;
+      flags.test_filename = argv[++count];
+    } else if (std::strcmp(argv[count], "-j") == 0 && has_value) {
+      flags.threads = std::strtoul(argv[++count], nullptr, 10);
+    } else if (std::strcmp(argv[count], "-s") == 0) {
+      flags.stream = true;
+    } else if (std::strcmp(argv[count], "-c") == 0 && has_value) {
+      flags.cache_dir = argv[++count];
+    } else if (std::strcmp(argv[count], "-C") == 0 && has_value) {
+      flags.clear_cache = true;
+      flags.cache_dir = argv[++count];
+    } else if (std::strcmp(argv[count], "-a") == 0) {
+      flags.print_ast = true;
+    } else if (std::strcmp(argv[count], "-x") == 0) {
+      flags.share_exprs = true;
+    } else if (std::strcmp(argv[count], "-l") == 0) {
+      flags.lazy_fn_bodies = true;
+    } else if (std::strcmp(argv[count], "-m") == 0) {
+      flags.memory_stats = true;
+    } else if (std::strcmp(argv[count], "-k") == 0) {
+      flags.keep_going = true;
+    } else if (std::strcmp(argv[count], "-d") == 0 && has_value) {
+      flags.keep_going = true;
+      const char *format = argv[++count];
+      if (std::strcmp(format, "json") == 0) {
+        flags.diagnostics = DiagnosticFormat::JSON;
+      } else if (std::strcmp(format, "text") == 0) {
+        flags.diagnostics = DiagnosticFormat::TEXT;
       } else {
-        filename = argv[count];
+        flags.error = std::string("-d expects text or json, not ") + format;
       }
+    } else {
+      flags.filename = argv[count];
+      flags.files.push_back(argv[count]);
     }
   }
-  return isTest;
+  return flags;
 }
 
 
 void get_variant_value_and_assign_to(ParserTokenChunk& tok,
 																		 SymbolTableEntryValue& var_to_assign) {
   if (tok.type == ParserToken::STRING) {
-    var_to_assign = std::get<std::string>(tok.value);
+    var_to_assign = std::string(std::get<std::string_view>(tok.value));
   } else if (tok.type == ParserToken::INT) {
     var_to_assign = std::get<int>(tok.value);
   } else if (tok.type == ParserToken::CHAR) {
@@ -342,7 +421,17 @@ void get_variant_value_and_assign_to(ParserTokenChunk& tok,
   }
 }
 
+// the view returned for a string points into the symbol table entry
 void get_variant_value_and_assign_to(SymbolTableEntryValue& tok,
-																		 SymbolTableEntryValue& var_to_assign) {
-		var_to_assign = tok;
+																		 TokenVariant& var_to_assign) {
+  std::visit(
+      [&var_to_assign](const auto &v) {
+        using T = std::decay_t<decltype(v)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          var_to_assign = std::string_view(v);
+        } else {
+          var_to_assign = v;
+        }
+      },
+      tok);
 }
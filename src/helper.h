@@ -1,15 +1,54 @@
 #include "globals.h"
 #include "parser.h"
+#include "token_stream.h"
 #include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
 
 const std::string token_to_string(const Token &tok);
 const std::string token_to_string(const ParserToken &tok);
+std::ostream &operator<<(std::ostream &os, const TokenVariant &value);
+// the text operator<< gives, without going through a stream
+void write_token_value(FdWriter &out, const TokenVariant &value);
 
-void print_lexed_tokens(std::unique_ptr<TokenChunk[]> &);
-void print_parsed_tokens(std::unique_ptr<PTNode> &token_stack);
-std::string print_lexed_tokens_test(std::unique_ptr<TokenChunk[]> &);
+void print_lexed_tokens(TokenArray &);
+void print_lexed_tokens(const TokenStream &);
+void print_parsed_tokens(const ParseTree &tree);
+std::string print_lexed_tokens_test(TokenArray &);
+std::string print_lexed_tokens_test(const TokenStream &);
 
 std::string readFile(const std::string &filename);
 void writeFile(const std::string &filename, const std::string &output);
-bool get_flags(const int &argc, char *argv[], std::string &filename,
-               std::string &parseString, std::string &test_string);
+
+struct Flags {
+  std::string filename = "input.snip";
+  // every file or directory named, more than one or a directory parses
+  // them all as a batch, see batch.h
+  std::vector<std::string> files;
+  std::string parse_string = "";
+  std::string test_filename = "output.txt";
+  bool is_test{false};
+  bool stream{false};
+  // collect syntax errors and keep parsing, see Parser::parse
+  bool keep_going{false};
+  // brace-match fn bodies instead of parsing them, see
+  // Parser::set_lazy_fn_bodies
+  bool lazy_fn_bodies{false};
+  // share identical expressions, see Parser::set_expr_pool
+  bool share_exprs{false};
+  // print the typed AST instead of the parse tree, see ast.h
+  bool print_ast{false};
+  DiagnosticFormat diagnostics{DiagnosticFormat::TEXT};
+  // parse trees are cached here, see tree_cache.h
+  std::string cache_dir = "";
+  bool clear_cache{false};
+  // heap use by phase, see memory_stats.h
+  bool memory_stats{false};
+  // lexing threads, 0 means one per core
+  std::size_t threads{1};
+  // why the arguments can't be used, empty when they can
+  std::string error = "";
+};
+
+Flags get_flags(const int &argc, char *argv[]);
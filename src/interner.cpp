@@ -0,0 +1,51 @@
+#include "interner.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace {
+
+constexpr std::size_t interner_block_bytes = std::size_t{64} << 10;
+
+} // namespace
+
+std::uint32_t Interner::intern(std::string_view name) {
+  auto it = this->ids.find(name);
+  if (it != this->ids.end()) {
+    return it->second;
+  }
+  if (this->names.size() >= no_symbol) {
+    throw std::length_error("too many distinct names to intern");
+  }
+  std::uint32_t sym = static_cast<std::uint32_t>(this->names.size());
+  std::string_view stored = this->store(name);
+  this->names.push_back(stored);
+  this->ids.emplace(stored, sym);
+  return sym;
+}
+
+std::uint32_t Interner::find(std::string_view name) const {
+  auto it = this->ids.find(name);
+  return it == this->ids.end() ? no_symbol : it->second;
+}
+
+std::string_view Interner::name(std::uint32_t sym) const {
+  return this->names.at(sym);
+}
+
+std::size_t Interner::size() const noexcept { return this->names.size(); }
+
+std::string_view Interner::store(std::string_view name) {
+  if (this->blocks.empty() ||
+      name.size() > this->block_size - this->block_used) {
+    // oversized names get a block of their own
+    std::size_t size = std::max(interner_block_bytes, name.size());
+    this->blocks.push_back(std::make_unique<char[]>(size));
+    this->block_used = 0;
+    this->block_size = size;
+  }
+  char *dest = this->blocks.back().get() + this->block_used;
+  std::memcpy(dest, name.data(), name.size());
+  this->block_used += name.size();
+  return std::string_view(dest, name.size());
+}
@@ -0,0 +1,38 @@
+#ifndef INTERNER_H
+#define INTERNER_H
+
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// maps every distinct identifier and string literal to a dense 32-bit id,
+// handed out in order of first appearance. the interner keeps its own copy
+// of each name, so ids and names outlive the source they were lexed from
+class Interner {
+public:
+  Interner() = default;
+  Interner(const Interner &) = delete;
+  Interner &operator=(const Interner &) = delete;
+
+  std::uint32_t intern(std::string_view name);
+  // no_symbol when the name was never interned
+  std::uint32_t find(std::string_view name) const;
+  std::string_view name(std::uint32_t sym) const;
+  std::size_t size() const noexcept;
+
+private:
+  std::string_view store(std::string_view name);
+
+  std::unordered_map<std::string_view, std::uint32_t> ids;
+  std::vector<std::string_view> names;
+  // names are packed into fixed blocks, so views into them never move
+  std::vector<std::unique_ptr<char[]>> blocks;
+  std::size_t block_used{0};
+  std::size_t block_size{0};
+};
+
+#endif // !INTERNER_H
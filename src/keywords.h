@@ -0,0 +1,144 @@
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include "globals.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+struct Keyword {
+  std::string_view text;
+  Token type;
+};
+
+// the single source of truth for reserved words and operator words, the
+// perfect hash below is generated from this list at compile time
+inline constexpr std::array<Keyword, 21> keywords{{
+    {"if", Token::IF},
+    {"else", Token::ELSE},
+    {"elif", Token::ELIF},
+    {"int", Token::INTK},
+    {"double", Token::DOUBLEK},
+    {"bool", Token::BOOLK},
+    {"str", Token::STRINGK},
+    {"char", Token::CHARK},
+    {"fn", Token::FN},
+    {"while", Token::WHILE},
+    {"t", Token::TRUEK},
+    {"f", Token::FALSEK},
+    {"=", Token::ASSIGN},
+    {"==", Token::EQUAL},
+    {"&&", Token::AND},
+    {"||", Token::OR},
+    {"<", Token::LESSERTHAN},
+    {">", Token::GREATERTHAN},
+    {"<=", Token::LESSTHANEQUAL},
+    {">=", Token::GREATERTHANEQUAL},
+    {"!=", Token::NOTEQUAL},
+}};
+
+inline constexpr std::size_t keyword_table_bits = 6;
+inline constexpr std::size_t keyword_table_size = 1 << keyword_table_bits;
+
+constexpr std::size_t max_keyword_length() {
+  std::size_t longest = 0;
+  for (const Keyword &kw : keywords) {
+    if (kw.text.size() > longest)
+      longest = kw.text.size();
+  }
+  return longest;
+}
+
+// only the length and the first and last bytes are hashed, so a lookup costs
+// the same no matter how long the word is; the full compare happens once
+constexpr std::size_t keyword_hash(std::uint32_t seed, const char *word,
+                                   std::size_t len) {
+  std::uint32_t key = static_cast<unsigned char>(word[0]) |
+                      static_cast<unsigned char>(word[len - 1]) << 8 |
+                      static_cast<std::uint32_t>(len) << 16;
+  return static_cast<std::uint32_t>(key * seed) >> (32 - keyword_table_bits);
+}
+
+constexpr bool keyword_seed_is_perfect(std::uint32_t seed) {
+  std::array<bool, keyword_table_size> used{};
+  for (const Keyword &kw : keywords) {
+    std::size_t slot = keyword_hash(seed, kw.text.data(), kw.text.size());
+    if (used[slot])
+      return false;
+    used[slot] = true;
+  }
+  return true;
+}
+
+constexpr std::uint32_t find_keyword_seed() {
+  for (std::uint32_t seed = 0x9E3779B1u;; seed += 2) {
+    if (keyword_seed_is_perfect(seed))
+      return seed;
+  }
+}
+
+inline constexpr std::uint32_t keyword_seed = find_keyword_seed();
+
+// slot -> index into keywords, -1 for an empty slot
+constexpr std::array<std::int8_t, keyword_table_size> build_keyword_slots() {
+  std::array<std::int8_t, keyword_table_size> slots{};
+  for (std::int8_t &slot : slots)
+    slot = -1;
+  for (std::size_t i = 0; i < keywords.size(); i++) {
+    std::size_t slot =
+        keyword_hash(keyword_seed, keywords[i].text.data(), keywords[i].text.size());
+    slots[slot] = static_cast<std::int8_t>(i);
+  }
+  return slots;
+}
+
+inline constexpr std::array<std::int8_t, keyword_table_size> keyword_slots =
+    build_keyword_slots();
+
+// returns Token::IDENTIFIER when the word is not a keyword
+constexpr Token lookup_keyword(const char *word, std::size_t len) {
+  if (len == 0 || len > max_keyword_length())
+    return Token::IDENTIFIER;
+  std::int8_t index = keyword_slots[keyword_hash(keyword_seed, word, len)];
+  if (index < 0 || keywords[index].text != std::string_view(word, len))
+    return Token::IDENTIFIER;
+  return keywords[index].type;
+}
+
+static_assert(lookup_keyword("while", 5) == Token::WHILE);
+static_assert(lookup_keyword(">=", 2) == Token::GREATERTHANEQUAL);
+static_assert(lookup_keyword("whale", 5) == Token::IDENTIFIER);
+
+// character classes used to classify a word in a single pass
+enum CharClass : std::uint8_t {
+  CHAR_OTHER = 0,
+  CHAR_DIGIT = 1,
+  CHAR_IDENT_START = 2, // [A-Za-z_]
+  CHAR_IDENT = CHAR_DIGIT | CHAR_IDENT_START,
+  // any byte of a multi-byte UTF-8 sequence, see unicode.h
+  CHAR_NON_ASCII = 4,
+};
+
+constexpr std::array<std::uint8_t, 256> build_char_classes() {
+  std::array<std::uint8_t, 256> classes{};
+  for (int c = '0'; c <= '9'; c++)
+    classes[c] = CHAR_DIGIT;
+  for (int c = 'a'; c <= 'z'; c++)
+    classes[c] = CHAR_IDENT_START;
+  for (int c = 'A'; c <= 'Z'; c++)
+    classes[c] = CHAR_IDENT_START;
+  classes['_'] = CHAR_IDENT_START;
+  for (int c = 0x80; c <= 0xFF; c++)
+    classes[c] = CHAR_NON_ASCII;
+  return classes;
+}
+
+inline constexpr std::array<std::uint8_t, 256> char_classes =
+    build_char_classes();
+
+inline std::uint8_t char_class(char c) {
+  return char_classes[static_cast<unsigned char>(c)];
+}
+
+#endif // !KEYWORDS_H
@@ -1,21 +1,21 @@
+#include <algorithm>
 #include <cctype>
+#include <climits>
 #include <cstdlib>
+#include <cstring>
+#include <exception>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "./keywords.h"
 #include "./lexer.h"
-
-std::string get_string_from_stack(std::string& s) {
-  int i = 0; 
-  std::string ret = "";
-  while (s[i] != '\0') {
-    ret += s[i];
-    i ++;
-  }
-  std::cout << "s: " << s << i << std::endl;
-  return ret;
-}
+#include "./memory_stats.h"
+#include "./scan.h"
+#include "./unicode.h"
 
 enum class State : short {
   START,
@@ -120,7 +120,7 @@ State get_initial_state(char c) {
   case '!':
     return State::NOT_1;
   default:
-    if (isalpha(c))
+    if (char_class(c) & CHAR_IDENT_START)
       return State::IDENTIFIER;
     else
       return State::INVALID;
@@ -141,283 +141,709 @@ bool isSpace(char c) noexcept {
 
 bool isComment(char c) noexcept { return (c == '#'); }
 
-// the tokens are inserted in reverse order
-int insert_into_linked_list(token_node *&head, TokenChunk tok,
-                            int &num_tokens) {
-  token_node *new_node = new token_node();
-  new_node->tok = tok;
-  token_node *temp = head;
-  new_node->next = temp;
-  head = new_node;
-  return num_tokens++;
+// decodes the code point at word[i] when all of its sequence lies inside
+// the word, which ends mid-sequence only where the input does
+bool decode_in_word(const char *word, std::size_t &i, std::size_t len,
+                    char32_t &cp) {
+  unsigned char lead = static_cast<unsigned char>(word[i]);
+  std::size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+  if (len - i < need) {
+    return false;
+  }
+  cp = decode_utf8(word, i);
+  return true;
+}
+
+// [i, len) of a word can continue an identifier: letters, digits and _, or
+// code points past ASCII with XID_Continue
+bool is_identifier_tail(const char *word, std::size_t i, std::size_t len) {
+  while (i < len) {
+    std::uint8_t cls = char_class(word[i]);
+    char32_t cp;
+    if (cls & CHAR_IDENT) {
+      i++;
+    } else if (!(cls & CHAR_NON_ASCII) || !decode_in_word(word, i, len, cp) ||
+               !is_xid_continue(cp)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// for words starting past ASCII, which can't be keywords
+bool is_unicode_identifier(const char *word, std::size_t len) {
+  std::size_t i = 0;
+  char32_t cp;
+  return decode_in_word(word, i, len, cp) && is_xid_start(cp) &&
+         is_identifier_tail(word, i, len);
 }
 
-Lexer::Lexer(std::string input) {
+Lexer::Lexer(std::string input, LexMode mode) {
   if (input.empty()) {
     std::exit(0);
   } else {
-    this->input = input;
-    this->len = input.length();
-    // reserve the char stack in advance
-    this->current_token.reserve(10000);
+    this->owned = std::move(input);
+    this->input = this->owned;
+    this->mode = mode;
+    this->len = this->input.length();
+    this->interner = std::make_shared<Interner>();
   }
 }
 
-void Lexer::process_token(token_node *&head) {
-  if (this->current_token_ptr != 0) {
-    this->current_token[this->current_token_ptr] = '\0';
-    TokenChunk retToken = get_token();
-    this->current_token[0] = '\0';
-    this->current_token_ptr = 0;
-    insert_into_linked_list(head, retToken, this->num_tokens);
+Lexer::Lexer(SourceBuffer &source, LexMode mode) {
+  // a streamed source may take more than one block to show its first byte
+  while (source.empty() && source.fill()) {
+  }
+  if (source.empty()) {
+    std::exit(0);
+  } else {
+    this->stream_source = &source;
+    this->take_input();
+    this->mode = mode;
+    this->interner = std::make_shared<Interner>();
   }
 }
 
-void Lexer::process_literal_token(TokenChunk &retToken, token_node *&head) {
-  if (this->current_token_ptr != 0) {
-    this->current_token[this->current_token_ptr] = '\0';
-    TokenChunk tok = this->get_token();
-    this->current_token[0] = '\0';
-    this->current_token_ptr = 0;
-    insert_into_linked_list(head, tok, this->num_tokens);
+// flushes the pending word, if there is one
+template <typename Sink> void Lexer::process_token(Sink &tokens) {
+  if (this->word_len != 0) {
+    TokenChunk tok = this->lex_word();
+    tok.offset = this->word_start;
+    if (tok.type == Token::IDENTIFIER && this->interner != nullptr) {
+      tok.sym = this->interner->intern(this->view(this->word_start,
+                                                  this->word_len));
+    }
+    tokens.push(std::move(tok));
+    this->word_len = 0;
   }
-  insert_into_linked_list(head, retToken, this->num_tokens);
-  read_next();
 }
 
-// calls read_next to update ptr values
-void Lexer::tokenize(std::unique_ptr<TokenChunk[]> &token_stack) {
-  token_node *head = nullptr;
-  int i = 0;
-  while (i < this->len) {
-    if (this->next_ptr >= this->len) { // reached EOF
-      this->current_token[this->current_token_ptr] = '\0';
-      if (this->current_token[0] != '\0') {
-        const TokenChunk token = get_token();
-        insert_into_linked_list(head, token, this->num_tokens);
-      }
-      this->current_token[0] = '\0';
-      this->current_token_ptr = 0;
-      i++;
+void Lexer::set_interner(std::shared_ptr<Interner> interner) {
+  this->interner = std::move(interner);
+}
+
+std::shared_ptr<Interner> Lexer::get_interner() const {
+  return this->interner;
+}
+
+template <typename Sink>
+void Lexer::process_literal_token(TokenChunk &retToken, Sink &tokens) {
+  this->process_token(tokens);
+  retToken.offset = this->ptr;
+  tokens.push(std::move(retToken));
+  this->ptr++;
+}
+
+// the input is consumed a run at a time: whitespace, words, comments and
+// string literals are each skipped by a single scan (see scan.h) instead of
+// one loop iteration per character. the last byte of the input is never
+// dispatched on, a word still pending when it is reached is flushed at the
+// end
+void Lexer::tokenize(TokenArray &token_stack) {
+  MemoryPhaseScope phase(MemoryPhase::LEXER);
+  this->check_utf8(0, this->len);
+  TokenBuffer tokens(estimate_token_count(this->len));
+  tokens.push({Token::START, "", no_symbol, 0});
+  while (this->more_input()) {
+    this->lex_step(tokens);
+  }
+  this->process_token(tokens);
+  tokens.push({Token::END, "", no_symbol, this->len});
+  tokens.shrink_to_fit();
+  token_stack = tokens.release();
+}
+
+void Lexer::tokenize(TokenStream &stream) {
+  MemoryPhaseScope phase(MemoryPhase::LEXER);
+  this->check_utf8(0, this->len);
+  stream = TokenStream(this->input);
+  stream.reserve(estimate_token_count(this->len));
+  stream.push({Token::START, "", no_symbol, 0});
+  while (this->more_input()) {
+    this->lex_step(stream);
+  }
+  this->process_token(stream);
+  stream.extend_source(this->input);
+  stream.push({Token::END, "", no_symbol, this->len});
+  stream.shrink_to_fit();
+}
+
+// lexing is restarted at the last token before the edit with whitespace in
+// front of it: the lexer had flushed every word there and the tokens before
+// it only read bytes the edit left alone. past the edit, the new tokens line
+// up with the old ones again as soon as the lexer stands between two steps
+// with no word pending, at the shifted start of an old token. every token
+// from there on is the same as before, only moved
+std::size_t Lexer::relex(TokenStream &tokens, const SourceEdit &edit) {
+  MemoryPhaseScope phase(MemoryPhase::LEXER);
+  this->read_all_input();
+  std::string_view old_source = tokens.source_view();
+  if (edit.offset > old_source.size() ||
+      edit.removed > old_source.size() - edit.offset ||
+      old_source.size() - edit.removed + edit.inserted.size() != this->len) {
+    throw std::logic_error("edit does not turn the old source into the new");
+  }
+  std::size_t limit = std::size_t{UINT32_MAX};
+  if (tokens.size() < 2 || old_source.size() >= limit || this->len >= limit) {
+    this->tokenize(tokens);
+    return tokens.size();
+  }
+
+  // last token starting before the edit, START and END are never picked
+  std::size_t lo = 1;
+  std::size_t hi = tokens.size() - 1;
+  while (lo < hi) {
+    std::size_t mid = lo + (hi - lo) / 2;
+    if (tokens.offset(mid) < edit.offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
     }
-    // if the end of the file is not reached, then the cases are:
-    // 1. you might have hit a blank space, in which case,
-    //  1. get_token() if there is a token in this->char_stack
-    //  2. do nothing if there isn't, increment the ptrs and i
-    // 2. any other type of whitespace, do nothing, increment the ptrs and i
-    // 3. you might hit a literal with the next ptr, so check if
-    // this->input[this->next_ptr] is a literal, if it is:
-    //  1. get_token() if there is a token in this->char_stack
-    //          then insert the literal into the linked list
-    //          IMPORTANT: increment the ptrs twice(since the literal was
-    //          detected using this-> next_ptr, and not this->ptr)
-    //  2. do nothing if there isn't, increment the ptrs twice, and insert the
-    //  literal into the list
-    // 4. If you don't encounter a whitespace or a literal, then keep going by
-    // calling read_next()
-    else {
-      this->current_char = this->input[this->ptr];
-      this->current_token[this->current_token_ptr] = '\0';
-      if (this->current_char == ' ' || this->current_char == '\t') {
-        if (this->current_token[0] != '\0') {
-          this->current_token[this->current_token_ptr] = '\0';
-
-          // unable to get the string from the char stack since it wasn't initialized properly
-          // this is a hack to get the string from the char stack
-          std::string tokenString = get_string_from_stack(this->current_token);
-          TokenChunk retToken = get_token();
-          retToken.value = tokenString;
-
-          insert_into_linked_list(head, retToken, this->num_tokens);
-          this->current_token[0] = '\0';
-          this->current_token_ptr = 0;
-        }
-        i++;
-        this->read_next();
-      } else if (this->current_char == '\n') {
-        if (this->current_token[0] != '\0') {
-          this->current_token[this->current_token_ptr] = '\0';
-          TokenChunk retToken = get_token();
-          insert_into_linked_list(head, retToken, this->num_tokens);
-          this->current_token[0] = '\0';
-          this->current_token_ptr = 0;
-        }
-        i++;
-        this->read_next();
-      } else {
-        TokenChunk retToken;
-        switch (this->input[this->ptr]) {
-        case '#': // comments
-          while (this->input[this->ptr] != '\n') {
-            i++;
-            this->read_next();
-          }
-          break;
-        case '{':
-          retToken = {Token::LEFTBRACE, "{"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '}':
-          retToken = {Token::RIGHTBRACE, "}"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '(':
-          retToken = {Token::LEFTPARENTHESIS, "("};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case ')':
-          retToken = {Token::RIGHTPARENTHESIS, ")"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '.':
-          retToken = {Token::PERIOD, "."};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case ',':
-          retToken = {Token::COMMA, ","};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case ':':
-          retToken = {Token::COLON, ":"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '!':
-          retToken = {Token::EXCLAIM, "!"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '*':
-          retToken = {Token::MULTIPLY, "*"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '+':
-          retToken = {Token::ADD, "+"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          break;
-        case '-':
-          retToken = {Token::SUBTRACT, "-"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case '/':
-          retToken = {Token::DIVIDE, "/"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        case ';':
-          retToken = {Token::SEMICOLON, ";"};
-          this->process_token(head);
-          this->process_literal_token(retToken, head);
-          i++;
-          break;
-        default:
-          // capture strings starting with double quotes
-          if (this->current_char == '"') {
-            if (this->current_token_ptr > 0) {
-              this->current_token[this->current_token_ptr] = '\0';
-              insert_into_linked_list(head, retToken, this->num_tokens);
-            }
-            read_next();
-            i++;
-            while (this->input[this->ptr] != '"') {
-              read_next();
-              i++;
-            }
-            if (this->input[this->ptr] == '"')
-              retToken = {Token::STRING, this->current_token};
-            else
-              retToken = {Token::UNDEFINED, this->current_token};
-            insert_into_linked_list(head, retToken, this->num_tokens);
-            this->current_token[0] = '\0';
-            this->current_token_ptr = 0;
-            i++;
-            read_next();
-          } else if (this->current_char == '\'') {
-            if (this->input[this->ptr + 2] == '\'') {
-              insert_into_linked_list(
-                  head,
-                  {Token::CHAR, std::string(1, this->input[this->ptr + 1])},
-                  this->num_tokens);
-              read_next(3);
-              i += 3;
-              this->current_token[0] = '\0';
-              this->current_token_ptr = 0;
-            } else {
-              // error out since a char either too long or too short
-              throw std::runtime_error("Expected expression for char at line ");
-            }
-          } else [[likely]] {
-            this->current_token[this->current_token_ptr] = this->current_char;
-            this->current_token_ptr++;
-            i++;
-            this->read_next();
-          }
-          break;
+  }
+  std::size_t first = lo - 1;
+  std::size_t restart = 0;
+  for (; first >= 1; first--) {
+    std::size_t at = tokens.offset(first);
+    if (at > 0 && (old_source[at - 1] == ' ' || old_source[at - 1] == '\t' ||
+                   old_source[at - 1] == '\n')) {
+      restart = at;
+      break;
+    }
+  }
+  if (restart == 0) {
+    first = 1;
+  }
+
+  std::size_t shift = this->len - old_source.size();
+  std::size_t edit_end = edit.offset + edit.inserted.size();
+  // the bytes outside were checked when the old source was lexed, the
+  // check runs on to the next ASCII byte in case the edit split a sequence
+  std::size_t checked_end = edit_end;
+  while (checked_end < this->len &&
+         (char_class(this->input[checked_end]) & CHAR_NON_ASCII)) {
+    checked_end++;
+  }
+  this->check_utf8(restart, checked_end);
+
+  TokenStream part(this->input);
+  std::size_t last = tokens.size();
+  std::size_t old_token = first;
+  this->ptr = restart;
+  this->word_len = 0;
+  while (!this->at_end()) {
+    if (this->word_len == 0 && this->ptr >= edit_end) {
+      // unsigned wrap-around gives the old position for either sign
+      std::size_t old_ptr = this->ptr - shift;
+      while (old_token < tokens.size() - 1 &&
+             tokens.offset(old_token) < old_ptr) {
+        old_token++;
+      }
+      if (old_token < tokens.size() - 1 &&
+          tokens.offset(old_token) == old_ptr) {
+        last = old_token;
+        break;
+      }
+    }
+    this->lex_step(part);
+  }
+  if (last == tokens.size()) {
+    this->process_token(part);
+    part.push({Token::END, "", no_symbol, this->len});
+  }
+  tokens.splice(first, last, part);
+  return part.size();
+}
+
+// a piece of the input lexed on its own. chunks start on a newline, which
+// the sequential lexer either dispatches on or skips inside a run of
+// whitespace, so a fresh lexer started there is usually in the same state.
+// when the previous chunk ran past the newline inside a string or char
+// literal the guess was wrong, and the chunk is lexed again from where the
+// previous one really stopped until it meets one of the checkpoints below
+struct LexChunk {
+  std::size_t start{0};
+  std::size_t end{0};
+  // first dispatch position at or past end
+  std::size_t resume{0};
+  // first byte in [start, end) that is not well-formed UTF-8, or end
+  std::size_t invalid_utf8{0};
+  TokenBuffer tokens;
+  // positions right after a run of whitespace, where no word is pending,
+  // with the number of tokens emitted before them
+  std::vector<std::pair<std::size_t, std::size_t>> checkpoints;
+  std::exception_ptr error;
+};
+
+// checkpoints are taken at most this often, the first one always
+inline constexpr std::size_t lex_checkpoint_bytes = 4096;
+
+// lexes the dispatch positions in [start, chunk.end). a word pending at
+// the end is flushed, the byte at end is a newline that would flush it
+void Lexer::lex_chunk(LexChunk &chunk) {
+  const char *src = this->input.data();
+  this->ptr = chunk.start;
+  this->word_len = 0;
+  std::size_t next_checkpoint = 0;
+  try {
+    while (this->ptr < chunk.end && !this->at_end()) {
+      char c = src[this->ptr];
+      this->lex_step(chunk.tokens);
+      if (isSpace(c) && this->ptr >= next_checkpoint) {
+        chunk.checkpoints.emplace_back(this->ptr, chunk.tokens.size());
+        next_checkpoint = this->ptr + lex_checkpoint_bytes;
+      }
+    }
+    this->process_token(chunk.tokens);
+  } catch (...) {
+    // may be an artifact of a wrong guess, only rethrown once the chunk
+    // is known to be right
+    chunk.error = std::current_exception();
+  }
+  chunk.resume = this->ptr;
+}
+
+// lexes the chunk again from start, where the sequential lexer really
+// is with no word pending. once it reaches a checkpoint in the same state
+// the rest of the speculative tokens are kept
+void Lexer::relex_chunk(LexChunk &chunk, std::size_t start) {
+  const char *src = this->input.data();
+  this->ptr = start;
+  this->word_len = 0;
+  TokenBuffer fixed;
+  std::size_t next = 0;
+  bool clean = true;
+  std::exception_ptr error;
+  try {
+    while (this->ptr < chunk.end && !this->at_end()) {
+      while (next < chunk.checkpoints.size() &&
+             chunk.checkpoints[next].first < this->ptr) {
+        next++;
+      }
+      if (clean && next < chunk.checkpoints.size() &&
+          chunk.checkpoints[next].first == this->ptr) {
+        for (std::size_t i = chunk.checkpoints[next].second;
+             i < chunk.tokens.size(); i++) {
+          fixed.push(std::move(chunk.tokens[i]));
         }
+        chunk.tokens = std::move(fixed);
+        return;
       }
+      char c = src[this->ptr];
+      this->lex_step(fixed);
+      clean = isSpace(c);
+    }
+    this->process_token(fixed);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  chunk.tokens = std::move(fixed);
+  chunk.error = error;
+  chunk.resume = this->ptr;
+}
+
+void Lexer::tokenize(TokenArray &token_stack,
+                     ThreadPool &pool, std::size_t chunk_bytes) {
+  MemoryPhaseScope phase(MemoryPhase::LEXER);
+  // chunks are cut from the whole input
+  this->read_all_input();
+  const char *src = this->input.data();
+  std::size_t target = std::max(chunk_bytes, this->len / (pool.size() * 4));
+  if (pool.size() < 2 || this->len < 2 * target) {
+    this->tokenize(token_stack);
+    return;
+  }
+  std::vector<LexChunk> chunks;
+  std::size_t start = 0;
+  while (start < this->len) {
+    std::size_t end = start + target < this->len
+                          ? find_byte(src, start + target, this->len, '\n')
+                          : this->len;
+    chunks.emplace_back();
+    chunks.back().start = start;
+    chunks.back().end = end;
+    start = end;
+  }
+
+  pool.run(chunks.size(), [this, &chunks](std::size_t i) {
+    // lexer state is a handful of offsets, every chunk gets its own
+    Lexer lexer;
+    this->share_input(lexer);
+    LexChunk &chunk = chunks[i];
+    chunk.invalid_utf8 =
+        chunk.start + find_invalid_utf8(lexer.input.data() + chunk.start,
+                                        chunk.end - chunk.start);
+    chunk.tokens.reserve(estimate_token_count(chunk.end - chunk.start));
+    lexer.lex_chunk(chunk);
+    // the estimate is dropped before the merge allocates the whole array
+    chunk.tokens.shrink_to_fit();
+  });
+  // chunks split at newlines, so no sequence spans two of them
+  for (const LexChunk &chunk : chunks) {
+    if (chunk.invalid_utf8 < chunk.end) {
+      this->throw_invalid_utf8(chunk.invalid_utf8);
     }
   }
-  token_stack = std::make_unique<TokenChunk[]>(this->num_tokens + 2);
-  token_stack[0] = {Token::START, ""};
-  token_node *temp;
-  for (int i = this->num_tokens - 1; i >= 0; i--) {
-    if (head != nullptr) {
-      temp = head;
-      token_stack[i + 1] = (*head).tok;
-      head = head->next;
-      delete temp;
+
+  // fix-up pass: walk the chunks in order and relex the ones that started
+  // from a state the sequential lexer never reaches
+  std::vector<std::size_t> offsets(chunks.size());
+  std::size_t total = 1;
+  std::size_t resume = 0;
+  Lexer fixer;
+  this->share_input(fixer);
+  for (std::size_t i = 0; i < chunks.size(); i++) {
+    if (resume != chunks[i].start) {
+      fixer.relex_chunk(chunks[i], resume);
+    }
+    if (chunks[i].error) {
+      std::rethrow_exception(chunks[i].error);
+    }
+    resume = chunks[i].resume;
+    offsets[i] = total;
+    total += chunks[i].tokens.size();
+  }
+
+  // every chunk knows where its tokens go, so they are copied in parallel
+  // into storage nothing has touched yet, and a chunk's buffer is freed as
+  // soon as its tokens are out
+  TokenArray tokens(static_cast<TokenChunk *>(
+      counted_realloc(nullptr, (total + 1) * sizeof(TokenChunk))));
+  new (&tokens[0]) TokenChunk{Token::START, "", no_symbol, 0};
+  pool.run(chunks.size(), [&tokens, &chunks, &offsets](std::size_t i) {
+    if (chunks[i].tokens.size() > 0) {
+      std::memcpy(static_cast<void *>(tokens.get() + offsets[i]),
+                  &chunks[i].tokens[0],
+                  chunks[i].tokens.size() * sizeof(TokenChunk));
+    }
+    chunks[i].tokens = TokenBuffer();
+  });
+  new (&tokens[total]) TokenChunk{Token::END, "", no_symbol, this->len};
+  // chunk lexers don't intern, ids are handed out here in source order so
+  // they match the sequential lexer's
+  if (this->interner != nullptr) {
+    for (std::size_t i = 1; i < total; i++) {
+      if (tokens[i].type == Token::IDENTIFIER ||
+          tokens[i].type == Token::STRING) {
+        tokens[i].sym = this->interner->intern(
+            std::get<std::string_view>(tokens[i].value));
+      }
     }
   }
-  head = nullptr;
-  token_stack[this->num_tokens + 1] = {Token::END, ""};
+  this->ptr = this->len;
+  token_stack = std::move(tokens);
 }
 
-// should not be called once EOF is reached
-void Lexer::read_next() noexcept {
-  if (this->ptr >= this->len) {
-    this->current_token[this->ptr] = '\0';
+// a Lexer over the same input with no interner, for lexing chunks
+void Lexer::share_input(Lexer &chunk_lexer) const {
+  chunk_lexer.input = this->input;
+  chunk_lexer.len = this->len;
+  chunk_lexer.mode = this->mode;
+}
+
+bool Lexer::at_end() const noexcept { return this->ptr + 1 >= this->len; }
+
+// true while there is a byte left to dispatch on. a streamed source is
+// decompressed further when lexing reaches the end of what it has, or a
+// literal that may go on past it. what it has always ends in a newline, so
+// no word, comment or run of whitespace does
+bool Lexer::more_input() {
+  std::size_t searched = this->ptr + 1;
+  while (this->stream_source != nullptr &&
+         (this->at_end() || this->literal_cut_off(searched))) {
+    std::size_t checked = this->len;
+    this->stream_source->fill();
+    this->take_input();
+    this->check_utf8(checked, this->len);
+  }
+  return !this->at_end();
+}
+
+// a string or char literal at ptr whose end may not be decompressed yet.
+// there is no closing quote before searched, a long string is only looked
+// through once however many blocks it spans
+bool Lexer::literal_cut_off(std::size_t &searched) const noexcept {
+  const char *src = this->input.data();
+  switch (src[this->ptr]) {
+  case '"':
+    searched = find_byte(src, searched, this->len, '"');
+    return searched == this->len;
+  case '\'':
+    return this->ptr + 2 >= this->len;
+  default:
+    return false;
+  }
+}
+
+// the source decompressed so far, up to its last newline while more is
+// coming. the text never moves, views taken earlier stay valid
+void Lexer::take_input() {
+  this->input = this->stream_source->view();
+  this->len = this->input.size();
+  if (this->stream_source->complete()) {
+    this->stream_source = nullptr;
+    return;
+  }
+  std::size_t newline = this->input.rfind('\n');
+  this->len = newline == std::string_view::npos ? 0 : newline + 1;
+}
+
+void Lexer::read_all_input() {
+  if (this->stream_source != nullptr) {
+    while (this->stream_source->fill()) {
+    }
+    this->take_input();
+  }
+}
+
+// [start, end) has to be well-formed UTF-8, both ends on a code point
+// boundary. pure ASCII goes through the check a vector at a time
+void Lexer::check_utf8(std::size_t start, std::size_t end) const {
+  std::size_t bad =
+      start + find_invalid_utf8(this->input.data() + start, end - start);
+  if (bad < end) {
+    this->throw_invalid_utf8(bad);
+  }
+}
+
+void Lexer::throw_invalid_utf8(std::size_t offset) const {
+  SourceLocation at = LineIndex(this->input).locate(offset);
+  throw std::runtime_error(std::to_string(at.line) + ":" +
+                           std::to_string(at.column) + ": invalid UTF-8");
+}
+
+// pull interface: tokens are lexed one dispatch at a time into a small
+// pending buffer, so memory stays bounded no matter how long the input is.
+// the stream starts with START like tokenize() does and repeats END once
+// the input is exhausted
+TokenChunk Lexer::next_token() {
+  MemoryPhaseScope phase(MemoryPhase::LEXER);
+  while (this->pending_head == this->pending.size()) {
+    this->pending.clear();
+    this->pending_head = 0;
+    if (!this->stream_started) {
+      this->check_utf8(0, this->len);
+      this->pending.push({Token::START, "", no_symbol, 0});
+      this->stream_started = true;
+    } else if (this->more_input()) {
+      this->lex_step(this->pending);
+    } else if (!this->stream_done) {
+      this->process_token(this->pending);
+      this->pending.push({Token::END, "", no_symbol, this->len});
+      this->stream_done = true;
+    } else {
+      return {Token::END, "", no_symbol, this->len};
+    }
+  }
+  return std::move(this->pending[this->pending_head++]);
+}
+
+// lexes whatever starts at ptr: a run of whitespace, a comment, a literal or
+// a piece of a word. pushes up to two tokens, possibly none
+template <typename Sink> void Lexer::lex_step(Sink &tokens) {
+  const char *src = this->input.data();
+  const std::size_t stop = this->len - 1;
+  TokenChunk retToken;
+  switch (src[this->ptr]) {
+  case ' ':
+  case '\t':
+  case '\n':
+    this->process_token(tokens);
+    this->ptr = scan_whitespace(src, this->ptr + 1, stop);
+    break;
+  case '#': // comments, the newline ending one is lexed as whitespace
+    this->ptr = find_byte(src, this->ptr, this->len, '\n');
+    break;
+  case '{':
+    retToken = {Token::LEFTBRACE, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '}':
+    retToken = {Token::RIGHTBRACE, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '(':
+    retToken = {Token::LEFTPARENTHESIS, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case ')':
+    retToken = {Token::RIGHTPARENTHESIS, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '.':
+    // the point of a double literal stays in its word
+    if (this->word_len != 0 &&
+        char_class(src[this->word_start]) == CHAR_DIGIT &&
+        char_class(src[this->ptr + 1]) == CHAR_DIGIT) {
+      this->word_len++;
+      this->ptr++;
+      break;
+    }
+    retToken = {Token::PERIOD, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case ',':
+    retToken = {Token::COMMA, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case ':':
+    retToken = {Token::COLON, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '!':
+    // != is the one operator word starting with a literal character, the
+    // last byte is never dispatched on so the = is always there to read
+    if (src[this->ptr + 1] == '=') {
+      retToken = {Token::NOTEQUAL, this->view(this->ptr, 2)};
+      this->process_literal_token(retToken, tokens);
+      this->ptr++;
+      break;
+    }
+    retToken = {Token::EXCLAIM, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '*':
+    retToken = {Token::MULTIPLY, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '+':
+    retToken = {Token::ADD, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '-':
+    retToken = {Token::SUBTRACT, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '/':
+    retToken = {Token::DIVIDE, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case ';':
+    retToken = {Token::SEMICOLON, this->view(this->ptr, 1)};
+    this->process_literal_token(retToken, tokens);
+    break;
+  case '"': { // capture strings starting with double quotes
+    if (this->word_len != 0) {
+      // a word running into a string is not flushed, an UNDEFINED token
+      // marks where it was
+      retToken.offset = this->word_start;
+      tokens.push(std::move(retToken));
+    }
+    std::size_t close = find_byte(src, this->ptr + 1, this->len, '"');
+    // the token is the text between the quotes
+    std::string_view text = this->view(this->ptr + 1, close - this->ptr - 1);
+    if (close < this->len) {
+      retToken = {Token::STRING, text};
+      if (this->interner != nullptr) {
+        retToken.sym = this->interner->intern(text);
+      }
+    } else {
+      retToken = {Token::UNDEFINED, text};
+    }
+    retToken.offset = this->ptr;
+    tokens.push(std::move(retToken));
+    this->word_len = 0;
+    this->ptr = close + 1;
+    break;
+  }
+  case '\'':
+    if (this->ptr + 2 < this->len && src[this->ptr + 2] == '\'') {
+      tokens.push({Token::CHAR, src[this->ptr + 1], no_symbol, this->ptr});
+      this->ptr += 3;
+      this->word_len = 0;
+    } else {
+      // error out since a char either too long or too short
+      throw std::runtime_error("Expected expression for char at line ");
+    }
+    break;
+  default:
+    if (this->word_len == 0) {
+      this->word_start = this->ptr;
+    }
+    std::size_t word_end = scan_word(src, this->ptr + 1, stop);
+    this->word_len += word_end - this->ptr;
+    this->ptr = word_end;
+    break;
+  }
+}
+
+// single pass over a word: numbers are converted while they are
+// scanned, words go through the keyword perfect hash once they are known to
+// be valid identifiers or operator words
+TokenChunk classify_token(const char *word, std::size_t token_len) {
+  std::uint8_t first = char_class(word[0]);
+  std::size_t i = 0;
+  if (first == CHAR_DIGIT) {
+    long long num = 0;
+    while (i < token_len && char_class(word[i]) == CHAR_DIGIT) {
+      num = num * 10 + (word[i] - '0');
+      if (num > INT_MAX) {
+        throw std::out_of_range("integer literal out of range");
+      }
+      i++;
+    }
+    if (i == token_len) {
+      return {Token::INT, static_cast<int>(num)};
+    }
+    if (word[i] == '.') {
+      i++;
+      while (i < token_len && char_class(word[i]) == CHAR_DIGIT) {
+        i++;
+      }
+      if (i == token_len) {
+        return {Token::DOUBLE, std::stod(std::string(word, token_len))};
+      }
+    }
+    // neither float nor string, but starts with a digit
+    return {Token::INVALID, std::string_view(word, token_len)};
+  }
+  if (first & CHAR_IDENT_START) {
+    while (i < token_len && (char_class(word[i]) & CHAR_IDENT)) {
+      i++;
+    }
+    if (i != token_len && !is_identifier_tail(word, i, token_len)) {
+      return {Token::INVALID, std::string_view(word, token_len)};
+    }
+  } else if (first & CHAR_NON_ASCII) {
+    Token type = is_unicode_identifier(word, token_len) ? Token::IDENTIFIER
+                                                        : Token::INVALID;
+    return {type, std::string_view(word, token_len)};
+  }
+  Token type = lookup_keyword(word, token_len);
+  if (type == Token::IDENTIFIER && !(first & CHAR_IDENT_START)) {
+    type = Token::INVALID;
   }
-  this->current_char = this->input[this->ptr];
-  this->ptr += 1;
-  this->next_ptr += 1;
+  return {type, std::string_view(word, token_len)};
+}
+
+std::string_view Lexer::view(std::size_t offset, std::size_t count) const {
+  return std::string_view(this->input.data() + offset, count);
 }
 
-// overloaded method to avoid multiple function calls calling read()
-void Lexer::read_next(int count) noexcept {
-  if (count > 0) {
-    if (this->ptr >= this->len) {
-      this->current_token[this->ptr] = '\0';
+std::string_view Lexer::source_view() const noexcept { return this->input; }
+
+TokenChunk Lexer::lex_word() {
+  const char *word = this->input.data() + this->word_start;
+  if (this->mode == LexMode::STATE_MACHINE) {
+    this->current_token.assign(word, this->word_len);
+    this->current_token_ptr = static_cast<int>(this->word_len);
+    TokenChunk tok = this->get_token();
+    // get_token() views current_token, which the next word overwrites
+    if (std::holds_alternative<std::string_view>(tok.value)) {
+      tok.value = std::string_view(word, this->word_len);
     }
-    this->current_char = this->input[this->ptr];
-    this->ptr += count;
-    this->next_ptr += count;
+    return tok;
   }
+  return classify_token(word, this->word_len);
 }
 
 // NOTE: only called when char_stack has a length of atleast one
 TokenChunk Lexer::get_token() {
   int i = 0;
   int token_len = this->current_token_ptr;
+  if (char_class(this->current_token[0]) & CHAR_NON_ASCII) {
+    bool valid = is_unicode_identifier(this->current_token.data(), token_len);
+    return {valid ? Token::IDENTIFIER : Token::INVALID, this->current_token};
+  }
   while (std::isdigit(this->current_token[i])) {
     i++;
   }
@@ -443,14 +869,10 @@ TokenChunk Lexer::get_token() {
     switch (currentState) {
       // ([a-z][A-z][0-9]|_)*
     case State::IDENTIFIER:
-      retToken = Token::IDENTIFIER;
-      while (i < token_len) {
-        if (!(isalnum(this->current_token[i]) ||
-              this->current_token[i] == '_')) {
-          retToken = Token::INVALID;
-        }
-        i++;
-      }
+      retToken = is_identifier_tail(this->current_token.data(), i, token_len)
+                     ? Token::IDENTIFIER
+                     : Token::INVALID;
+      i = token_len;
       currentState = State::END;
       break;
     case State::ANDK_1:
@@ -810,3 +1232,8 @@ TokenChunk Lexer::get_token() {
   std::cout << "Aborting" << std::endl;
   std::exit(-11);
 }
+
+template void Lexer::process_token(TokenBuffer &);
+template void Lexer::process_token(TokenStream &);
+template void Lexer::process_literal_token(TokenChunk &, TokenBuffer &);
+template void Lexer::process_literal_token(TokenChunk &, TokenStream &);
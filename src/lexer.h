@@ -1,37 +1,104 @@
 #include "globals.h"
+#include "interner.h"
+#include "source.h"
+#include "thread_pool.h"
+#include "token_buffer.h"
+#include "token_stream.h"
 #include <cstddef>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#ifndef LEXER
+#ifndef LEXER_H
+#define LEXER_H
 
-struct token_node {
-  TokenChunk tok;
-  token_node *next = nullptr;
-};
+// TABLE classifies words through the keyword table in keywords.h,
+// STATE_MACHINE is the original hand-written State switch in get_token()
+enum class LexMode { TABLE, STATE_MACHINE };
+
+struct LexChunk;
+
+// inputs smaller than a couple of chunks are not worth splitting
+inline constexpr std::size_t default_lex_chunk_bytes = std::size_t{1} << 20;
 
+// tokens hold views into the input, so a Lexer has to outlive the tokens
+// and parse tree built from its output. a Lexer built from a SourceBuffer
+// reads it in place, the buffer then has to outlive the Lexer as well. a
+// buffer from SourceBuffer::open_stream() is decompressed further as the
+// lexer reaches the end of what is there, so tokenize() and next_token()
+// start on the first block instead of waiting for the whole file
+// the input has to be UTF-8, every way of lexing it throws
+// std::runtime_error at the first malformed byte. identifiers may use any
+// XID_Start / XID_Continue code point besides letters, digits and _
 class Lexer {
 public:
   Lexer() = default;
-  Lexer(std::string);
-  void read_next() noexcept;
-  void read_next(int) noexcept;
+  Lexer(std::string, LexMode mode = LexMode::TABLE);
+  Lexer(SourceBuffer &, LexMode mode = LexMode::TABLE);
+  // the input view may point into this object
+  Lexer(const Lexer &) = delete;
+  Lexer &operator=(const Lexer &) = delete;
   TokenChunk get_token();
-  void tokenize(std::unique_ptr<TokenChunk[]> &token_stack);
-  void process_literal_token(TokenChunk &, token_node *&);
-  void process_token(token_node *&);
+  TokenChunk lex_word();
+  std::string_view view(std::size_t offset, std::size_t count) const;
+  // the whole input, token offsets index into it
+  std::string_view source_view() const noexcept;
+  void tokenize(TokenArray &token_stack);
+  // compact storage, see token_stream.h
+  void tokenize(TokenStream &stream);
+  // same tokens as tokenize(), the input is split at newlines and the
+  // pieces are lexed on the pool
+  void tokenize(TokenArray &token_stack, ThreadPool &pool,
+                std::size_t chunk_bytes = default_lex_chunk_bytes);
+  // tokens were lexed from the source before edit, this Lexer reads the
+  // source after it and has to share the interner used for tokens. only the
+  // tokens around the edit are lexed again and spliced in, returns how many
+  // were lexed. like tokenize(), call it once per Lexer
+  std::size_t relex(TokenStream &tokens, const SourceEdit &edit);
+  // streaming alternative to tokenize(), don't mix the two on one Lexer
+  TokenChunk next_token();
+  // every Lexer starts with an interner of its own, lexers that share one
+  // give the same name the same id
+  void set_interner(std::shared_ptr<Interner>);
+  std::shared_ptr<Interner> get_interner() const;
+  // tokens go to a TokenBuffer or a TokenStream
+  template <typename Sink> void process_literal_token(TokenChunk &, Sink &);
+  template <typename Sink> void process_token(Sink &);
 
 private:
-  std::string input = "";
-  int ptr{0};
-  int next_ptr{1};
+  template <typename Sink> void lex_step(Sink &);
+  void lex_chunk(LexChunk &);
+  void relex_chunk(LexChunk &, std::size_t start);
+  void share_input(Lexer &) const;
+  bool at_end() const noexcept;
+  bool more_input();
+  bool literal_cut_off(std::size_t &searched) const noexcept;
+  void take_input();
+  void read_all_input();
+  void check_utf8(std::size_t start, std::size_t end) const;
+  [[noreturn]] void throw_invalid_utf8(std::size_t offset) const;
+  // only set when the Lexer was given a string, input views it
+  std::string owned;
+  // a streamed source still being decompressed, nullptr once all of it is
+  // in input
+  SourceBuffer *stream_source = nullptr;
+  std::string_view input;
+  std::size_t ptr{0};
+  std::size_t len{0};
+  // the word being built is always a contiguous span of the input
+  std::size_t word_start{0};
+  std::size_t word_len{0};
+  // only used by the STATE_MACHINE mode, get_token() reads from it
   int current_token_ptr{0};
-  char current_char{0};
-  int line_number{1};
-  int len{0};
-  int num_tokens{0};
   std::string current_token;
+  LexMode mode = LexMode::TABLE;
+  std::shared_ptr<Interner> interner;
+  // next_token() state, at most the two tokens one lex_step() produces
+  TokenBuffer pending;
+  std::size_t pending_head{0};
+  bool stream_started{false};
+  bool stream_done{false};
 };
 
 #endif
@@ -1,29 +1,197 @@
+#include "batch.h"
+#include "diagnostics.h"
+#include "expr_pool.h"
+#include "fd_writer.h"
+#include "flat_tree.h"
 #include "helper.h"
 #include "lexer.h"
+#include "memory_stats.h"
 #include "parser.h"
 #include "semantic.h"
+#include "source.h"
+#include "thread_pool.h"
+#include "tree_cache.h"
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <unistd.h>
 
-int main(int argc, char *argv[]) {
-  std::string filename = "input.snip";
-  std::string test_filename = "output.txt";
-  std::string parse_string = "";
-  bool isTest = get_flags(argc, argv, filename, parse_string, test_filename);
-  std::unique_ptr<TokenChunk[]> token_stack = nullptr;
-  std::string lines = readFile(filename);
-  Lexer lex((parse_string.empty() ? lines : parse_string));
-  lex.tokenize(token_stack);
-
-  if (isTest) {
-    writeFile(test_filename, print_lexed_tokens_test(token_stack));
+// trees parsed with -l or -x have LAZYBODY nodes or EXPR ids in them and
+// -a prints something else, so those runs don't use the cache. -t writes
+// the lexed tokens, which a cached run doesn't have
+static bool uses_cache(const Flags &flags) {
+  return !flags.cache_dir.empty() && !flags.lazy_fn_bodies &&
+         !flags.share_exprs && !flags.print_ast && !flags.is_test;
+}
+
+// with -k the syntax errors are written to stderr together once the parse
+// is done, the exit status is 1 if there were any. with -c a tree without
+// errors is cached for the next run on the same source. with -x the
+// expression sharing stats follow the tree on stderr. -a prints the typed
+// AST instead of the tree, lowering parses the bodies -l left out and
+// reads expressions back from the pool
+static int parse_and_print(Parser &parser, const Flags &flags,
+                           const SourceBuffer &source,
+                           DiagnosticBuffer &diagnostics) {
+  ParseTree parsed_tokens;
+  ExprPool exprs;
+  parser.set_lazy_fn_bodies(flags.lazy_fn_bodies);
+  parser.set_expr_pool(flags.share_exprs ? &exprs : nullptr);
+  std::size_t errors = 0;
+  if (flags.keep_going) {
+    errors = parser.parse(parsed_tokens, diagnostics);
+  } else {
+    parser.parse(parsed_tokens);
+  }
+  if (errors == 0 && uses_cache(flags)) {
+    // the lexer has read the whole source by now
+    TreeCache(flags.cache_dir).store(source.view(), FlatTree(parsed_tokens));
+  }
+  if (flags.print_ast) {
+    SemanticAnalyzer analyzer(
+        parsed_tokens,
+        parsed_fn_bodies(parser, flags.keep_going ? &diagnostics : nullptr),
+        flags.share_exprs ? &exprs : nullptr);
+    analyzer.analyze();
+    errors = diagnostics.error_count();
+    std::cout << analyzer.get_ast().output() << std::flush;
   } else {
-    print_lexed_tokens(token_stack);
+    print_parsed_tokens(parsed_tokens);
   }
+  if (flags.keep_going || flags.share_exprs) {
+    FdWriter err(STDERR_FILENO);
+    if (flags.keep_going) {
+      diagnostics.emit(err, flags.diagnostics);
+    }
+    if (flags.share_exprs) {
+      exprs.write_stats(err);
+    }
+  }
+  return errors == 0 ? 0 : 1;
+}
 
-  Parser parser(token_stack);
-  std::unique_ptr<PTNode> parsed_tokens = nullptr;
-  parser.parse(parsed_tokens);
-  print_parsed_tokens(parsed_tokens);
+// one file or the -e string, read, lexed and parsed
+static int parse_source(const Flags &flags, DiagnosticBuffer &diagnostics) {
+  // the file is mapped and lexed in place, "-" reads stdin. compressed
+  // files are decompressed as the lexer gets to them. a file that can't be
+  // read is an error message, with -k a diagnostic
+  SourceBuffer source;
+  try {
+    source = flags.parse_string.empty()
+                 ? SourceBuffer::open_stream(flags.filename)
+                 : SourceBuffer(flags.parse_string);
+  } catch (const std::runtime_error &e) {
+    if (flags.keep_going) {
+      throw;
+    }
+    std::cerr << "snip: " << e.what() << std::endl;
+    return 1;
+  }
+  // with -c a tree cached for these exact bytes is printed straight from
+  // the mapped cache entry, nothing is lexed or parsed. token dumps are
+  // left out with -c, a cached run has no tokens to print
+  if (uses_cache(flags)) {
+    while (source.fill()) {
+    }
+  }
+  if (uses_cache(flags) && !source.empty()) {
+    TreeCache cache(flags.cache_dir);
+    if (std::unique_ptr<TreeImage> cached = cache.load(source.view())) {
+      FdWriter out(STDOUT_FILENO);
+      cached->write(out);
+      return 0;
+    }
+  }
+  Lexer lex(source);
+
+  if (flags.stream) {
+    // the parser pulls tokens as it goes, no token array is built
+    Parser parser(lex);
+    return parse_and_print(parser, flags, source, diagnostics);
+  }
+
+  if (flags.threads != 1) {
+    TokenArray token_stack = nullptr;
+    ThreadPool pool(flags.threads);
+    lex.tokenize(token_stack, pool);
+    if (flags.is_test) {
+      writeFile(flags.test_filename, print_lexed_tokens_test(token_stack));
+    } else if (flags.cache_dir.empty()) {
+      print_lexed_tokens(token_stack);
+    }
+    Parser parser(token_stack, source.view());
+    return parse_and_print(parser, flags, source, diagnostics);
+  }
 
-  // SemanticAnalyzer sem_analyzer(parsed_tokens);
-  return 0;
+  // one byte of kind and four of offset per token, see token_stream.h
+  TokenStream tokens;
+  lex.tokenize(tokens);
+
+  if (flags.is_test) {
+    writeFile(flags.test_filename, print_lexed_tokens_test(tokens));
+  } else if (flags.cache_dir.empty()) {
+    print_lexed_tokens(tokens);
+  }
+
+  Parser parser(tokens);
+  return parse_and_print(parser, flags, source, diagnostics);
+}
+
+// runs at exit, so the lexer's exit() on empty input is reported too
+static void report_memory() {
+  MemoryReport report = memory_report();
+  FdWriter err(STDERR_FILENO);
+  write_memory_report(err, report);
+}
+
+int main(int argc, char *argv[]) {
+  Flags flags = get_flags(argc, argv);
+  if (!flags.error.empty()) {
+    std::cerr << "snip: " << flags.error << "\n"
+              << "usage: snip [-e source] [-t file] [-j threads] [-s] [-k] "
+                 "[-d text|json] [-c dir] [-C dir] [-m] [-l] [-x] [-a] "
+                 "[file|dir ...]"
+              << std::endl;
+    return 2;
+  }
+  if (flags.memory_stats) {
+    if (memory_stats_enabled) {
+      std::atexit(report_memory);
+    } else {
+      std::cerr << "-m needs a build with make ALLOC_STATS=1" << std::endl;
+    }
+  }
+  // several files or a directory are lexed and parsed side by side, with
+  // -j threads, and only the results are printed
+  if (flags.files.size() > 1 ||
+      (flags.files.size() == 1 &&
+       std::filesystem::is_directory(flags.files[0]))) {
+    ThreadPool pool(flags.threads);
+    BatchReport report = parse_files(collect_sources(flags.files), pool);
+    FdWriter out(STDOUT_FILENO);
+    write_report(report, out, flags.diagnostics);
+    return report.error_count() == 0 ? 0 : 1;
+  }
+  if (flags.clear_cache) {
+    std::size_t removed = TreeCache(flags.cache_dir).clear();
+    std::cout << "removed " << removed << " cached trees" << std::endl;
+    return 0;
+  }
+  DiagnosticBuffer diagnostics(flags.parse_string.empty() ? flags.filename
+                                                          : "");
+  if (!flags.keep_going) {
+    return parse_source(flags, diagnostics);
+  }
+  // with -k a source that can't be read or lexed is one more diagnostic,
+  // as it is in batch mode
+  try {
+    return parse_source(flags, diagnostics);
+  } catch (const std::exception &e) {
+    Diagnostic error;
+    error.message = e.what();
+    diagnostics.add(std::move(error));
+    FdWriter err(STDERR_FILENO);
+    diagnostics.emit(err, flags.diagnostics);
+    return 1;
+  }
 }
@@ -0,0 +1,190 @@
+#include "memory_stats.h"
+#include "fd_writer.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
+namespace {
+
+thread_local MemoryPhase phase_of_thread = MemoryPhase::OTHER;
+
+#ifdef SNIP_ALLOC_STATS
+struct Counters {
+  std::atomic<std::size_t> allocations{0};
+  std::atomic<std::size_t> frees{0};
+  std::atomic<std::size_t> bytes{0};
+  std::atomic<std::size_t> live_bytes{0};
+  std::atomic<std::size_t> peak_bytes{0};
+};
+
+// one per phase, the last is the total
+Counters counters[memory_phase_count + 1];
+
+// every block starts with its size and phase, so a free is counted
+// against the phase that allocated it. the header keeps the alignment
+// operator new promises
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+  std::size_t size;
+  MemoryPhase phase;
+};
+
+void count_allocation(Counters &counter, std::size_t size) noexcept {
+  counter.allocations.fetch_add(1, std::memory_order_relaxed);
+  counter.bytes.fetch_add(size, std::memory_order_relaxed);
+  std::size_t live =
+      counter.live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+  std::size_t peak = counter.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !counter.peak_bytes.compare_exchange_weak(
+                            peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void count_free(Counters &counter, std::size_t size) noexcept {
+  counter.frees.fetch_add(1, std::memory_order_relaxed);
+  counter.live_bytes.fetch_sub(size, std::memory_order_relaxed);
+}
+
+PhaseMemory snapshot(const Counters &counter) noexcept {
+  PhaseMemory memory;
+  memory.allocations = counter.allocations.load(std::memory_order_relaxed);
+  memory.frees = counter.frees.load(std::memory_order_relaxed);
+  memory.bytes = counter.bytes.load(std::memory_order_relaxed);
+  memory.live_bytes = counter.live_bytes.load(std::memory_order_relaxed);
+  memory.peak_bytes = counter.peak_bytes.load(std::memory_order_relaxed);
+  return memory;
+}
+#endif
+
+void write_phase(FdWriter &out, const char *name, const PhaseMemory &memory) {
+  char line[256];
+  int n = std::snprintf(line, sizeof(line),
+                        "phase=%s allocations=%zu frees=%zu bytes=%zu "
+                        "live_bytes=%zu peak_bytes=%zu\n",
+                        name, memory.allocations, memory.frees, memory.bytes,
+                        memory.live_bytes, memory.peak_bytes);
+  out.write(std::string_view(line, n));
+}
+
+} // namespace
+
+const char *to_string(MemoryPhase phase) noexcept {
+  switch (phase) {
+  case MemoryPhase::LEXER:
+    return "lexer";
+  case MemoryPhase::PARSER:
+    return "parser";
+  case MemoryPhase::SEMANTIC:
+    return "semantic";
+  case MemoryPhase::HELPER:
+    return "helper";
+  default:
+    return "other";
+  }
+}
+
+const PhaseMemory &
+MemoryReport::operator[](MemoryPhase phase) const noexcept {
+  return this->phases[static_cast<std::size_t>(phase)];
+}
+
+MemoryReport memory_report() noexcept {
+  MemoryReport report;
+#ifdef SNIP_ALLOC_STATS
+  for (std::size_t i = 0; i < memory_phase_count; i++) {
+    report.phases[i] = snapshot(counters[i]);
+  }
+  report.total = snapshot(counters[memory_phase_count]);
+#endif
+  return report;
+}
+
+void write_memory_report(FdWriter &out, const MemoryReport &report) {
+  for (std::size_t i = 0; i < memory_phase_count; i++) {
+    write_phase(out, to_string(static_cast<MemoryPhase>(i)),
+                report.phases[i]);
+  }
+  write_phase(out, "total", report.total);
+}
+
+#ifndef SNIP_ALLOC_STATS
+void *counted_realloc(void *block, std::size_t size) {
+  void *resized = std::realloc(block, size == 0 ? 1 : size);
+  if (resized == nullptr) {
+    throw std::bad_alloc();
+  }
+  return resized;
+}
+
+void counted_free(void *block) noexcept { std::free(block); }
+#endif
+
+MemoryPhase current_memory_phase() noexcept { return phase_of_thread; }
+
+void set_memory_phase(MemoryPhase phase) noexcept { phase_of_thread = phase; }
+
+#ifdef SNIP_ALLOC_STATS
+// the block keeps its header in front, a resize is counted as the old size
+// freed and the new one allocated
+void *counted_realloc(void *block, std::size_t size) {
+  BlockHeader *header =
+      block == nullptr ? nullptr : static_cast<BlockHeader *>(block) - 1;
+  std::size_t old_size = header == nullptr ? 0 : header->size;
+  MemoryPhase old_phase = header == nullptr ? phase_of_thread : header->phase;
+  void *raw = std::realloc(header, sizeof(BlockHeader) + size);
+  if (raw == nullptr) {
+    throw std::bad_alloc();
+  }
+  if (block != nullptr) {
+    count_free(counters[static_cast<std::size_t>(old_phase)], old_size);
+    count_free(counters[memory_phase_count], old_size);
+  }
+  header = static_cast<BlockHeader *>(raw);
+  header->size = size;
+  header->phase = phase_of_thread;
+  count_allocation(counters[static_cast<std::size_t>(header->phase)], size);
+  count_allocation(counters[memory_phase_count], size);
+  return header + 1;
+}
+
+void counted_free(void *block) noexcept {
+  if (block == nullptr) {
+    return;
+  }
+  BlockHeader *header = static_cast<BlockHeader *>(block) - 1;
+  count_free(counters[static_cast<std::size_t>(header->phase)], header->size);
+  count_free(counters[memory_phase_count], header->size);
+  std::free(header);
+}
+
+void *operator new(std::size_t size) {
+  void *raw = std::malloc(sizeof(BlockHeader) + size);
+  if (raw == nullptr) {
+    throw std::bad_alloc();
+  }
+  BlockHeader *header = static_cast<BlockHeader *>(raw);
+  header->size = size;
+  header->phase = phase_of_thread;
+  count_allocation(counters[static_cast<std::size_t>(header->phase)], size);
+  count_allocation(counters[memory_phase_count], size);
+  return header + 1;
+}
+
+void operator delete(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  BlockHeader *header = static_cast<BlockHeader *>(ptr) - 1;
+  count_free(counters[static_cast<std::size_t>(header->phase)], header->size);
+  count_free(counters[memory_phase_count], header->size);
+  std::free(header);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept { operator delete(ptr); }
+void *operator new[](std::size_t size) { return operator new(size); }
+void operator delete[](void *ptr) noexcept { operator delete(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept {
+  operator delete(ptr);
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+
+class FdWriter;
+
+// heap use of the front end, split by the phase that allocated it. built
+// with make ALLOC_STATS=1 (SNIP_ALLOC_STATS) the global operator new and
+// delete in memory_stats.cpp count every allocation against the phase of
+// the thread making it, and a free against the phase the block came from.
+// otherwise nothing is counted and MemoryPhaseScope is empty
+enum class MemoryPhase : std::uint8_t {
+  OTHER,
+  LEXER,
+  PARSER,
+  SEMANTIC,
+  HELPER,
+};
+
+inline constexpr std::size_t memory_phase_count = 5;
+
+const char *to_string(MemoryPhase phase) noexcept;
+
+struct PhaseMemory {
+  std::size_t allocations = 0;
+  std::size_t frees = 0;
+  // every byte handed out, freed or not
+  std::size_t bytes = 0;
+  std::size_t live_bytes = 0;
+  // the most live_bytes has been
+  std::size_t peak_bytes = 0;
+};
+
+struct MemoryReport {
+  PhaseMemory phases[memory_phase_count];
+  // peak_bytes of the total is the process peak, not the sum of the phases
+  PhaseMemory total;
+
+  const PhaseMemory &operator[](MemoryPhase phase) const noexcept;
+};
+
+#ifdef SNIP_ALLOC_STATS
+inline constexpr bool memory_stats_enabled = true;
+#else
+inline constexpr bool memory_stats_enabled = false;
+#endif
+
+// a snapshot of the counters, all zero without SNIP_ALLOC_STATS
+MemoryReport memory_report() noexcept;
+// one line per phase and the total, phase=... allocations=... and so on
+void write_memory_report(FdWriter &out, const MemoryReport &report);
+
+// malloc-style blocks that can grow and shrink in place, counted like
+// operator new when built with SNIP_ALLOC_STATS. counted_realloc(nullptr,
+// size) allocates, and throws std::bad_alloc when it can't
+void *counted_realloc(void *block, std::size_t size);
+void counted_free(void *block) noexcept;
+
+MemoryPhase current_memory_phase() noexcept;
+void set_memory_phase(MemoryPhase phase) noexcept;
+
+// allocations on this thread go to phase until the scope ends, then to
+// whatever phase was current before. ThreadPool::run hands the caller's
+// phase to its workers
+class MemoryPhaseScope {
+public:
+#ifdef SNIP_ALLOC_STATS
+  explicit MemoryPhaseScope(MemoryPhase phase) noexcept
+      : previous(current_memory_phase()) {
+    set_memory_phase(phase);
+  }
+  ~MemoryPhaseScope() { set_memory_phase(this->previous); }
+#else
+  explicit MemoryPhaseScope(MemoryPhase) noexcept {}
+#endif
+  MemoryPhaseScope(const MemoryPhaseScope &) = delete;
+  MemoryPhaseScope &operator=(const MemoryPhaseScope &) = delete;
+
+#ifdef SNIP_ALLOC_STATS
+private:
+  MemoryPhase previous;
+#endif
+};
+
+#endif // !MEMORY_STATS_H
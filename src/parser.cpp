@@ -1,7 +1,12 @@
 #include "parser.h"
-#include "error.h"
+#include "diagnostics.h"
+#include "expr_pool.h"
+#include "fd_writer.h"
+#include "flat_tree.h"
 #include "globals.h"
 #include "helper.h"
+#include "lexer.h"
+#include "memory_stats.h"
 #include <cassert>
 #include <climits>
 #include <iostream>
@@ -10,6 +15,7 @@
 #include <sstream>
 #include <stack>
 #include <stdexcept>
+#include <utility>
 
 bool operator==(Token t, ParserToken pt) {
   return static_cast<int>(t) == static_cast<int>(pt);
@@ -27,98 +33,7 @@ ParserTokenChunk tc_to_ptc(const TokenChunk &tc) {
   ParserTokenChunk ptc;
   ptc.type = token_to_parser_token(tc.type);
   ptc.value = tc.value;
-  return ptc;
-}
-
-struct OutputQueueNode {
-  std::unique_ptr<PTNode> node = nullptr;
-  OutputQueueNode *next = nullptr;
-};
-
-struct OutputQueue {
-  OutputQueueNode *head = nullptr;
-  OutputQueueNode *tail = nullptr;
-};
-/*
- * Adds nodes to tail
- */
-void add_sym_to_output_queue(std::unique_ptr<OutputQueue> &queue,
-                             ParserTokenChunk &sym) {
-  OutputQueueNode *new_node = new OutputQueueNode;
-  new_node->node = std::make_unique<PTNode>(sym);
-  if (queue->tail == nullptr) {
-    queue->tail = new_node;
-    queue->head = new_node;
-  } else {
-    queue->tail->next = new_node;
-    queue->tail = queue->tail->next;
-  }
-}
-
-/*
-  Add nodes to tail
- */
-void add_node_to_output_queue(std::unique_ptr<OutputQueue> &queue,
-                              PTNode *node) {
-  OutputQueueNode *new_node = new OutputQueueNode;
-  new_node->node = std::unique_ptr<PTNode>(node);
-  if (queue->tail == nullptr) {
-    queue->tail = new_node;
-    queue->head = new_node;
-  } else {
-    queue->tail->next = new_node;
-    queue->tail = queue->tail->next;
-  }
-}
-
-/*
- * Remove nodes from head
- */
-std::unique_ptr<PTNode>
-pop_from_output_queue(std::unique_ptr<OutputQueue> &queue) {
-  if (queue->head == nullptr) {
-    return nullptr;
-  }
-  std::unique_ptr<PTNode> node = std::move(queue->head->node);
-  OutputQueueNode *temp = queue->head;
-  queue->head = temp->next;
-  if (queue->head == nullptr) {
-    queue->tail = nullptr;
-  }
-  delete temp;
-  return node;
-}
-
-struct OperatorStackNode {
-  ParserTokenChunk *ptc = nullptr;
-  OperatorStackNode *next = nullptr;
-};
-
-struct OperatorStack {
-  OperatorStackNode *head = nullptr;
-};
-
-void add_op_to_stack(std::unique_ptr<OperatorStack> &stack,
-                     ParserTokenChunk &op) {
-  OperatorStackNode *new_node = new OperatorStackNode;
-  new_node->ptc = new ParserTokenChunk;
-  new_node->ptc->type = op.type;
-  new_node->ptc->value = op.value;
-  new_node->next = stack->head;
-  stack->head = new_node;
-}
-
-std::unique_ptr<ParserTokenChunk>
-pop_from_stack(std::unique_ptr<OperatorStack> &stack) {
-  if (stack->head == nullptr) {
-    throw std::runtime_error("pop_from_stack() called on empty stack");
-    return nullptr;
-  }
-  std::unique_ptr<ParserTokenChunk> ptc =
-      std::make_unique<ParserTokenChunk>(*stack->head->ptc);
-  OperatorStackNode *temp = stack->head;
-  stack->head = temp->next;
-  delete temp;
+  ptc.sym = tc.sym;
   return ptc;
 }
 
@@ -130,34 +45,31 @@ TokenChunk ptc_to_tc(const ParserTokenChunk &ptc) {
   TokenChunk tc;
   tc.type = parser_token_to_token(ptc.type);
   tc.value = ptc.value;
+  tc.sym = ptc.sym;
   return tc;
 }
 
-Parser::Parser(std::unique_ptr<TokenChunk[]> &token_s) {
+Parser::Parser(TokenArray &token_s, std::string_view source)
+    : lines(source), has_source(source.data() != nullptr) {
   token_stream = std::move(token_s);
   ParserTokenChunk ptc;
 }
 
-void PTNode::print(const int spaces) {
-  for (int i = 0; i < spaces; i++) {
-    std::cout << " ";
-  }
-  if (this->val->type == ParserToken::INT) {
-    std::cout << token_to_string(this->val->type) << " "
-              << std::get<int>(this->val->value) << std::endl;
-  } else if (this->val->type == ParserToken::DOUBLE) {
-    std::cout << token_to_string(this->val->type) << " "
-              << std::get<double>(this->val->value) << std::endl;
-  } else {
-    std::cout << token_to_string(this->val->type) << " "
-              << std::get<std::string>(this->val->value) << std::endl;
-  }
-  if (this->first_child) {
-    this->first_child->print(spaces + 2);
+Parser::Parser(Lexer &lexer)
+    : lexer(&lexer), lines(lexer.source_view()), has_source(true) {
+  for (std::size_t i = 0; i < lookahead_depth; i++) {
+    this->ring[i] = lexer.next_token();
   }
-  if (this->next_sibling) {
-    this->next_sibling->print(spaces);
+}
+
+void PTNode::print(const int spaces) {
+  PTNodeWalk walk(this);
+  for (PTNode *node = walk.next(); node != nullptr; node = walk.next()) {
+    std::cout << std::string(spaces + 2 * walk.depth(), ' ')
+              << token_to_string(node->val.type) << " " << node->val.value
+              << "\n";
   }
+  std::cout.flush();
 }
 
 PTNode *PTNode::get_first_child() {
@@ -169,87 +81,115 @@ PTNode *PTNode::get_next_sibling() {
 }
 
 const std::string PTNode::get_type() {
-  return token_to_string(this->val->type);
+  return token_to_string(this->val.type);
 }
 
-void output_nodes_recursively(const int spaces, PTNode *node,
-                              std::stringstream &ss) {
-  if (node == nullptr) {
-    return;
-  }
-  for (int i = 0; i < spaces; i++) {
-    ss << " ";
-  }
-  ss << node->get_type() << std::endl;
-  output_nodes_recursively(spaces + 2, node->get_first_child(), ss);
-  output_nodes_recursively(spaces, node->get_next_sibling(), ss);
+std::string Parser::output_tree_as_str() {
+  return FlatTree(*this->tree).output();
 }
 
-std::string Parser::output_tree_as_str() { return this->head->output(); }
-
 // return the parse tree as a string
 std::string PTNode::output() {
-  std::stringstream ss;
-  output_nodes_recursively(0, this, ss);
-  return ss.str();
+  std::string out;
+  PTNodeWalk walk(this);
+  for (PTNode *node = walk.next(); node != nullptr; node = walk.next()) {
+    out.append(2 * walk.depth(), ' ');
+    out += token_to_string(node->val.type);
+    out += '\n';
+  }
+  return out;
 }
 
-PTNode* PTNode::add_child(ParserTokenChunk &tok) {
-  if (this->last_child != nullptr) {
-    this->last_child->add_sibling(tok);
-    this->last_child = this->last_child->next_sibling;
-  } else {
-    this->first_child = new PTNode(tok);
-    this->first_child->val->value = tok.value;
-    this->first_child->val->type = tok.type;
-    this->last_child = this->first_child;
+void PTNode::write(FdWriter &out) {
+  PTNodeWalk walk(this);
+  for (PTNode *node = walk.next(); node != nullptr; node = walk.next()) {
+    out.fill(' ', 2 * walk.depth());
+    out.write(token_to_string(node->val.type));
+    out.put(' ');
+    write_token_value(out, node->val.value);
+    out.put('\n');
   }
-  return this;
 }
 
-PTNode* PTNode::add_sibling(ParserTokenChunk &tok) {
-  if (this->next_sibling != nullptr) {
-    this->next_sibling->add_sibling(tok);
-  } else {
-    this->next_sibling = new PTNode(tok);
-    ;
-    this->next_sibling->prev_sibling = this;
+PTNodeWalk::PTNodeWalk(PTNode *start) : pending(start) {}
+
+PTNode *PTNodeWalk::next() {
+  PTNode *node = this->pending;
+  if (node == nullptr) {
+    return nullptr;
   }
-  return this;
+  this->current_depth = this->pending_depth;
+  if (node->get_first_child() != nullptr) {
+    this->resume.push_back(node->get_next_sibling());
+    this->pending = node->get_first_child();
+    this->pending_depth++;
+    return node;
+  }
+  this->pending = node->get_next_sibling();
+  while (this->pending == nullptr && !this->resume.empty()) {
+    this->pending = this->resume.back();
+    this->resume.pop_back();
+    this->pending_depth--;
+  }
+  return node;
 }
 
+std::size_t PTNodeWalk::depth() const noexcept { return this->current_depth; }
+
 void PTNode::add_sibling(PTNode *sibling) {
-  if (this->next_sibling != nullptr) {
-    this->next_sibling->add_sibling(sibling);
-  } else {
-    this->next_sibling = sibling;
-    if (sibling != nullptr) {
-      sibling->prev_sibling = this;
-    }
+  PTNode *last = this;
+  while (last->next_sibling != nullptr) {
+    last = last->next_sibling;
+  }
+  last->next_sibling = sibling;
+  if (sibling != nullptr) {
+    sibling->prev_sibling = last;
   }
 }
 
+// last_child is kept at the end of the chain, so appending doesn't walk
+// the children already there. a child that brings siblings of its own
+// costs as many steps as it brings
 PTNode* PTNode::add_child(PTNode *child) {
+  if (child == nullptr) {
+    return this;
+  }
   if (this->last_child != nullptr) {
-    this->last_child->add_sibling(child);
-    this->last_child = this->last_child->next_sibling;
+    this->last_child->next_sibling = child;
+    child->prev_sibling = this->last_child;
   } else {
     this->first_child = child;
-    this->first_child = child;
-    this->last_child = this->first_child;
   }
-  return this ;
+  this->last_child = child;
+  while (this->last_child->next_sibling != nullptr) {
+    this->last_child = this->last_child->next_sibling;
+  }
+  return this;
 }
 
-PTNode::~PTNode() { // NOTE: pointless
-  delete first_child;
-  delete next_sibling;
+PTNode::PTNode(ParserTokenChunk tok) : val(tok) {}
+
+PTNode *ParseTree::make_node(const ParserTokenChunk &tok) {
+  this->count++;
+  return this->nodes.make<PTNode>(tok);
 }
 
-PTNode::PTNode(ParserTokenChunk tok) {
-  this->val = std::make_unique<ParserTokenChunk>();
-  this->val->type = tok.type;
-  this->val->value = tok.value;
+PTNode *ParseTree::root() const noexcept { return this->head; }
+
+void ParseTree::clear() noexcept {
+  this->nodes.reset();
+  this->head = nullptr;
+  this->count = 0;
+}
+
+void ParseTree::set_root(PTNode *root) noexcept { this->head = root; }
+
+std::size_t ParseTree::node_count() const noexcept { return this->count; }
+
+const ParseArena &ParseTree::arena() const noexcept { return this->nodes; }
+
+PTNode *Parser::node(const ParserTokenChunk &tok) {
+  return this->tree->make_node(tok);
 }
 
 OperatorPrecedence token_type_to_precedence(const ParserToken &tok) {
@@ -265,7 +205,11 @@ OperatorPrecedence token_type_to_precedence(const ParserToken &tok) {
   case ParserToken::GREATERTHAN:
   case ParserToken::LESSERTHAN:
     return OperatorPrecedence::COMPARISON;
+  case ParserToken::EQUAL:
+  case ParserToken::NOTEQUAL:
+    return OperatorPrecedence::EQUALITY;
   case ParserToken::NOT:
+  case ParserToken::EXCLAIM:
     return OperatorPrecedence::NOT;
   case ParserToken::ASSIGN:
     return OperatorPrecedence::ASSIGN;
@@ -278,41 +222,182 @@ OperatorPrecedence token_type_to_precedence(const ParserToken &tok) {
   }
 }
 
-void Parser::next() { this->_ptr++; }
+// the levels of the operators that sit between two operands, NONE for
+// anything else. assignment is a statement, not an operator
+OperatorPrecedence binary_precedence(Token tok) {
+  OperatorPrecedence level =
+      token_type_to_precedence(token_to_parser_token(tok));
+  if (level == OperatorPrecedence::ASSIGN || level == OperatorPrecedence::NOT) {
+    return OperatorPrecedence::NONE;
+  }
+  return level;
+}
+
+Parser::Parser(const TokenStream &stream)
+    : stream(&stream), lines(stream.source_view()), has_source(true) {}
+
+// byte offset of the token at the cursor, a stream is read without decoding
+std::size_t Parser::offset() const {
+  if (this->stream != nullptr) {
+    return this->stream->offset(this->_ptr);
+  }
+  return this->get().offset;
+}
+
+// the diagnostic for a problem at the current token. running into the end
+// of the input is reported as that, whatever was expected there
+Unexpected<Diagnostic> Parser::fail(const std::string &message) const {
+  Diagnostic diagnostic;
+  diagnostic.message =
+      this->kind() == Token::END ? "unexpected end of input" : message;
+  if (this->has_source) {
+    SourceLocation loc = this->lines.locate(this->offset());
+    diagnostic.line = loc.line;
+    diagnostic.column = loc.column;
+  }
+  return unexpected(std::move(diagnostic));
+}
 
-TokenChunk Parser::peek() const noexcept {
-  return this->token_stream[_ptr + 1];
+// streaming keeps [_ptr, _ptr + lookahead_depth) lexed, the slot being
+// refilled last held the token lookahead_depth behind the cursor
+void Parser::next() {
+  // the cursor stays on END, whatever comes next fails on it
+  if (this->kind() == Token::END) {
+    return;
+  }
+  if (this->stream != nullptr) {
+    this->payload_cursor += token_has_payload(this->stream->kind(this->_ptr));
+  }
+  this->_ptr++;
+  if (this->lexer != nullptr) {
+    this->ring[(this->_ptr + lookahead_depth - 1) % ring_size] =
+        this->lexer->next_token();
+  }
 }
-TokenChunk Parser::peek(int k) const { return this->token_stream[_ptr + k]; }
 
-TokenChunk Parser::get() const noexcept { return this->token_stream[_ptr]; }
+// the cursor hands out references into the token stream, tokens are never
+// copied while parsing. a TokenStream is decoded on demand into a slot for
+// get() and one for peek(), each is overwritten by the next such call
+const TokenChunk &Parser::peek() const noexcept { return this->peek(1); }
 
-PTNode *Parser::parse_stmts() {
-  PTNode *stmts = new PTNode(this->ptcs.stmts);
-  if (this->get().type != Token::LEFTBRACE) {
-    throw std::runtime_error("parse_stmts() expects a left brace, statements "
-                             "without braces are not supported yet");
-    return nullptr;
+const TokenChunk &Parser::peek(int k) const {
+  if (this->stream != nullptr) {
+    std::size_t payload = this->payload_cursor;
+    for (int i = 0; i < k; i++) {
+      payload += token_has_payload(this->stream->kind(this->_ptr + i));
+    }
+    this->decoded_peek = this->stream->token(this->_ptr + k, payload);
+    return this->decoded_peek;
+  }
+  if (this->lexer != nullptr) {
+    if (k < 0 || static_cast<std::size_t>(k) >= lookahead_depth) {
+      throw std::out_of_range("peek() past the streaming lookahead");
+    }
+    return this->ring[(_ptr + k) % ring_size];
+  }
+  return this->token_stream[_ptr + k];
+}
+
+const TokenChunk &Parser::get() const noexcept {
+  if (this->stream != nullptr) {
+    this->decoded = this->stream->token(this->_ptr, this->payload_cursor);
+    return this->decoded;
+  }
+  if (this->lexer != nullptr) {
+    return this->ring[_ptr % ring_size];
+  }
+  return this->token_stream[_ptr];
+}
+
+// kind checks read the kind array directly and decode nothing
+Token Parser::kind() const noexcept {
+  if (this->stream != nullptr) {
+    return this->stream->kind(this->_ptr);
+  }
+  return this->get().type;
+}
+
+Token Parser::peek_kind(int k) const {
+  if (this->stream != nullptr) {
+    return this->stream->kind(this->_ptr + k);
   }
-  PTNode *braces = new PTNode(this->ptcs.left_brace);
+  return this->peek(k).type;
+}
+
+ParseResult Parser::parse_stmts() {
+  if (this->kind() != Token::LEFTBRACE) {
+    return this->fail("parse_stmts() expects a left brace, statements "
+                      "without braces are not supported yet");
+  }
+  PTNode *stmts = this->node(this->ptcs.stmts);
+  PTNode *braces = this->node(this->ptcs.left_brace);
   this->next();
-  while (this->get().type != Token::RIGHTBRACE) {
-    PTNode *stmt = this->parse_stmt();
-    braces->add_child(stmt);
+  while (this->kind() != Token::RIGHTBRACE) {
+    if (this->kind() == Token::END) {
+      return this->fail("block expects a right brace");
+    }
+    ParseResult stmt = this->parse_stmt();
+    if (stmt) {
+      braces->add_child(*stmt);
+    } else if (!this->recover(stmt.error(), true)) {
+      return stmt;
+    }
   }
   this->next();
   stmts->add_child(braces);
-  stmts->add_child(new PTNode(this->ptcs.right_brace));
+  stmts->add_child(this->node(this->ptcs.right_brace));
   return stmts;
 }
 
-void Parser::parse_body(PTNode *start_token) {
-  while (this->get().type != Token::END) {
-    PTNode *stmt = this->parse_stmt();
-    if (stmt == nullptr) {
-      throw std::runtime_error("stmt is somehow null");
+ParseResult Parser::parse_body(PTNode *start_token) {
+  while (this->kind() != Token::END) {
+    ParseResult stmt = this->parse_stmt();
+    if (stmt) {
+      start_token->add_child(*stmt);
+    } else if (!this->recover(stmt.error(), false)) {
+      return stmt;
+    }
+  }
+  return start_token;
+}
+
+// false when there is no diagnostics buffer and the error has to end the
+// parse. otherwise it is recorded and the tokens up to the end of the
+// broken statement are skipped: past the next ; or the } closing a block
+// opened inside the statement. a } closing the enclosing block is left for
+// that block, one at the top level with nothing to close is skipped
+bool Parser::recover(Diagnostic &error, bool in_block) {
+  if (this->diagnostics == nullptr) {
+    return false;
+  }
+  this->diagnostics->add(std::move(error));
+  std::size_t nesting = 0;
+  for (;; this->next()) {
+    switch (this->kind()) {
+    case Token::END:
+      return true;
+    case Token::SEMICOLON:
+      if (nesting == 0) {
+        this->next();
+        return true;
+      }
+      break;
+    case Token::LEFTBRACE:
+      nesting++;
+      break;
+    case Token::RIGHTBRACE:
+      if (nesting == 0 && in_block) {
+        return true;
+      }
+      if (nesting <= 1) {
+        this->next();
+        return true;
+      }
+      nesting--;
+      break;
+    default:
+      break;
     }
-    start_token->add_child(stmt);
   }
 }
 
@@ -322,374 +407,481 @@ bool is_type(const Token tok) {
 }
 
 // Type <identifier>
-PTNode *Parser::parse_variable() {
-  PTNode *variable = new PTNode(this->ptcs.variable);
-  if (!is_type(this->get().type)) {
-    throw std::runtime_error("parse_variable() expects a type");
-  }
-  ParserTokenChunk type = {token_to_parser_token(this->get().type),
-                           this->get().value};
-  variable->add_child(type);
+ParseResult Parser::parse_variable() {
+  if (!is_type(this->kind())) {
+    return this->fail("parse_variable() expects a type");
+  }
+  PTNode *variable = this->node(this->ptcs.variable);
+  ParserTokenChunk type = tc_to_ptc(this->get());
+  variable->add_child(this->node(type));
   this->next();
-  if (this->get().type != Token::IDENTIFIER) {
-    throw std::runtime_error("parse_variable() expects an identifier");
+  if (this->kind() != Token::IDENTIFIER) {
+    return this->fail("parse_variable() expects an identifier");
   }
-  ParserTokenChunk ident = {token_to_parser_token(this->get().type),
-                            this->get().value};
-  variable->add_child(ident);
+  ParserTokenChunk ident = tc_to_ptc(this->get());
+  variable->add_child(this->node(ident));
   return variable;
 }
 
 // ( <variable> (, <variable>*) )
-PTNode *Parser::parse_formal() {
-  PTNode *formal = new PTNode(this->ptcs.formal);
-  if (this->get().type != Token::LEFTPARENTHESIS) {
-    throw std::runtime_error("formal expects a left parenthesis");
+ParseResult Parser::parse_formal() {
+  if (this->kind() != Token::LEFTPARENTHESIS) {
+    return this->fail("formal expects a left parenthesis");
   }
+  PTNode *formal = this->node(this->ptcs.formal);
   this->next();
-  formal->add_child(this->ptcs.left_paren);
-  while (this->get().type != Token::RIGHTPARENTHESIS) {
-    if (this->get().type == Token::COMMA) {
+  formal->add_child(this->node(this->ptcs.left_paren));
+  while (this->kind() != Token::RIGHTPARENTHESIS) {
+    if (this->kind() == Token::COMMA) {
       this->next();
       continue;
     }
-    PTNode *variable = this->parse_variable();
-    if (variable == nullptr) {
-      throw std::runtime_error("formal expects a left parenthesis");
+    ParseResult variable = this->parse_variable();
+    if (!variable) {
+      return variable;
     }
-    formal->add_child(variable);
+    formal->add_child(*variable);
     this->next();
   }
   return formal;
 }
 
 // ( <expr> (, <expr>)* )
-PTNode *Parser::parse_factor() {
-  assert(this->get().type != Token::LEFTPARENTHESIS);
-  PTNode *factor = new PTNode(this->ptcs.factor);
-  factor->add_child(this->ptcs.left_paren);
+ParseResult Parser::parse_factor() {
+  assert(this->kind() == Token::LEFTPARENTHESIS);
+  PTNode *factor = this->node(this->ptcs.factor);
+  factor->add_child(this->node(this->ptcs.left_paren));
   this->next();
-  while (this->get().type != Token::RIGHTPARENTHESIS) {
-    if (this->get().type == Token::COMMA) {
+  while (this->kind() != Token::RIGHTPARENTHESIS) {
+    if (this->kind() == Token::COMMA) {
       this->next();
       continue;
     }
-    PTNode *expr = this->parse_expr();
-    if (expr == nullptr) {
-      throw std::runtime_error("factor expects an expr");
+    ParseResult expr = this->parse_expr();
+    if (!expr) {
+      return expr;
     }
-    factor->add_child(expr);
+    factor->add_child(*expr);
   }
-  factor->add_child(this->ptcs.right_paren);
+  factor->add_child(this->node(this->ptcs.right_paren));
   return factor;
 }
 
 // <fn> <identifier> : <type> (formal) <stmts>
-PTNode *Parser::parse_fn_decl() {
-  PTNode *fn_decl{new PTNode(this->ptcs.fn_decl)};
-  fn_decl->add_child(this->ptcs.fn);
+ParseResult Parser::parse_fn_decl() {
+  PTNode *fn_decl{this->node(this->ptcs.fn_decl)};
+  fn_decl->add_child(this->node(this->ptcs.fn));
   this->next();
-  ParserTokenChunk ident_ptc = {token_to_parser_token(this->get().type),
-                                this->get().value};
+  ParserTokenChunk ident_ptc = tc_to_ptc(this->get());
   if (ident_ptc.type != ParserToken::IDENTIFIER) {
-    throw std::runtime_error(
+    return this->fail(
         "Function name in function declaration is not an identifier");
   }
   this->next();
-  PTNode *ident = new PTNode(ident_ptc);
+  PTNode *ident = this->node(ident_ptc);
   fn_decl->add_child(ident);
-  if (this->get().type != Token::COLON) {
-    Error("Invalid function declaration syntax").logError();
+  if (this->kind() != Token::COLON) {
+    return this->fail("Invalid function declaration syntax");
   }
-  fn_decl->add_child(this->ptcs.colon);
+  fn_decl->add_child(this->node(this->ptcs.colon));
   this->next();
-  if (!is_type(this->get().type)) {
-    Error("Invalid type specifier in function declaration").logError();
+  if (!is_type(this->kind())) {
+    return this->fail("Invalid type specifier in function declaration");
   }
-  ParserTokenChunk fn_type_ptc = {token_to_parser_token(this->get().type), ""};
-  fn_decl->add_child(fn_type_ptc);
+  ParserTokenChunk fn_type_ptc = {token_to_parser_token(this->kind()), ""};
+  fn_decl->add_child(this->node(fn_type_ptc));
   this->next();
-  fn_decl->add_child(this->parse_formal());
+  ParseResult formal = this->parse_formal();
+  if (!formal) {
+    return formal;
+  }
+  fn_decl->add_child(*formal);
   this->next();
-  PTNode *block = this->parse_stmts();
-  if (block == nullptr) {
-    Error("function declaration body is undefined:").logError();
+  ParseResult block = this->lazy_fn_bodies && this->lexer == nullptr
+                          ? this->skip_fn_body()
+                          : this->parse_stmts();
+  if (!block) {
+    return block;
   }
-  fn_decl->add_child(block);
+  fn_decl->add_child(*block);
   return fn_decl;
 }
 
+// the body's tokens are only counted through to the matching right brace
+ParseResult Parser::skip_fn_body() {
+  if (this->kind() != Token::LEFTBRACE) {
+    return this->fail("parse_stmts() expects a left brace, statements "
+                      "without braces are not supported yet");
+  }
+  int index = static_cast<int>(this->lazy_bodies.size());
+  this->lazy_bodies.push_back({this->_ptr, this->payload_cursor, nullptr});
+  std::size_t nesting = 0;
+  do {
+    switch (this->kind()) {
+    case Token::END:
+      return this->fail("block expects a right brace");
+    case Token::LEFTBRACE:
+      nesting++;
+      break;
+    case Token::RIGHTBRACE:
+      nesting--;
+      break;
+    default:
+      break;
+    }
+    this->next();
+  } while (nesting > 0);
+  PTNode *body = this->node({ParserToken::LAZYBODY, index});
+  this->lazy_bodies[index].node = body;
+  return body;
+}
+
+void Parser::set_lazy_fn_bodies(bool lazy) noexcept {
+  this->lazy_fn_bodies = lazy;
+}
+
+// the body is parsed from where skip_fn_body() found it and its nodes are
+// moved under the LAZYBODY node, which becomes the STMTS node. the cursor
+// is put back afterwards
+ParseResult Parser::parse_fn_body(PTNode *fn_decl) {
+  if (fn_decl == nullptr || fn_decl->get_val()->type != ParserToken::FNDECL) {
+    throw std::invalid_argument("parse_fn_body() expects a FNDECL node");
+  }
+  PTNode *body = fn_decl->get_first_child();
+  while (body->get_next_sibling() != nullptr) {
+    body = body->get_next_sibling();
+  }
+  if (body->get_val()->type != ParserToken::LAZYBODY) {
+    return body;
+  }
+  return this->parse_lazy_body(std::get<int>(body->get_val()->value));
+}
+
+ParseResult Parser::parse_lazy_body(int index) {
+  const BodyStart &start = this->lazy_bodies.at(index);
+  PTNode *body = start.node;
+  if (body->get_val()->type != ParserToken::LAZYBODY) {
+    return body;
+  }
+  std::size_t ptr = this->_ptr;
+  std::size_t payload = this->payload_cursor;
+  this->_ptr = start.token;
+  this->payload_cursor = start.payload;
+  ParseResult parsed = this->parse_stmts();
+  this->_ptr = ptr;
+  this->payload_cursor = payload;
+  if (!parsed) {
+    return parsed;
+  }
+  body->add_child((*parsed)->get_first_child());
+  *body->get_val() = this->ptcs.stmts;
+  return body;
+}
+
 // ! <identifier>  (<factor>) ;
-PTNode *Parser::parse_fn_call() {
-  PTNode *fn_call = new PTNode(this->ptcs.fn_call);
-  fn_call->add_child(this->ptcs.exclam);
+ParseResult Parser::parse_fn_call() {
+  PTNode *fn_call = this->node(this->ptcs.fn_call);
+  fn_call->add_child(this->node(this->ptcs.exclam));
   this->next();
-  ParserTokenChunk ident_ptc = {token_to_parser_token(this->get().type),
-                                this->get().value};
+  ParserTokenChunk ident_ptc = tc_to_ptc(this->get());
   if (ident_ptc.type != ParserToken::IDENTIFIER) {
-    throw std::runtime_error(
-        "Function name in function call is not an identifier");
+    return this->fail("Function name in function call is not an identifier");
   }
+  fn_call->add_child(this->node(ident_ptc));
   this->next();
-  if (this->get().type != Token::LEFTPARENTHESIS) {
-    throw std::runtime_error("Function call expects a left parenthesis");
+  if (this->kind() != Token::LEFTPARENTHESIS) {
+    return this->fail("Function call expects a left parenthesis");
   }
-  PTNode *factor = this->parse_factor();
-  fn_call->add_child(factor);
+  ParseResult factor = this->parse_factor();
+  if (!factor) {
+    return factor;
+  }
+  fn_call->add_child(*factor);
   this->next();
-  if (this->get().type == Token::SEMICOLON) {
-    fn_call->add_child(this->ptcs.semicolon);
+  if (this->kind() == Token::SEMICOLON) {
+    fn_call->add_child(this->node(this->ptcs.semicolon));
   }
   this->next();
   return fn_call;
 }
 
-PTNode *Parser::parse_stmt() {
-  PTNode *stmt{new PTNode(this->ptcs.stmt)};
-  switch (this->get().type) {
+ParseResult Parser::parse_stmt() {
+  ParseResult child = nullptr;
+  switch (this->kind()) {
   case Token::IF:
-    stmt->add_child(this->parse_if_stmt());
+    child = this->parse_if_stmt();
     break;
   case Token::WHILE:
-    stmt->add_child(this->parse_while_stmt());
+    child = this->parse_while_stmt();
+    break;
   case Token::INTK:
   case Token::CHARK:
   case Token::DOUBLEK:
   case Token::STRINGK:
-    if (this->peek().type == Token::IDENTIFIER) {
-      stmt->add_child(this->parse_var_decl());
+    if (this->peek_kind() != Token::IDENTIFIER) {
+      this->next();
+      return this->fail("Variable declaration expects an identifier");
     }
+    child = this->parse_var_decl();
     break;
   case Token::FN:
-    stmt->add_child(this->parse_fn_decl());
+    child = this->parse_fn_decl();
     break;
   case Token::EXCLAIM:
-    if (this->peek().type == Token::IDENTIFIER) {
-      stmt->add_child(this->parse_fn_call());
-    } else
-      throw std::runtime_error("Unknown symbol: !");
+    if (this->peek_kind() != Token::IDENTIFIER) {
+      return this->fail("Unknown symbol: !");
+    }
+    child = this->parse_fn_call();
     break;
   case Token::IDENTIFIER:
-    if (this->peek().type == Token::ASSIGN) {
-      stmt->add_child(this->parse_assignment());
-    } else {
-      throw std::runtime_error("parse() expects a variable declaration");
+    if (this->peek_kind() != Token::ASSIGN) {
+      return this->fail("parse() expects a variable declaration");
     }
+    child = this->parse_assignment();
     break;
   default:
-    throw std::runtime_error("Stmt type not recognized");
-    break;
+    return this->fail("Stmt type not recognized");
+  }
+  if (!child) {
+    return child;
   }
+  PTNode *stmt{this->node(this->ptcs.stmt)};
+  stmt->add_child(*child);
   return stmt;
 }
 
-PTNode *Parser::parse_assignment() {
-  PTNode *assignment = new PTNode(this->ptcs.assignstmt);
-  ParserTokenChunk ident = {ParserToken::IDENTIFIER, this->get().value};
-  PTNode *assign = new PTNode(this->ptcs.assign);
-  assignment->add_child(new PTNode(ident));
+ParseResult Parser::parse_assignment() {
+  PTNode *assignment = this->node(this->ptcs.assignstmt);
+  ParserTokenChunk ident = tc_to_ptc(this->get());
+  PTNode *assign = this->node(this->ptcs.assign);
+  assignment->add_child(this->node(ident));
   this->next();
   assignment->add_child(assign);
   this->next();
-  PTNode *expr = this->parse_expr();
-  assert(expr != nullptr);
-  assert(this->get().type == Token::SEMICOLON);
-  assignment->add_child(expr);
-  assignment->add_child(this->ptcs.semicolon);
+  ParseResult expr = this->parse_expr();
+  if (!expr) {
+    return expr;
+  }
+  if (this->kind() != Token::SEMICOLON) {
+    return this->fail("Assignment expects a semicolon");
+  }
+  assignment->add_child(*expr);
+  assignment->add_child(this->node(this->ptcs.semicolon));
   this->next();
   return assignment;
 }
 
-std::unique_ptr<ParserTokenChunk> &PTNode::get_val() { return this->val; }
+ParserTokenChunk *PTNode::get_val() { return &this->val; }
 
-bool is_operator(PTNode *node) {
-  return (node->get_val()->type == ParserToken::ADD ||
-          node->get_val()->type == ParserToken::SUBTRACT ||
-          node->get_val()->type == ParserToken::MULTIPLY ||
-          node->get_val()->type == ParserToken::DIVIDE);
+// precedence climbing over the OperatorPrecedence table. an operator
+// binds while its level is at least min_level and its right operand is
+// parsed one level tighter, so operators of one level associate to the
+// left. the tree is built as the tokens are read, a binary operation is
+// BINOP[left, right, operator] and a prefix one UNOP[operator, operand]
+ParseResult Parser::parse_binary(int min_level) {
+  ParseResult left = this->parse_unary();
+  if (!left) {
+    return left;
+  }
+  for (;;) {
+    OperatorPrecedence level = binary_precedence(this->kind());
+    if (level == OperatorPrecedence::NONE || level < min_level) {
+      return left;
+    }
+    PTNode *op = this->node(tc_to_ptc(this->get()));
+    this->next();
+    ParseResult right = this->parse_binary(level + 1);
+    if (!right) {
+      return right;
+    }
+    PTNode *binop = this->node(this->ptcs.binop);
+    binop->add_child(*left);
+    binop->add_child(*right);
+    binop->add_child(op);
+    *left = binop;
+  }
 }
 
-struct RPNStack {
-  PTNode *head = nullptr;
-  RPNStack *next = nullptr;
-};
-
-PTNode *convert_RPN_to_tree(std::unique_ptr<OutputQueue> &postfix_queue) {
-  PTNode *root = nullptr;
-  std::stack<PTNode *> rpn_stack;
-
-  // convert to rpn_ to tree format
-  // 0. make a rpn_stack that holds all the nodes from postfix_queue
-  // 1. keep popping nodes from postfix_queue
-  // 2. if an operator is encountered, then pop the last two
-  // nodes from rpn_stack
-  // 3. return a new node containing the expr back into the rpn_stack
-
-  PTNode *node = nullptr;
-
-  do {
-    node = pop_from_output_queue(postfix_queue).release();
-    if (is_operator(node) || node->get_val()->type == ParserToken::BINOP) {
-      PTNode *right = rpn_stack.top();
-      assert(right != nullptr);
-      rpn_stack.pop();
-      PTNode *left = rpn_stack.top();
-      assert(left != nullptr);
-      rpn_stack.pop();
-
-      PTNode *sub_expr_node = new PTNode({ParserToken::BINOP, ""});
-      sub_expr_node->add_child(left);
-      sub_expr_node->add_child(right);
-      sub_expr_node->add_child(node);
-      rpn_stack.push(sub_expr_node);
-    } else {
-      rpn_stack.push(node);
-    }
-  } while (postfix_queue != nullptr && postfix_queue->head != nullptr);
-  
-  
-  return rpn_stack.top();
-}
-
-PTNode *Parser::parse_expr(bool is_outer_expr) {
-  PTNode *expr{new PTNode(this->ptcs.expr)};
-  PTNode *parens{nullptr};
-  PTNode *expression{nullptr};
-  PTNode *temp{nullptr};
-  bool is_expr{false};
-  TokenChunk current;
-  ParserTokenChunk ptc;
-  std::unique_ptr<OutputQueue> output_q = std::make_unique<OutputQueue>();
-  auto op_stack{std::make_unique<OperatorStack>()};
-  if (this->get().type == Token::LEFTPARENTHESIS) {
+// - negates and ! is logical not, both bind tighter than any binary
+// operator
+ParseResult Parser::parse_unary() {
+  if (this->kind() != Token::SUBTRACT && this->kind() != Token::EXCLAIM) {
+    return this->parse_primary();
+  }
+  PTNode *op = this->node(tc_to_ptc(this->get()));
+  this->next();
+  ParseResult operand = this->parse_unary();
+  if (!operand) {
+    return operand;
+  }
+  PTNode *unop = this->node(this->ptcs.unop);
+  unop->add_child(op);
+  unop->add_child(*operand);
+  return unop;
+}
+
+// a literal, a name or ( <expr> ), which is EXPR[LEFTPARENTHESIS[inner],
+// RIGHTPARENTHESIS]
+ParseResult Parser::parse_primary() {
+  switch (this->kind()) {
+  case Token::INT:
+  case Token::DOUBLE:
+  case Token::STRING:
+  case Token::CHAR:
+  case Token::IDENTIFIER:
+  case Token::TRUEK:
+  case Token::FALSEK: {
+    PTNode *leaf = this->node(tc_to_ptc(this->get()));
     this->next();
-    parens = new PTNode(this->ptcs.left_paren);
-  }
-  expression = (parens == nullptr) ? expr : parens;
-  current = this->get();
-  while (!(is_outer_expr && current.type == Token::RIGHTPARENTHESIS) &&
-         (current.type != Token::SEMICOLON && current.type != Token::COMMA)) {
-    ptc = tc_to_ptc(current);
-    switch (current.type) {
-    case Token::LEFTPARENTHESIS:
-      is_expr = true;
-      temp = this->parse_expr(is_outer_expr = false);
-      assert(temp != nullptr);
-      expression->add_child(temp);
-      ptc = {ParserToken::EXPR, ""};
-      add_sym_to_output_queue(output_q, ptc);
-      break;
-    case Token::INT:
-    case Token::DOUBLE:
-    case Token::STRING:
-    case Token::IDENTIFIER:
-    case Token::CHAR:
-      add_sym_to_output_queue(output_q, ptc);
-      break;
-    default:
-      // operators
-      while (op_stack->head != nullptr &&
-             token_type_to_precedence(op_stack->head->ptc->type) >=
-                 token_type_to_precedence(ptc.type)) {
-        auto op = *pop_from_stack(op_stack);
-        PTNode *op_node = new PTNode({ParserToken::BINOP, ""});
-        op_node->add_child(op);
-        add_node_to_output_queue(output_q, op_node);
-      }
-      add_op_to_stack(op_stack, ptc);
-      break;
+    return leaf;
+  }
+  case Token::LEFTPARENTHESIS: {
+    this->next();
+    ParseResult inner = this->parse_binary(0);
+    if (!inner) {
+      return inner;
     }
-    // NOTE: temp fix: look at next() behavior for parse_expr
-    // this is a hack to prevent the parser from skipping tokens
-    if (!is_expr) {
-      this->next();
-    } else
-      is_expr = false;
-    current = this->get();
+    if (this->kind() != Token::RIGHTPARENTHESIS) {
+      return this->fail("Missing closing ')'");
+    }
+    this->next();
+    PTNode *parens = this->node(this->ptcs.left_paren);
+    parens->add_child(*inner);
+    PTNode *group = this->node(this->ptcs.expr);
+    group->add_child(parens);
+    group->add_child(this->node(this->ptcs.right_paren));
+    return group;
   }
-  while (op_stack->head != nullptr) {
-    add_sym_to_output_queue(output_q, *pop_from_stack(op_stack));
+  default:
+    return this->fail("expected an expression");
   }
-  auto expr_nodes = convert_RPN_to_tree(output_q);
-  expr->add_child(expr_nodes);
+}
 
-  if (parens == nullptr) {
-  } else {
-    if (this->get().type == Token::RIGHTPARENTHESIS) {
-      parens->add_sibling(this->ptcs.right_paren);
-      expr->add_child(parens);
-      this->next();
-    } else
-      throw std::runtime_error("Missing closing ')'");
+// stops at the first token that can't continue the expression, which the
+// caller checks. an expression that is all one parenthesized group is
+// that group's EXPR node
+ParseResult Parser::parse_expr() {
+  if (this->exprs != nullptr && this->tree != &this->scratch) {
+    return this->parse_shared_expr();
   }
+  ParseResult value = this->parse_binary(0);
+  if (!value || (*value)->get_val()->type == ParserToken::EXPR) {
+    return value;
+  }
+  PTNode *expr = this->node(this->ptcs.expr);
+  expr->add_child(*value);
   return expr;
 }
 
-PTNode *Parser::parse_if_stmt() {
-  PTNode *if_stmt = new PTNode(this->ptcs.if_stmt);
+void Parser::set_expr_pool(ExprPool *pool) noexcept { this->exprs = pool; }
+
+// the expression's nodes only live until it is interned, the scratch tree
+// is emptied for the next one and keeps its memory
+ParseResult Parser::parse_shared_expr() {
+  ParseTree *tree = this->tree;
+  this->tree = &this->scratch;
+  ParseResult expr = this->parse_expr();
+  this->tree = tree;
+  ExprId id = expr ? this->exprs->intern(*expr) : 0;
+  this->scratch.clear();
+  if (!expr) {
+    return expr;
+  }
+  return this->node({ParserToken::EXPR, static_cast<int>(id)});
+}
+
+ParseResult Parser::parse_if_stmt() {
+  PTNode *if_stmt = this->node(this->ptcs.if_stmt);
   this->next();
-  PTNode *cond = this->parse_expr();
-  assert(cond != nullptr);
-  PTNode *block = this->parse_stmts();
-  if (block == nullptr) {
-    throw std::runtime_error("parse_if_stmt() expects block");
-  }
-  if_stmt->add_child(cond);
-  if_stmt->add_child(block);
+  ParseResult cond = this->parse_expr();
+  if (!cond) {
+    return cond;
+  }
+  ParseResult block = this->parse_stmts();
+  if (!block) {
+    return block;
+  }
+  if_stmt->add_child(*cond);
+  if_stmt->add_child(*block);
   return if_stmt;
 }
 
 // <while> ( <expr> ) <stmts>
-PTNode *Parser::parse_while_stmt() {
-  PTNode *while_stmt = new PTNode(this->ptcs.while_stmt);
-  assert(this->get().type == Token::WHILE);
-  while_stmt->add_child(new PTNode(this->ptcs.while_stmt));
+ParseResult Parser::parse_while_stmt() {
+  PTNode *while_stmt = this->node(this->ptcs.while_stmt);
+  assert(this->kind() == Token::WHILE);
+  while_stmt->add_child(this->node(this->ptcs.while_stmt));
   this->next();
-  PTNode *expr = this->parse_expr();
-  if (expr == nullptr) {
-    throw std::runtime_error("while() requires an expression");
+  ParseResult expr = this->parse_expr();
+  if (!expr) {
+    return expr;
   }
-  while_stmt->add_child(expr);
-  this->next();
-  PTNode *stmts = this->parse_stmts();
-  while_stmt->add_child(stmts);
+  while_stmt->add_child(*expr);
+  ParseResult stmts = this->parse_stmts();
+  if (!stmts) {
+    return stmts;
+  }
+  while_stmt->add_child(*stmts);
   return while_stmt;
 }
 
 // <type> <identifier> [= <expr>] ;
-PTNode *Parser::parse_var_decl() {
-  PTNode *var_decl = new PTNode(this->ptcs.var_decl);
-  assert((this->get().type == Token::INTK || this->get().type == Token::CHARK ||
-          this->get().type == Token::DOUBLEK ||
-          this->get().type == Token::STRINGK));
-  ParserTokenChunk type_k = {token_to_parser_token(this->get().type),
-                             this->get().value};
-  var_decl->add_child(new PTNode(type_k));
+ParseResult Parser::parse_var_decl() {
+  PTNode *var_decl = this->node(this->ptcs.var_decl);
+  assert((this->kind() == Token::INTK || this->kind() == Token::CHARK ||
+          this->kind() == Token::DOUBLEK ||
+          this->kind() == Token::STRINGK));
+  ParserTokenChunk type_k = tc_to_ptc(this->get());
+  var_decl->add_child(this->node(type_k));
   this->next();
-  ParserTokenChunk ident_ptc = {token_to_parser_token(this->get().type),
-                                this->get().value};
-  var_decl->add_child(new PTNode(ident_ptc));
+  ParserTokenChunk ident_ptc = tc_to_ptc(this->get());
+  var_decl->add_child(this->node(ident_ptc));
   this->next();
-  if (this->get().type == Token::ASSIGN) {
-    var_decl->add_child(new PTNode(this->ptcs.assign));
+  if (this->kind() == Token::ASSIGN) {
+    var_decl->add_child(this->node(this->ptcs.assign));
     this->next();
-    var_decl->add_child(this->parse_expr());
+    ParseResult expr = this->parse_expr();
+    if (!expr) {
+      return expr;
+    }
+    var_decl->add_child(*expr);
   }
-  if (this->get().type != Token::SEMICOLON) {
-    throw std::runtime_error("Variable declaration expects a semicolon");
+  if (this->kind() != Token::SEMICOLON) {
+    return this->fail("Variable declaration expects a semicolon");
   }
-  var_decl->add_child(new PTNode(this->ptcs.semicolon));
+  var_decl->add_child(this->node(this->ptcs.semicolon));
   this->next();
   return var_decl;
 }
 
-void Parser::parse(std::unique_ptr<PTNode> &head) {
-  assert(this->get().type == Token::START);
-  ParserTokenChunk start = {ParserToken::START, ""};
-  this->head = new PTNode(start);
+void Parser::parse(ParseTree &tree) {
+  MemoryPhaseScope phase(MemoryPhase::PARSER);
+  ParseResult body = this->parse_program(tree);
+  if (!body) {
+    throw std::runtime_error(to_string(body.error()));
+  }
+}
+
+std::size_t Parser::parse(ParseTree &tree, DiagnosticBuffer &diagnostics) {
+  MemoryPhaseScope phase(MemoryPhase::PARSER);
+  std::size_t before = diagnostics.error_count();
+  this->diagnostics = &diagnostics;
+  this->parse_program(tree);
+  this->diagnostics = nullptr;
+  return diagnostics.error_count() - before;
+}
+
+// an error only reaches here when there is no diagnostics buffer to
+// recover with
+ParseResult Parser::parse_program(ParseTree &tree) {
+  assert(this->kind() == Token::START);
+  this->tree = &tree;
+  this->head = this->node({ParserToken::START, ""});
+  tree.set_root(this->head);
   this->next();
-  this->parse_body(this->head);
-  ParserTokenChunk end = {ParserToken::END, ""};
-  this->head->add_sibling(end);
-  head.reset(this->head);
+  ParseResult body = this->parse_body(this->head);
+  if (body) {
+    this->head->add_sibling(this->node({ParserToken::END, ""}));
+  }
+  return body;
 }
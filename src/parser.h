@@ -1,9 +1,20 @@
+#include "arena.h"
+#include "diagnostics.h"
 #include "globals.h"
+#include "source.h"
+#include "token_buffer.h"
+#include "token_stream.h"
+#include <cstddef>
 #include <memory>
+#include <vector>
 
 #ifndef PARSER_H
 #define PARSER_H
 
+class ExprPool;
+class FdWriter;
+class Lexer;
+
 bool is_type(const Token tok);
 
 // struct to hold the const structs used during parsing
@@ -12,6 +23,8 @@ struct StmtPTCs {
   ParserTokenChunk semicolon = {ParserToken::SEMICOLON, ""};
   ParserTokenChunk if_stmt = {ParserToken::IFSTMT, ""};
   ParserTokenChunk expr = {ParserToken::EXPR, ""};
+  ParserTokenChunk binop = {ParserToken::BINOP, ""};
+  ParserTokenChunk unop = {ParserToken::UNOP, ""};
   ParserTokenChunk while_stmt = {ParserToken::WHILESTMT, ""};
   ParserTokenChunk fn_decl = {ParserToken::FNDECL, ""};
   ParserTokenChunk fn = {ParserToken::FN, ""};
@@ -35,29 +48,49 @@ struct StmtPTCs {
   ParserTokenChunk variable = {ParserToken::VARIABLE, ""};
 };
 
+// nodes of a parse live in its ParseTree, the payload is stored inline so a
+// node is a single allocation. nothing is freed node by node
 class PTNode {
 public:
   PTNode(ParserTokenChunk);
-  ~PTNode();
-  PTNode* add_child(ParserTokenChunk &);
   PTNode* add_child(PTNode *);
-  PTNode* add_sibling(ParserTokenChunk &);
   const std::string get_type();
   void add_sibling(PTNode *);
   void print(const int);
   std::string output();
+  // the text print(0) writes, streamed into out
+  void write(FdWriter &out);
   PTNode *get_first_child();
   PTNode *get_next_sibling();
-  std::unique_ptr<ParserTokenChunk> &get_val();
+  ParserTokenChunk *get_val();
 
 private:
-  std::unique_ptr<ParserTokenChunk> val = nullptr;
+  ParserTokenChunk val;
   PTNode *first_child = nullptr;
   PTNode *last_child = nullptr;
   PTNode *next_sibling = nullptr;
   PTNode *prev_sibling = nullptr;
 };
 
+// pre-order walk over a node, its subtree and the siblings after it, in
+// the order output() lists them. the stack keeps one entry per level of
+// nesting, so long sibling chains cost no stack or memory
+class PTNodeWalk {
+public:
+  explicit PTNodeWalk(PTNode *start);
+  // the next node, nullptr once all of them have been visited
+  PTNode *next();
+  // nesting of the node last returned by next(), start is at 0
+  std::size_t depth() const noexcept;
+
+private:
+  // where to resume once the subtree being walked at each level is done
+  std::vector<PTNode *> resume;
+  PTNode *pending;
+  std::size_t pending_depth{0};
+  std::size_t current_depth{0};
+};
+
 class ExprNode : public PTNode {};
 class IntegerNode : public PTNode {};
 class DoubleNode : public PTNode {};
@@ -65,36 +98,134 @@ class IfStmt : public PTNode {};
 class WhileStmt : public PTNode {};
 class StmtNode : public PTNode {};
 
+// the result of a parse. its nodes are bump-allocated from an arena and
+// freed all at once with the tree, however long or deep it is
+class ParseTree {
+public:
+  ParseTree() = default;
+  ParseTree(const ParseTree &) = delete;
+  ParseTree &operator=(const ParseTree &) = delete;
+  ParseTree(ParseTree &&) noexcept = default;
+  ParseTree &operator=(ParseTree &&) noexcept = default;
+
+  PTNode *make_node(const ParserTokenChunk &tok);
+  // empties the tree for another parse, its memory is kept for that one
+  void clear() noexcept;
+  // START, nullptr before a parse
+  PTNode *root() const noexcept;
+  void set_root(PTNode *root) noexcept;
+  std::size_t node_count() const noexcept;
+  const ParseArena &arena() const noexcept;
+
+private:
+  ParseArena nodes;
+  PTNode *head = nullptr;
+  std::size_t count{0};
+};
+
+// a node, or the diagnostic for the syntax error that stopped it
+using ParseResult = Expected<PTNode *>;
+
+// tokens come from a fully lexed array, a TokenStream or straight from a
+// Lexer. in streaming mode only the next lookahead_depth tokens are held in
+// a ring, a token returned by get() or peek() stays valid for
+// lookahead_depth calls to next()
 class Parser {
 public:
-  Parser(std::unique_ptr<TokenChunk[]> &);
+  static constexpr std::size_t lookahead_depth = 4;
+  // errors only carry a line:column when the source is given
+  Parser(TokenArray &, std::string_view source = {});
+  Parser(Lexer &);
+  // the stream has to outlive the Parser
+  Parser(const TokenStream &);
   Parser();
   // ~Parser();
-  TokenChunk peek() const noexcept;
-  TokenChunk peek(int k) const;
-  TokenChunk get() const noexcept;
+  const TokenChunk &peek() const noexcept;
+  const TokenChunk &peek(int k) const;
+  const TokenChunk &get() const noexcept;
+  Token kind() const noexcept;
+  Token peek_kind(int k = 1) const;
   void next();
-  void parse(std::unique_ptr<PTNode> &head);
-  PTNode *parse_stmt();
-  PTNode *parse_stmts();
-  void shunting_yard();
+  // tree gets the nodes, a tree is filled by one parse. throws
+  // std::runtime_error with the first syntax error
+  void parse(ParseTree &tree);
+  // keeps going past syntax errors instead: each is added to diagnostics,
+  // the statement it is in is left out of the tree and parsing resumes after
+  // the next ; or }. returns the number of errors
+  std::size_t parse(ParseTree &tree, DiagnosticBuffer &diagnostics);
+  // with lazy bodies parse() only brace-matches the body of every fn and
+  // leaves a LAZYBODY node in its place, a syntax error inside one isn't
+  // seen until it is parsed. ignored in streaming mode, where the tokens
+  // are gone by the time a body would be wanted
+  void set_lazy_fn_bodies(bool lazy) noexcept;
+  // the STMTS body of a FNDECL node from the last parse(), parsed into that
+  // tree the first time it is asked for. the tokens have to still be there
+  ParseResult parse_fn_body(PTNode *fn_decl);
+  // the same for the body whose LAZYBODY node has that value
+  ParseResult parse_lazy_body(int body);
+  // with a pool every expression is interned into it and stands in the
+  // tree as an EXPR leaf whose value is its id, see expr_pool.h. the pool
+  // has to outlive the tree, nullptr parses expressions into the tree
+  void set_expr_pool(ExprPool *pool) noexcept;
+  ParseResult parse_stmt();
+  ParseResult parse_stmts();
   std::string output_tree_as_str();
 
 private:
-  std::unique_ptr<TokenChunk[]> token_stream;
-  PTNode *parse_expr(bool is_outer_expr = true);
-  void parse_body(PTNode *);
-  PTNode *parse_if_stmt();
-  PTNode *parse_while_stmt();
-  PTNode *parse_var_decl();
-  PTNode *parse_factor();
-  PTNode *parse_formal();
-  PTNode *parse_fn_decl();
-  PTNode *parse_fn_call();
-  PTNode *parse_assignment();
-  PTNode *parse_variable();
-  int _ptr = 0;
+  TokenArray token_stream;
+  // set in streaming mode, token_stream is unused then
+  Lexer *lexer = nullptr;
+  static constexpr std::size_t ring_size = 2 * lookahead_depth;
+  TokenChunk ring[ring_size];
+  // set when parsing a TokenStream, with the payload index of the token at
+  // the cursor
+  const TokenStream *stream = nullptr;
+  std::size_t payload_cursor{0};
+  mutable TokenChunk decoded;
+  mutable TokenChunk decoded_peek;
+  // built the first time an error needs a location
+  LineIndex lines;
+  bool has_source = false;
+  std::size_t offset() const;
+  // set while parse() recovers from errors
+  DiagnosticBuffer *diagnostics = nullptr;
+  // the message located at the current token's line:column
+  Unexpected<Diagnostic> fail(const std::string &message) const;
+  bool recover(Diagnostic &error, bool in_block);
+  // a node in the tree being parsed
+  PTNode *node(const ParserTokenChunk &tok);
+  ParseResult parse_program(ParseTree &tree);
+  ParseResult parse_expr();
+  ParseResult parse_shared_expr();
+  ParseResult parse_binary(int min_level);
+  ParseResult parse_unary();
+  ParseResult parse_primary();
+  ParseResult parse_body(PTNode *);
+  ParseResult parse_if_stmt();
+  ParseResult parse_while_stmt();
+  ParseResult parse_var_decl();
+  ParseResult parse_factor();
+  ParseResult parse_formal();
+  ParseResult parse_fn_decl();
+  ParseResult skip_fn_body();
+  ParseResult parse_fn_call();
+  ParseResult parse_assignment();
+  ParseResult parse_variable();
+  // where each body skipped with lazy bodies starts and the LAZYBODY node
+  // left for it, whose value is the index
+  struct BodyStart {
+    std::size_t token;
+    std::size_t payload;
+    PTNode *node;
+  };
+  std::vector<BodyStart> lazy_bodies;
+  bool lazy_fn_bodies = false;
+  // set_expr_pool(), expressions are parsed into scratch and interned
+  ExprPool *exprs = nullptr;
+  ParseTree scratch;
+  std::size_t _ptr = 0;
   PTNode *head = nullptr;
+  ParseTree *tree = nullptr;
   // make a list of const nodes that can be used to initialize to when
   // parsing, instead of making new parserChunks
   StmtPTCs ptcs;
@@ -0,0 +1,335 @@
+#include "scan.h"
+#include <array>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SNIP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr std::array<bool, 256> build_word_delimiters() {
+  std::array<bool, 256> delimiters{};
+  for (char c : std::string_view(" \t\n#{}().,:!*+-/;\"'")) {
+    delimiters[static_cast<unsigned char>(c)] = true;
+  }
+  return delimiters;
+}
+
+constexpr std::array<bool, 256> word_delimiters = build_word_delimiters();
+
+inline bool is_space(char c) noexcept {
+  return c == ' ' || c == '\t' || c == '\n';
+}
+
+std::size_t scan_word_scalar(const char *input, std::size_t pos,
+                             std::size_t end) noexcept {
+  while (pos < end && !word_delimiters[static_cast<unsigned char>(input[pos])]) {
+    pos++;
+  }
+  return pos;
+}
+
+std::size_t scan_whitespace_scalar(const char *input, std::size_t pos,
+                                   std::size_t end) noexcept {
+  while (pos < end && is_space(input[pos])) {
+    pos++;
+  }
+  return pos;
+}
+
+std::size_t find_byte_scalar(const char *input, std::size_t pos,
+                             std::size_t end, char c) noexcept {
+  while (pos < end && input[pos] != c) {
+    pos++;
+  }
+  return pos;
+}
+
+std::size_t count_byte_scalar(const char *input, std::size_t pos,
+                              std::size_t end, char c) noexcept {
+  std::size_t count{0};
+  for (; pos < end; pos++) {
+    count += input[pos] == c;
+  }
+  return count;
+}
+
+#ifdef SNIP_SCAN_X86
+
+// x in [lo, hi] as an unsigned compare, SSE2 only has signed byte compares
+inline __m128i in_range_sse2(__m128i x, char lo, char hi) noexcept {
+  __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+  __m128i width = _mm_set1_epi8(static_cast<char>(hi - lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(shifted, width), shifted);
+}
+
+// the delimiters fall into four byte ranges plus the two braces
+inline __m128i word_delimiters_sse2(__m128i chunk) noexcept {
+  __m128i mask = in_range_sse2(chunk, '\t', '\n');
+  mask = _mm_or_si128(mask, in_range_sse2(chunk, ' ', '#'));
+  mask = _mm_or_si128(mask, in_range_sse2(chunk, '\'', '/'));
+  mask = _mm_or_si128(mask, in_range_sse2(chunk, ':', ';'));
+  mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('{')));
+  return _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('}')));
+}
+
+inline __m128i whitespace_sse2(__m128i chunk) noexcept {
+  __m128i mask = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+  mask = _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')));
+  return _mm_or_si128(mask, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+}
+
+inline __m128i load_sse2(const char *p) noexcept {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+}
+
+std::size_t scan_word_sse2(const char *input, std::size_t pos,
+                           std::size_t end) noexcept {
+  while (pos + 16 <= end) {
+    unsigned mask =
+        _mm_movemask_epi8(word_delimiters_sse2(load_sse2(input + pos)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return scan_word_scalar(input, pos, end);
+}
+
+std::size_t scan_whitespace_sse2(const char *input, std::size_t pos,
+                                 std::size_t end) noexcept {
+  while (pos + 16 <= end) {
+    unsigned mask =
+        ~_mm_movemask_epi8(whitespace_sse2(load_sse2(input + pos))) & 0xFFFF;
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return scan_whitespace_scalar(input, pos, end);
+}
+
+std::size_t find_byte_sse2(const char *input, std::size_t pos,
+                           std::size_t end, char c) noexcept {
+  const __m128i needle = _mm_set1_epi8(c);
+  while (pos + 16 <= end) {
+    unsigned mask =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(load_sse2(input + pos), needle));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return find_byte_scalar(input, pos, end, c);
+}
+
+std::size_t count_byte_sse2(const char *input, std::size_t pos,
+                            std::size_t end, char c) noexcept {
+  const __m128i needle = _mm_set1_epi8(c);
+  std::size_t count{0};
+  while (pos + 16 <= end) {
+    unsigned mask =
+        _mm_movemask_epi8(_mm_cmpeq_epi8(load_sse2(input + pos), needle));
+    count += __builtin_popcount(mask);
+    pos += 16;
+  }
+  return count + count_byte_scalar(input, pos, end, c);
+}
+
+// AVX2 classifies delimiters with two nibble lookups: the high nibble picks
+// a bit for its row of the ASCII table, the low nibble table holds the bits
+// of every row that has a delimiter in that column
+__attribute__((target("avx2"))) inline __m256i
+word_delimiters_avx2(__m256i chunk) noexcept {
+  const __m256i low_table = _mm256_setr_epi8(
+      0x02, 0x02, 0x02, 0x02, 0x00, 0x00, 0x00, 0x02, 0x02, 0x03, 0x07, 0x0E,
+      0x02, 0x0A, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x00, 0x00, 0x00, 0x02,
+      0x02, 0x03, 0x07, 0x0E, 0x02, 0x0A, 0x02, 0x02);
+  const __m256i high_table = _mm256_setr_epi8(
+      0x01, 0x00, 0x02, 0x04, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x04, 0x00, 0x00, 0x00, 0x08,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  __m256i low = _mm256_and_si256(chunk, nibble);
+  __m256i high = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble);
+  __m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(low_table, low),
+                                  _mm256_shuffle_epi8(high_table, high));
+  return _mm256_cmpeq_epi8(bits, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2"))) inline __m256i
+load_avx2(const char *p) noexcept {
+  return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+}
+
+__attribute__((target("avx2"))) std::size_t
+scan_word_avx2(const char *input, std::size_t pos, std::size_t end) noexcept {
+  while (pos + 32 <= end) {
+    // word_delimiters_avx2 flags the bytes that are not delimiters
+    unsigned mask = ~static_cast<unsigned>(
+        _mm256_movemask_epi8(word_delimiters_avx2(load_avx2(input + pos))));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 32;
+  }
+  return scan_word_sse2(input, pos, end);
+}
+
+__attribute__((target("avx2"))) std::size_t
+scan_whitespace_avx2(const char *input, std::size_t pos,
+                     std::size_t end) noexcept {
+  while (pos + 32 <= end) {
+    __m256i chunk = load_avx2(input + pos);
+    __m256i mask = _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(' '));
+    mask = _mm256_or_si256(mask,
+                           _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\t')));
+    mask = _mm256_or_si256(mask,
+                           _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8('\n')));
+    unsigned other = ~static_cast<unsigned>(_mm256_movemask_epi8(mask));
+    if (other != 0) {
+      return pos + __builtin_ctz(other);
+    }
+    pos += 32;
+  }
+  return scan_whitespace_sse2(input, pos, end);
+}
+
+__attribute__((target("avx2"))) std::size_t
+find_byte_avx2(const char *input, std::size_t pos, std::size_t end,
+               char c) noexcept {
+  const __m256i needle = _mm256_set1_epi8(c);
+  while (pos + 32 <= end) {
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(load_avx2(input + pos), needle)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 32;
+  }
+  return find_byte_sse2(input, pos, end, c);
+}
+
+__attribute__((target("avx2"))) std::size_t
+count_byte_avx2(const char *input, std::size_t pos, std::size_t end,
+                char c) noexcept {
+  const __m256i needle = _mm256_set1_epi8(c);
+  std::size_t count{0};
+  while (pos + 32 <= end) {
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(load_avx2(input + pos), needle)));
+    count += __builtin_popcount(mask);
+    pos += 32;
+  }
+  return count + count_byte_sse2(input, pos, end, c);
+}
+
+#endif // SNIP_SCAN_X86
+
+struct ScanOps {
+  std::size_t (*word)(const char *, std::size_t, std::size_t) noexcept;
+  std::size_t (*whitespace)(const char *, std::size_t, std::size_t) noexcept;
+  std::size_t (*find)(const char *, std::size_t, std::size_t, char) noexcept;
+  std::size_t (*count)(const char *, std::size_t, std::size_t, char) noexcept;
+};
+
+constexpr ScanOps scalar_ops{scan_word_scalar, scan_whitespace_scalar,
+                             find_byte_scalar, count_byte_scalar};
+#ifdef SNIP_SCAN_X86
+constexpr ScanOps sse2_ops{scan_word_sse2, scan_whitespace_sse2,
+                           find_byte_sse2, count_byte_sse2};
+constexpr ScanOps avx2_ops{scan_word_avx2, scan_whitespace_avx2,
+                           find_byte_avx2, count_byte_avx2};
+#endif
+
+bool backend_supported(ScanBackend backend) noexcept {
+  switch (backend) {
+  case ScanBackend::SCALAR:
+    return true;
+#ifdef SNIP_SCAN_X86
+  case ScanBackend::SSE2:
+    return true; // part of the x86-64 baseline
+  case ScanBackend::AVX2:
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+const ScanOps *ops_for(ScanBackend backend) noexcept {
+  switch (backend) {
+#ifdef SNIP_SCAN_X86
+  case ScanBackend::SSE2:
+    return &sse2_ops;
+  case ScanBackend::AVX2:
+    return &avx2_ops;
+#endif
+  default:
+    return &scalar_ops;
+  }
+}
+
+ScanBackend active_backend = detect_scan_backend();
+const ScanOps *active_ops = ops_for(active_backend);
+
+} // namespace
+
+bool is_word_delimiter(char c) noexcept {
+  return word_delimiters[static_cast<unsigned char>(c)];
+}
+
+std::size_t scan_word(const char *input, std::size_t pos,
+                      std::size_t end) noexcept {
+  return active_ops->word(input, pos, end);
+}
+
+std::size_t scan_whitespace(const char *input, std::size_t pos,
+                            std::size_t end) noexcept {
+  return active_ops->whitespace(input, pos, end);
+}
+
+std::size_t find_byte(const char *input, std::size_t pos, std::size_t end,
+                      char c) noexcept {
+  return active_ops->find(input, pos, end, c);
+}
+
+std::size_t count_byte(const char *input, std::size_t pos, std::size_t end,
+                       char c) noexcept {
+  return active_ops->count(input, pos, end, c);
+}
+
+ScanBackend detect_scan_backend() noexcept {
+  if (backend_supported(ScanBackend::AVX2)) {
+    return ScanBackend::AVX2;
+  }
+  if (backend_supported(ScanBackend::SSE2)) {
+    return ScanBackend::SSE2;
+  }
+  return ScanBackend::SCALAR;
+}
+
+ScanBackend get_scan_backend() noexcept { return active_backend; }
+
+bool set_scan_backend(ScanBackend backend) noexcept {
+  if (!backend_supported(backend)) {
+    return false;
+  }
+  active_backend = backend;
+  active_ops = ops_for(backend);
+  return true;
+}
+
+const char *scan_backend_name(ScanBackend backend) noexcept {
+  switch (backend) {
+  case ScanBackend::SSE2:
+    return "sse2";
+  case ScanBackend::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
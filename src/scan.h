@@ -0,0 +1,32 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <cstddef>
+
+// character-class scanners the lexer uses to skip over long runs. every
+// function returns the index of the first byte in [pos, end) that does not
+// belong to the run, or end when the whole range does
+enum class ScanBackend { SCALAR, SSE2, AVX2 };
+
+// bytes that end a word: whitespace, punctuation, comment and quote starts
+bool is_word_delimiter(char c) noexcept;
+
+std::size_t scan_word(const char *input, std::size_t pos,
+                      std::size_t end) noexcept;
+std::size_t scan_whitespace(const char *input, std::size_t pos,
+                            std::size_t end) noexcept;
+// index of the first occurrence of c in [pos, end), or end
+std::size_t find_byte(const char *input, std::size_t pos, std::size_t end,
+                      char c) noexcept;
+// number of occurrences of c in [pos, end)
+std::size_t count_byte(const char *input, std::size_t pos, std::size_t end,
+                       char c) noexcept;
+
+// the best backend the running CPU supports, picked once at startup
+ScanBackend detect_scan_backend() noexcept;
+ScanBackend get_scan_backend() noexcept;
+// returns false when the CPU can't run the requested backend
+bool set_scan_backend(ScanBackend backend) noexcept;
+const char *scan_backend_name(ScanBackend backend) noexcept;
+
+#endif // !SCAN_H
@@ -2,9 +2,11 @@
 #include "ast.h"
 #include "globals.h"
 #include "helper.h"
+#include "memory_stats.h"
 #include "parser.h"
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <stdexcept>
 #include <unordered_map>
 #include <utility>
@@ -15,35 +17,54 @@ extern Token parser_token_to_token(const ParserToken &pt);
 extern void get_variant_value_and_assign_to(ParserTokenChunk &,
                                             SymbolTableEntryValue &);
 extern void get_variant_value_and_assign_to(SymbolTableEntryValue &,
-                                            SymbolTableEntryValue &);
+                                            TokenVariant &);
+
+SemanticAnalyzer::SemanticAnalyzer(const ParseTree &tree)
+    : SemanticAnalyzer(FlatTree(tree)) {}
+
+SemanticAnalyzer::SemanticAnalyzer(const ParseTree &tree, FnBodies bodies,
+                                   const ExprPool *exprs)
+    : SemanticAnalyzer(FlatTree(tree)) {
+  this->bodies = std::move(bodies);
+  this->exprs = exprs;
+}
 
-SemanticAnalyzer::SemanticAnalyzer(std::unique_ptr<PTNode> &root) {
-  if (root == nullptr) {
+// node 0 is the root, the statements are checked as they are lowered
+SemanticAnalyzer::SemanticAnalyzer(FlatTree tree) : tree(std::move(tree)) {
+  if (this->tree.empty()) {
     throw std::runtime_error("no tokens to analyze");
   }
-
-  PTNode *root_node = root.get();
-  if (root_node->get_type() != "START") {
+  if (this->tree.kind(0) != ParserToken::START) {
     throw std::runtime_error("root node of parsed tokens is not of type START");
   }
-  PTNode *child = root_node->get_first_child();
-  while (child and child->get_type() == "STMT") {
-    auto child_node = child->get_first_child();
-    if (child_node->get_type() == "IFSTMT") {
-    } else if (child_node->get_type() == "WHILESTMT") {
-    } else if (child_node->get_type() == "VARDECL") {
-    } else if (child_node->get_type() == "FNDECL") {
-    } else {
-      throw std::runtime_error("unexpected token type");
-    }
-    child = child->get_next_sibling();
-  }
 }
 
 /**
  * Walk through the parsed_tokens, then build the AST
  */
-void SemanticAnalyzer::analyze() {}
+void SemanticAnalyzer::analyze() {
+  MemoryPhaseScope phase(MemoryPhase::SEMANTIC);
+  this->ast = lower(this->tree, this->bodies, this->exprs);
+  this->tree = FlatTree();
+}
+
+FnBodies parsed_fn_bodies(Parser &parser, DiagnosticBuffer *diagnostics) {
+  return [&parser, diagnostics](int body) {
+    ParseResult parsed = parser.parse_lazy_body(body);
+    if (parsed) {
+      return FlatTree(*parsed);
+    }
+    if (diagnostics == nullptr) {
+      throw std::runtime_error(to_string(parsed.error()));
+    }
+    diagnostics->add(parsed.error());
+    FlatTree empty;
+    empty.add_node({ParserToken::STMTS, ""});
+    return empty;
+  };
+}
+
+const ASTRoot &SemanticAnalyzer::get_ast() const noexcept { return this->ast; }
 
 ExprNode *parse_expr(PTNode *expr_node) {
   ExprNode *ast_expr_node = nullptr;
@@ -53,6 +74,8 @@ ExprNode *parse_expr(PTNode *expr_node) {
 
 SymbolTable::SymbolTable() { this->scope = 0; }
 
+SymbolTableS::SymbolTableS() {}
+
 int SymbolTableS::get_scope() const { return this->scope; }
 
 SymbolTableS::~SymbolTableS() {
@@ -66,6 +89,7 @@ SymbolTable *SymbolTableS::get_current_scope() {
 }
 
 void SymbolTableS::enter_scope() {
+  MemoryPhaseScope phase(MemoryPhase::SEMANTIC);
   this->scope++;
   SymbolTable *table = new SymbolTable();
   this->tables.push_back(table);
@@ -103,7 +127,10 @@ int SymbolTableS::insert(PTNode *node, PTNode *type) {
  * @param node ParserTokenChunk*
  */
 int SymbolTable::insert_tok(ParserTokenChunk *tok, PTNode *ident_type) {
-  std::string ident_name = std::get<std::string>(tok->value);
+  MemoryPhaseScope phase(MemoryPhase::SEMANTIC);
+  if (tok->sym == no_symbol) {
+    throw std::runtime_error("semantic: identifier was not interned");
+  }
   SymbolTableEntry entry = {ParserToken(), '\0'};
   switch (ident_type->get_val()->type) {
   case ParserToken::CHAR:
@@ -117,35 +144,36 @@ int SymbolTable::insert_tok(ParserTokenChunk *tok, PTNode *ident_type) {
     entry = {ident_type->get_val()->type, 0};
     break;
   }
-  this->table.insert(std::make_pair(ident_name, entry));
+  this->table.insert(std::make_pair(tok->sym, entry));
   return 0;
 }
 
 /** get a identifier from the sym_table
  *
- * @param ident_name std::string
- * @return ParserTokenChunk*
+ * @param sym std::uint32_t interned id of the identifier
+ * @return std::optional<ParserTokenChunk> by value, a lookup doesn't
+ * allocate. a string value views the table entry
  */
-ParserTokenChunk *SymbolTable::get_tok(const std::string &ident_name) {
-  auto entry_it = table.find(ident_name);
+std::optional<ParserTokenChunk> SymbolTable::get_tok(std::uint32_t sym) {
+  auto entry_it = table.find(sym);
   if (entry_it == this->table.end()) {
-    return nullptr;
+    return std::nullopt;
   }
-  ParserTokenChunk *chunk = new ParserTokenChunk;
-  chunk->type = entry_it->second.type;
-  get_variant_value_and_assign_to(entry_it->second.ident_value, chunk->value);
+  ParserTokenChunk chunk;
+  chunk.type = entry_it->second.type;
+  chunk.sym = sym;
+  get_variant_value_and_assign_to(entry_it->second.ident_value, chunk.value);
   return chunk;
 }
 
-ParserTokenChunk *SymbolTableS::get_tok(std::string ident_name) {
-  ParserTokenChunk *ident = nullptr;
-  for (SymbolTable *table : this->tables) {
-    ParserTokenChunk *ident = table->get_tok(ident_name);
-    if (ident != nullptr) {
-      break;
+// the innermost scope that declares the name wins
+std::optional<ParserTokenChunk> SymbolTableS::get_tok(std::uint32_t sym) {
+  for (auto it = this->tables.rbegin(); it != this->tables.rend(); ++it) {
+    if (std::optional<ParserTokenChunk> ident = (*it)->get_tok(sym)) {
+      return ident;
     }
   }
-  return ident;
+  return std::nullopt;
 }
 
 /** insert a identifier into the sym_table
@@ -153,7 +181,7 @@ ParserTokenChunk *SymbolTableS::get_tok(std::string ident_name) {
  * @param node PTNode*
  */
 int SymbolTable::insert_tok(PTNode *node, PTNode *ident_type) {
-  ParserTokenChunk *ident = (node->get_val().get());
+  ParserTokenChunk *ident = (node->get_val());
   this->insert_tok(ident, ident_type);
   return 0;
 }
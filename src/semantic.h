@@ -1,19 +1,42 @@
 #ifndef SEMANTIC_ANALYZER_H
 #define SEMANTIC_ANALYZER_H
 
+#include "ast.h"
+#include "flat_tree.h"
 #include "globals.h"
 #include "parser.h"
+#include <cstdint>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <variant>
 #include <vector>
 
 class SemanticAnalyzer {
 public:
-  SemanticAnalyzer(std::unique_ptr<PTNode> &root);
+  SemanticAnalyzer(const ParseTree &tree);
+  // a tree parsed with lazy bodies or an expression pool, see lower()
+  SemanticAnalyzer(const ParseTree &tree, FnBodies bodies,
+                   const ExprPool *exprs = nullptr);
+  SemanticAnalyzer(FlatTree tree);
+  // lowers the tree to the typed AST, see ast.h. the analyzer lets go of
+  // the tree afterwards
   void analyze();
+  const ASTRoot &get_ast() const noexcept;
+
+private:
+  FlatTree tree;
+  FnBodies bodies;
+  const ExprPool *exprs = nullptr;
+  ASTRoot ast;
 };
 
+// bodies parsed by parser the first time lowering asks for them. a body
+// with a syntax error is added to diagnostics and lowered as empty, or
+// throws std::runtime_error without diagnostics, as Parser::parse does
+FnBodies parsed_fn_bodies(Parser &parser,
+                          DiagnosticBuffer *diagnostics = nullptr);
+
 struct SymbolTableEntry {
   ParserToken type;
 	std::variant<int, std::string, double, bool, char> ident_value;
@@ -23,11 +46,12 @@ class SymbolTable {
 public:
   SymbolTable();
   int insert_tok(ParserTokenChunk *, PTNode *);
-  ParserTokenChunk *get_tok(const std::string&) ;
+  std::optional<ParserTokenChunk> get_tok(std::uint32_t sym);
   int insert_tok(PTNode *, PTNode *);
 
 private:
-  std::unordered_map<std::string, SymbolTableEntry> table;
+  // keyed on the interned id of the name, see interner.h
+  std::unordered_map<std::uint32_t, SymbolTableEntry> table;
   // how to  i in sert an element into this the table?
   int scope{0};
 };
@@ -40,7 +64,7 @@ public:
   void enter_scope();
   void exit_scope();
   int get_scope() const;
-  ParserTokenChunk *get_tok(std::string) ;
+  std::optional<ParserTokenChunk> get_tok(std::uint32_t sym);
   SymbolTable *get_top_table();
   SymbolTable *get_current_scope();
 
@@ -0,0 +1,463 @@
+#include "source.h"
+#include "memory_stats.h"
+#include "scan.h"
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iostream>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <zlib.h>
+#ifdef SNIP_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// stdin and pipes have no size up front, read them in large blocks
+std::string read_all(int fd) {
+  std::string text;
+  std::size_t used = 0;
+  std::size_t block = std::size_t{1} << 16;
+  for (;;) {
+    if (used == text.size()) {
+      text.resize(text.size() + block);
+      block *= 2;
+    }
+    ssize_t got = ::read(fd, &text[used], text.size() - used);
+    if (got < 0 && errno == EINTR) {
+      continue;
+    }
+    if (got <= 0) {
+      break;
+    }
+    used += static_cast<std::size_t>(got);
+  }
+  text.resize(used);
+  return text;
+}
+
+enum class Compression { NONE, GZIP, ZSTD };
+
+Compression detect_compression(std::string_view raw) {
+  if (raw.size() >= 2 && raw[0] == '\x1F' && raw[1] == '\x8B') {
+    return Compression::GZIP;
+  }
+  if (raw.size() >= 4 && raw.substr(0, 4) == "\x28\xB5\x2F\xFD") {
+    return Compression::ZSTD;
+  }
+  return Compression::NONE;
+}
+
+// compressed input is fed to the decompressor this much at a time, pages
+// of a mapped file are dropped once they have been consumed
+inline constexpr std::size_t compressed_block = std::size_t{1} << 20;
+
+// deflate can't shrink anything more than about 1032 times
+inline constexpr std::size_t max_inflate_ratio = 1032;
+
+// the most address space the text of one compressed source reserves
+inline constexpr std::size_t max_text_reserve = std::size_t{1} << 44;
+
+std::size_t page_size() {
+  return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+}
+
+std::size_t round_to_page(std::size_t size) {
+  std::size_t page = page_size();
+  return (size + page - 1) / page * page;
+}
+
+void release_consumed(const SourceBuffer &raw, std::size_t consumed) {
+  if (!raw.is_mapped()) {
+    return;
+  }
+  std::size_t page = page_size();
+  std::size_t done = consumed / page * page;
+  if (done > 0) {
+    ::madvise(const_cast<char *>(raw.data()), done, MADV_DONTNEED);
+  }
+}
+
+} // namespace
+
+// the compressed bytes of a source opened with open_stream(), the
+// decompressor and how far it got. members and frames are read one after
+// the other, gzip and zstd concatenate them like cat
+struct SourceBuffer::Decoder {
+  Decoder(SourceBuffer compressed, const std::string &filename,
+          Compression format);
+  ~Decoder();
+  Decoder(const Decoder &) = delete;
+  Decoder &operator=(const Decoder &) = delete;
+
+  std::size_t output_bound() const;
+  // decompress the next block of raw onto the end of text
+  void inflate_block(SourceBuffer &text);
+#ifdef SNIP_HAVE_ZSTD
+  void zstd_block(SourceBuffer &text);
+#endif
+  // throws when the data stops inside a member or frame
+  void check_complete() const;
+
+  SourceBuffer raw;
+  std::string name;
+  Compression format;
+  std::size_t consumed = 0;
+  z_stream gzip{};
+  int gzip_status = Z_OK;
+#ifdef SNIP_HAVE_ZSTD
+  ZSTD_DStream *zstd = nullptr;
+  // 0 once the last frame was decoded completely
+  std::size_t zstd_pending = 1;
+#endif
+};
+
+SourceBuffer::Decoder::Decoder(SourceBuffer compressed,
+                               const std::string &filename,
+                               Compression format)
+    : raw(std::move(compressed)), name(filename), format(format) {
+  if (format == Compression::GZIP) {
+    // 32 has zlib accept and check the gzip header and trailer
+    if (inflateInit2(&this->gzip, 15 + 32) != Z_OK) {
+      throw std::runtime_error(name + ": can't start gzip decompression");
+    }
+  }
+#ifdef SNIP_HAVE_ZSTD
+  if (format == Compression::ZSTD) {
+    this->zstd = ZSTD_createDStream();
+    if (this->zstd == nullptr) {
+      throw std::runtime_error(name + ": can't start zstd decompression");
+    }
+  }
+#endif
+}
+
+SourceBuffer::Decoder::~Decoder() {
+  if (this->format == Compression::GZIP) {
+    inflateEnd(&this->gzip);
+  }
+#ifdef SNIP_HAVE_ZSTD
+  ZSTD_freeDStream(this->zstd);
+#endif
+}
+
+// only the pages written to cost memory, so the reservation can be as
+// large as the data could possibly get
+std::size_t SourceBuffer::Decoder::output_bound() const {
+  std::size_t in = this->raw.size();
+  std::size_t bound = in > max_text_reserve / max_inflate_ratio
+                          ? max_text_reserve
+                          : in * max_inflate_ratio;
+#ifdef SNIP_HAVE_ZSTD
+  if (this->format == Compression::ZSTD) {
+    unsigned long long known =
+        ZSTD_getFrameContentSize(this->raw.data(), in);
+    if (known != ZSTD_CONTENTSIZE_UNKNOWN &&
+        known != ZSTD_CONTENTSIZE_ERROR && known > bound) {
+      bound = static_cast<std::size_t>(known);
+    }
+  }
+#endif
+  return bound;
+}
+
+void SourceBuffer::Decoder::inflate_block(SourceBuffer &text) {
+  std::string_view in = this->raw.view();
+  if (this->gzip_status == Z_STREAM_END) {
+    inflateReset(&this->gzip);
+  }
+  std::size_t block = std::min(compressed_block, in.size() - this->consumed);
+  this->gzip.next_in = reinterpret_cast<Bytef *>(
+      const_cast<char *>(in.data() + this->consumed));
+  this->gzip.avail_in = static_cast<uInt>(block);
+  do {
+    text.grow_text(this->name);
+    std::size_t room =
+        std::min(text.mapped - text.length, std::size_t{1} << 30);
+    this->gzip.next_out =
+        reinterpret_cast<Bytef *>(static_cast<char *>(text.mapping)) +
+        text.length;
+    this->gzip.avail_out = static_cast<uInt>(room);
+    this->gzip_status = inflate(&this->gzip, Z_NO_FLUSH);
+    text.length += room - this->gzip.avail_out;
+  } while (this->gzip_status == Z_OK && this->gzip.avail_out == 0);
+  if (this->gzip_status != Z_OK && this->gzip_status != Z_STREAM_END &&
+      this->gzip_status != Z_BUF_ERROR) {
+    throw std::runtime_error(this->name + ": corrupt gzip data");
+  }
+  this->consumed += block - this->gzip.avail_in;
+  release_consumed(this->raw, this->consumed);
+}
+
+#ifdef SNIP_HAVE_ZSTD
+void SourceBuffer::Decoder::zstd_block(SourceBuffer &text) {
+  std::string_view in = this->raw.view();
+  std::size_t block = std::min(compressed_block, in.size() - this->consumed);
+  ZSTD_inBuffer input{in.data() + this->consumed, block, 0};
+  do {
+    text.grow_text(this->name);
+    ZSTD_outBuffer output{static_cast<char *>(text.mapping) + text.length,
+                          text.mapped - text.length, 0};
+    this->zstd_pending = ZSTD_decompressStream(this->zstd, &output, &input);
+    if (ZSTD_isError(this->zstd_pending)) {
+      throw std::runtime_error(this->name + ": corrupt zstd data");
+    }
+    text.length += output.pos;
+  } while (input.pos < input.size ||
+           (this->zstd_pending != 0 && text.length == text.mapped));
+  this->consumed += block;
+  release_consumed(this->raw, this->consumed);
+}
+#endif
+
+void SourceBuffer::Decoder::check_complete() const {
+  if (this->format == Compression::GZIP &&
+      this->gzip_status != Z_STREAM_END) {
+    throw std::runtime_error(this->name + ": truncated gzip data");
+  }
+#ifdef SNIP_HAVE_ZSTD
+  if (this->format == Compression::ZSTD && this->zstd_pending != 0) {
+    throw std::runtime_error(this->name + ": truncated zstd data");
+  }
+#endif
+}
+
+// out of line, Decoder is only complete in here
+SourceBuffer::SourceBuffer() = default;
+
+SourceBuffer::SourceBuffer(std::string text) : owned(std::move(text)) {
+  this->bytes = this->owned.data();
+  this->length = this->owned.size();
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept {
+  *this = std::move(other);
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+  if (this != &other) {
+    this->unmap();
+    this->owned = std::move(other.owned);
+    this->decoder = std::move(other.decoder);
+    this->mapping = other.mapping;
+    this->mapped = other.mapped;
+    this->length = other.length;
+    // the owned string may have been stored inline, re-point at our copy
+    this->bytes = this->mapping ? other.bytes : this->owned.data();
+    other.mapping = nullptr;
+    other.mapped = 0;
+    other.bytes = nullptr;
+    other.length = 0;
+  }
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() { this->unmap(); }
+
+void SourceBuffer::unmap() noexcept {
+  if (this->mapping != nullptr) {
+    ::munmap(this->mapping, this->mapped);
+    this->mapping = nullptr;
+  }
+}
+
+SourceBuffer SourceBuffer::open(const std::string &filename) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  SourceBuffer source = SourceBuffer::open_stream(filename);
+  while (source.fill()) {
+  }
+  return source;
+}
+
+SourceBuffer SourceBuffer::open_stream(const std::string &filename) {
+  MemoryPhaseScope phase(MemoryPhase::HELPER);
+  SourceBuffer raw = SourceBuffer::open_uncompressed(filename);
+  Compression format = detect_compression(raw.view());
+  if (format == Compression::NONE) {
+    return raw;
+  }
+#ifndef SNIP_HAVE_ZSTD
+  if (format == Compression::ZSTD) {
+    throw std::runtime_error(
+        filename + ": zstd support not built, rebuild with make ZSTD=1");
+  }
+#endif
+  SourceBuffer text;
+  text.decoder =
+      std::make_unique<Decoder>(std::move(raw), filename, format);
+  text.reserve_text(text.decoder->output_bound());
+  return text;
+}
+
+bool SourceBuffer::fill() {
+  if (this->decoder == nullptr) {
+    return false;
+  }
+  Decoder &decoder = *this->decoder;
+#ifdef SNIP_HAVE_ZSTD
+  if (decoder.format == Compression::ZSTD) {
+    decoder.zstd_block(*this);
+  } else {
+    decoder.inflate_block(*this);
+  }
+#else
+  decoder.inflate_block(*this);
+#endif
+  if (decoder.consumed == decoder.raw.size()) {
+    decoder.check_complete();
+    this->finish_text();
+  }
+  return true;
+}
+
+bool SourceBuffer::complete() const noexcept {
+  return this->decoder == nullptr;
+}
+
+// address space for the whole text is reserved once and never moves, the
+// Lexer keeps views into it while more is decompressed. a smaller range is
+// tried when the system won't reserve that much
+void SourceBuffer::reserve_text(std::size_t bound) {
+  std::size_t size =
+      round_to_page(std::clamp(bound, compressed_block, max_text_reserve));
+  for (;;) {
+    void *reserved =
+        ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved != MAP_FAILED) {
+      this->mapping = reserved;
+      this->mapped = size;
+      this->bytes = static_cast<const char *>(reserved);
+      this->length = 0;
+      return;
+    }
+    if (size <= compressed_block) {
+      throw std::bad_alloc();
+    }
+    size = round_to_page(size / 2);
+  }
+}
+
+// only grows in place, moving the text would leave the Lexer's views
+// dangling
+void SourceBuffer::grow_text(const std::string &name) {
+  if (this->length < this->mapped) {
+    return;
+  }
+  void *grown = ::mremap(this->mapping, this->mapped, 2 * this->mapped, 0);
+  if (grown == MAP_FAILED) {
+    throw std::runtime_error(name + ": decompressed source too large");
+  }
+  this->mapped *= 2;
+}
+
+// the reservation past the text is given back and the text made read-only
+// like a mapped file
+void SourceBuffer::finish_text() {
+  std::size_t keep = round_to_page(std::max<std::size_t>(this->length, 1));
+  if (keep < this->mapped) {
+    ::munmap(static_cast<char *>(this->mapping) + keep, this->mapped - keep);
+    this->mapped = keep;
+  }
+  ::mprotect(this->mapping, this->mapped, PROT_READ);
+  this->decoder.reset();
+}
+
+SourceBuffer SourceBuffer::open_uncompressed(const std::string &filename) {
+  if (filename == "-") {
+    return SourceBuffer(read_all(STDIN_FILENO));
+  }
+  int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    std::cerr << "Unable to open source file" << std::endl;
+    return SourceBuffer();
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    // pipes, character devices and files that report no size
+    SourceBuffer source(read_all(fd));
+    ::close(fd);
+    return source;
+  }
+  std::size_t size = static_cast<std::size_t>(st.st_size);
+  void *mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED) {
+    SourceBuffer source(read_all(fd));
+    ::close(fd);
+    return source;
+  }
+  ::close(fd);
+  // the lexer walks the file front to back exactly once
+  ::madvise(mapping, size, MADV_SEQUENTIAL);
+  SourceBuffer source;
+  source.mapping = mapping;
+  source.mapped = size;
+  source.bytes = static_cast<const char *>(mapping);
+  source.length = size;
+  return source;
+}
+
+std::string_view SourceBuffer::view() const noexcept {
+  return std::string_view(this->bytes, this->length);
+}
+
+const char *SourceBuffer::data() const noexcept { return this->bytes; }
+
+std::size_t SourceBuffer::size() const noexcept { return this->length; }
+
+bool SourceBuffer::empty() const noexcept { return this->length == 0; }
+
+bool SourceBuffer::is_mapped() const noexcept {
+  return this->mapping != nullptr;
+}
+
+std::string apply_edit(std::string_view text, const SourceEdit &edit) {
+  if (edit.offset > text.size() || edit.removed > text.size() - edit.offset) {
+    throw std::out_of_range("edit outside the source");
+  }
+  std::string edited;
+  edited.reserve(text.size() - edit.removed + edit.inserted.size());
+  edited.append(text.substr(0, edit.offset));
+  edited.append(edit.inserted);
+  edited.append(text.substr(edit.offset + edit.removed));
+  return edited;
+}
+
+LineIndex::LineIndex(std::string_view text) : text(text) {}
+
+// newlines are counted first so the table is allocated once, then found
+// with the same scanner the lexer uses for comments
+void LineIndex::build() const {
+  const char *data = this->text.data();
+  std::size_t size = this->text.size();
+  this->starts.reserve(count_byte(data, 0, size, '\n') + 1);
+  this->starts.push_back(0);
+  for (std::size_t pos = find_byte(data, 0, size, '\n'); pos < size;
+       pos = find_byte(data, pos + 1, size, '\n')) {
+    this->starts.push_back(pos + 1);
+  }
+}
+
+SourceLocation LineIndex::locate(std::size_t offset) const {
+  if (this->starts.empty()) {
+    this->build();
+  }
+  offset = std::min(offset, this->text.size());
+  auto line =
+      std::upper_bound(this->starts.begin(), this->starts.end(), offset);
+  std::size_t index = static_cast<std::size_t>(line - this->starts.begin());
+  return {index, offset - this->starts[index - 1] + 1};
+}
+
+std::size_t LineIndex::line_count() const {
+  if (this->starts.empty()) {
+    this->build();
+  }
+  return this->starts.size();
+}
+
+bool LineIndex::built() const noexcept { return !this->starts.empty(); }
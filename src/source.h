@@ -0,0 +1,97 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// read-only source text. regular files are memory mapped and lexed in place,
+// stdin, pipes and strings passed on the command line are held in an owned
+// buffer instead. gzip and zstd input is decompressed into an anonymous
+// mapping reserved up front, so the text never moves while it grows. sizes
+// and offsets are 64-bit, so multi-GB inputs work
+class SourceBuffer {
+public:
+  SourceBuffer();
+  explicit SourceBuffer(std::string text);
+  SourceBuffer(SourceBuffer &&other) noexcept;
+  SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer &operator=(const SourceBuffer &) = delete;
+  ~SourceBuffer();
+
+  // "-" reads stdin. prints to std::cerr and returns an empty buffer when the
+  // file can't be opened, like readFile() does. gzip and zstd input is
+  // recognised by its magic bytes and decompressed a block at a time, throws
+  // std::runtime_error when it is corrupt or, for zstd, when the build has
+  // no zstd support
+  static SourceBuffer open(const std::string &filename);
+  // the same, but compressed input is only decompressed as far as fill()
+  // is called, the Lexer calls it as it reaches the end of the text
+  static SourceBuffer open_stream(const std::string &filename);
+  // decompresses the next block, false once the whole source is there
+  bool fill();
+  bool complete() const noexcept;
+
+  // the text decompressed so far, all of it once complete()
+  std::string_view view() const noexcept;
+  const char *data() const noexcept;
+  std::size_t size() const noexcept;
+  bool empty() const noexcept;
+  bool is_mapped() const noexcept;
+
+private:
+  struct Decoder;
+  static SourceBuffer open_uncompressed(const std::string &filename);
+  void reserve_text(std::size_t bound);
+  void grow_text(const std::string &name);
+  void finish_text();
+  void unmap() noexcept;
+  const char *bytes = nullptr;
+  std::size_t length = 0;
+  void *mapping = nullptr;
+  // bytes mapped, past length while decompressed text is still coming
+  std::size_t mapped = 0;
+  std::string owned;
+  std::unique_ptr<Decoder> decoder;
+};
+
+// inserted replaces the removed bytes starting at offset
+struct SourceEdit {
+  std::size_t offset;
+  std::size_t removed;
+  std::string_view inserted;
+};
+
+// a copy of text with the edit applied
+std::string apply_edit(std::string_view text, const SourceEdit &edit);
+
+// 1-based line and column, the column counts bytes
+struct SourceLocation {
+  std::size_t line;
+  std::size_t column;
+};
+
+// maps the byte offsets tokens carry to line:column. the table of line
+// starts is only built the first time locate() is called, so lexing and
+// parsing pay nothing for locations until something has to be reported.
+// the first locate() is not thread safe
+class LineIndex {
+public:
+  LineIndex() = default;
+  explicit LineIndex(std::string_view text);
+  // offsets past the end resolve to the end of the text
+  SourceLocation locate(std::size_t offset) const;
+  std::size_t line_count() const;
+  bool built() const noexcept;
+
+private:
+  void build() const;
+  std::string_view text;
+  // offset of the first byte of every line, starts with 0
+  mutable std::vector<std::size_t> starts;
+};
+
+#endif // !SOURCE_H
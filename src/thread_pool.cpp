@@ -0,0 +1,74 @@
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(std::size_t threads) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  for (std::size_t i = 1; i < threads; i++) {
+    this->workers.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (std::thread &worker : this->workers) {
+    worker.join();
+  }
+}
+
+std::size_t ThreadPool::size() const noexcept {
+  return this->workers.size() + 1;
+}
+
+void ThreadPool::run(std::size_t count,
+                     const std::function<void(std::size_t)> &task) {
+  std::unique_lock<std::mutex> guard(this->lock);
+  this->task = &task;
+  this->phase = current_memory_phase();
+  this->next_index = 0;
+  this->task_count = count;
+  this->finished = 0;
+  this->generation++;
+  this->wake.notify_all();
+  this->drain(guard);
+  this->done.wait(guard, [this] { return this->finished == this->task_count; });
+  this->task = nullptr;
+}
+
+void ThreadPool::drain(std::unique_lock<std::mutex> &guard) {
+  while (this->next_index < this->task_count) {
+    std::size_t index = this->next_index++;
+    const std::function<void(std::size_t)> &current = *this->task;
+    MemoryPhase phase = this->phase;
+    guard.unlock();
+    {
+      MemoryPhaseScope scope(phase);
+      current(index);
+    }
+    guard.lock();
+    if (++this->finished == this->task_count) {
+      this->done.notify_all();
+    }
+  }
+}
+
+void ThreadPool::work() {
+  std::uint64_t seen = 0;
+  std::unique_lock<std::mutex> guard(this->lock);
+  for (;;) {
+    this->wake.wait(guard, [this, seen] {
+      return this->stopping || this->generation != seen;
+    });
+    if (this->stopping) {
+      return;
+    }
+    seen = this->generation;
+    if (this->task != nullptr) {
+      this->drain(guard);
+    }
+  }
+}
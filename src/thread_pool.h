@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "memory_stats.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// a fixed set of worker threads for data-parallel loops. the calling thread
+// takes part in every run(), so a pool of size 1 starts no threads at all
+class ThreadPool {
+public:
+  // 0 picks std::thread::hardware_concurrency()
+  explicit ThreadPool(std::size_t threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  std::size_t size() const noexcept;
+  // calls task(i) for every i in [0, count) and returns once all calls have
+  // finished. tasks must not throw
+  void run(std::size_t count, const std::function<void(std::size_t)> &task);
+
+private:
+  void work();
+  // claims and runs task indices until there are none left
+  void drain(std::unique_lock<std::mutex> &guard);
+
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const std::function<void(std::size_t)> *task = nullptr;
+  // tasks allocate in the phase of the thread that called run()
+  MemoryPhase phase = MemoryPhase::OTHER;
+  std::size_t next_index{0};
+  std::size_t task_count{0};
+  std::size_t finished{0};
+  std::uint64_t generation{0};
+  bool stopping{false};
+};
+
+#endif // !THREAD_POOL_H
@@ -0,0 +1,68 @@
+#include "token_buffer.h"
+#include <utility>
+
+namespace {
+
+// 48MB of tokens, about a 4MB source
+constexpr std::size_t max_token_estimate = std::size_t{1} << 20;
+
+} // namespace
+
+TokenBuffer::TokenBuffer(std::size_t capacity) { this->reserve(capacity); }
+
+void TokenBuffer::reserve(std::size_t capacity) {
+  if (capacity > this->cap) {
+    this->reallocate(capacity);
+  }
+}
+
+void TokenBuffer::reallocate(std::size_t capacity) {
+  if (capacity == 0) {
+    this->tokens = nullptr;
+  } else {
+    TokenChunk *resized = static_cast<TokenChunk *>(
+        counted_realloc(this->tokens.get(), capacity * sizeof(TokenChunk)));
+    // realloc already freed or reused the old block
+    this->tokens.release();
+    this->tokens.reset(resized);
+  }
+  this->cap = capacity;
+}
+
+void TokenBuffer::push(TokenChunk &&tok) {
+  if (this->count == this->cap) {
+    // geometric growth keeps the amortized cost of a push constant
+    this->reserve(this->cap < 16 ? 16 : this->cap * 2);
+  }
+  new (&this->tokens[this->count]) TokenChunk(std::move(tok));
+  this->count++;
+}
+
+std::size_t TokenBuffer::size() const noexcept { return this->count; }
+
+std::size_t TokenBuffer::capacity() const noexcept { return this->cap; }
+
+TokenChunk &TokenBuffer::operator[](std::size_t i) noexcept {
+  return this->tokens[i];
+}
+
+void TokenBuffer::shrink_to_fit() {
+  if (this->count < this->cap) {
+    this->reallocate(this->count);
+  }
+}
+
+TokenArray TokenBuffer::release() noexcept {
+  this->count = 0;
+  this->cap = 0;
+  return std::move(this->tokens);
+}
+
+void TokenBuffer::clear() noexcept { this->count = 0; }
+
+std::size_t estimate_token_count(std::size_t input_len) noexcept {
+  // generated scripts average a little over four bytes per token, the
+  // START/END sentinels are always present
+  std::size_t estimate = input_len / 4 + 2;
+  return estimate < max_token_estimate ? estimate : max_token_estimate;
+}
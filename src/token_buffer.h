@@ -0,0 +1,60 @@
+#ifndef TOKEN_BUFFER_H
+#define TOKEN_BUFFER_H
+
+#include "globals.h"
+#include "memory_stats.h"
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+// tokens are copied and dropped as raw bytes, a token array is storage that
+// was never default-constructed and only holds the tokens written into it
+static_assert(std::is_trivially_copyable_v<TokenChunk> &&
+                  std::is_trivially_destructible_v<TokenChunk>,
+              "token arrays are raw storage");
+
+struct TokenArrayDeleter {
+  void operator()(TokenChunk *tokens) const noexcept {
+    counted_free(tokens);
+  }
+};
+
+// the token array the lexer hands to the parser
+using TokenArray = std::unique_ptr<TokenChunk[], TokenArrayDeleter>;
+
+// contiguous token storage the lexer emits into directly. the backing array
+// has the same type the parser takes, so release() hands it over without
+// copying a single token. storage is allocated uninitialized and a token is
+// constructed when it is pushed, so capacity that is never used is never
+// touched. growing and shrinking go through realloc, which moves the pages
+// of a large array instead of copying them, so the old and new arrays are
+// never both resident
+class TokenBuffer {
+public:
+  TokenBuffer() = default;
+  explicit TokenBuffer(std::size_t capacity);
+  void reserve(std::size_t capacity);
+  void push(TokenChunk &&tok);
+  std::size_t size() const noexcept;
+  std::size_t capacity() const noexcept;
+  TokenChunk &operator[](std::size_t i) noexcept;
+  // drops the capacity past size(), done once the lexer is finished
+  void shrink_to_fit();
+  TokenArray release() noexcept;
+  // forgets the tokens but keeps the storage for reuse
+  void clear() noexcept;
+
+private:
+  void reallocate(std::size_t capacity);
+  TokenArray tokens = nullptr;
+  std::size_t count{0};
+  std::size_t cap{0};
+};
+
+// rough guess of how many tokens a source of input_len bytes produces, used
+// to size the buffer up front so most inputs never have to grow it. capped,
+// a large input grows past it instead of reserving a guess it may not need
+std::size_t estimate_token_count(std::size_t input_len) noexcept;
+
+#endif // !TOKEN_BUFFER_H
@@ -0,0 +1,265 @@
+#include "token_stream.h"
+#include "keywords.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+constexpr std::size_t payload_mark_stride = 64;
+constexpr std::uint32_t no_text = UINT32_MAX;
+constexpr std::uint8_t payload_text = 0xFF;
+
+constexpr std::uint8_t kind_byte(Token kind) {
+  return static_cast<std::uint8_t>(static_cast<std::int8_t>(kind));
+}
+
+// text length of every kind whose spelling is fixed, payload_text for the
+// rest
+constexpr std::array<std::uint8_t, 256> build_fixed_lengths() {
+  std::array<std::uint8_t, 256> lengths{};
+  for (std::uint8_t &len : lengths) {
+    len = payload_text;
+  }
+  for (const Keyword &kw : keywords) {
+    lengths[kind_byte(kw.type)] = static_cast<std::uint8_t>(kw.text.size());
+  }
+  for (Token punct :
+       {Token::LEFTBRACE, Token::RIGHTBRACE, Token::LEFTPARENTHESIS,
+        Token::RIGHTPARENTHESIS, Token::PERIOD, Token::COMMA, Token::COLON,
+        Token::EXCLAIM, Token::MULTIPLY, Token::ADD, Token::SUBTRACT,
+        Token::DIVIDE, Token::SEMICOLON}) {
+    lengths[kind_byte(punct)] = 1;
+  }
+  lengths[kind_byte(Token::START)] = 0;
+  lengths[kind_byte(Token::END)] = 0;
+  return lengths;
+}
+
+constexpr std::array<std::uint8_t, 256> fixed_lengths = build_fixed_lengths();
+
+// string literals are stored from their opening quote
+inline std::size_t text_skip(Token kind) noexcept {
+  return kind == Token::STRING || kind == Token::UNDEFINED ? 1 : 0;
+}
+
+inline std::uint32_t checked_len(std::size_t len) {
+  if (len >= no_text) {
+    throw std::length_error("token text longer than 4 GB");
+  }
+  return static_cast<std::uint32_t>(len);
+}
+
+} // namespace
+
+bool token_has_payload(Token kind) noexcept {
+  return fixed_lengths[kind_byte(kind)] == payload_text;
+}
+
+TokenStream::TokenStream(std::string_view source) : source(source) {}
+
+void TokenStream::reserve(std::size_t tokens) {
+  this->kinds.reserve(tokens);
+  this->offsets.reserve(tokens);
+  this->payload_marks.reserve(tokens / payload_mark_stride + 1);
+}
+
+void TokenStream::shrink_to_fit() {
+  this->kinds.shrink_to_fit();
+  this->offsets.shrink_to_fit();
+  this->wraps.shrink_to_fit();
+  this->payloads.shrink_to_fit();
+  this->reals.shrink_to_fit();
+  this->payload_marks.shrink_to_fit();
+}
+
+void TokenStream::push(TokenChunk &&tok) {
+  std::size_t i = this->kinds.size();
+  if (i % payload_mark_stride == 0) {
+    this->payload_marks.push_back(this->payloads.size());
+  }
+  if (i != 0 && tok.offset < this->offset(i - 1)) {
+    throw std::logic_error("tokens pushed out of source order");
+  }
+  while ((tok.offset >> 32) > this->wraps.size()) {
+    this->wraps.push_back(i);
+  }
+  this->kinds.push_back(kind_byte(tok.type));
+  this->offsets.push_back(static_cast<std::uint32_t>(tok.offset));
+
+  std::uint8_t fixed = fixed_lengths[kind_byte(tok.type)];
+  if (fixed != payload_text) {
+    const std::string_view *text = std::get_if<std::string_view>(&tok.value);
+    if (text == nullptr || text->size() != fixed) {
+      throw std::logic_error("token text does not match its kind");
+    }
+    return;
+  }
+  TokenPayload payload{0, 0};
+  if (tok.type == Token::INT) {
+    payload.data = static_cast<std::uint32_t>(std::get<int>(tok.value));
+  } else if (tok.type == Token::CHAR) {
+    payload.data = static_cast<unsigned char>(std::get<char>(tok.value));
+  } else if (tok.type == Token::DOUBLE) {
+    payload.data = checked_len(this->reals.size());
+    this->reals.push_back(std::get<double>(tok.value));
+  } else if (std::holds_alternative<std::string_view>(tok.value)) {
+    std::string_view text = std::get<std::string_view>(tok.value);
+    if (text.data() != this->source.data() + tok.offset + text_skip(tok.type)) {
+      throw std::logic_error("token text is not a view of the source");
+    }
+    payload.len = checked_len(text.size());
+    payload.data = tok.sym;
+  } else if (tok.type == Token::UNDEFINED) {
+    // the marker left where a word ran into a string literal, it has no text
+    payload.len = no_text;
+  } else {
+    throw std::logic_error("token value does not match its kind");
+  }
+  this->payloads.push_back(payload);
+}
+
+void TokenStream::splice(std::size_t first, std::size_t last,
+                         const TokenStream &part) {
+  if (!this->wraps.empty() || !part.wraps.empty() ||
+      part.source.size() >= no_text) {
+    throw std::length_error("can't splice tokens past 4 GB");
+  }
+  if (first > last || last > this->kinds.size()) {
+    throw std::out_of_range("splice range outside the token stream");
+  }
+  std::size_t payload_first = this->payload_index(first);
+  std::size_t payload_last = this->payload_index(last);
+  std::size_t mark = first / payload_mark_stride;
+  std::size_t mark_payload = mark < this->payload_marks.size()
+                                 ? this->payload_marks[mark]
+                                 : this->payloads.size();
+
+  // part's doubles go to the end of the pool, the replaced ones are left
+  // unreferenced
+  std::vector<TokenPayload> payloads = part.payloads;
+  std::size_t payload = 0;
+  for (std::uint8_t kind : part.kinds) {
+    if (fixed_lengths[kind] != payload_text) {
+      continue;
+    }
+    if (token_kind_from_byte(kind) == Token::DOUBLE) {
+      payloads[payload].data += checked_len(this->reals.size());
+    }
+    payload++;
+  }
+  this->reals.insert(this->reals.end(), part.reals.begin(), part.reals.end());
+
+  this->kinds.erase(this->kinds.begin() + first, this->kinds.begin() + last);
+  this->kinds.insert(this->kinds.begin() + first, part.kinds.begin(),
+                     part.kinds.end());
+  this->offsets.erase(this->offsets.begin() + first,
+                      this->offsets.begin() + last);
+  this->offsets.insert(this->offsets.begin() + first, part.offsets.begin(),
+                       part.offsets.end());
+  this->payloads.erase(this->payloads.begin() + payload_first,
+                       this->payloads.begin() + payload_last);
+  this->payloads.insert(this->payloads.begin() + payload_first,
+                        payloads.begin(), payloads.end());
+
+  // both sizes are below 4 GB, so the shift wraps to the right offsets
+  std::uint32_t shift = static_cast<std::uint32_t>(part.source.size()) -
+                        static_cast<std::uint32_t>(this->source.size());
+  for (std::size_t i = first + part.kinds.size(); i < this->offsets.size();
+       i++) {
+    this->offsets[i] += shift;
+  }
+  this->source = part.source;
+
+  // marks before first are unchanged, the rest are counted again
+  this->payload_marks.resize(mark);
+  payload = mark_payload;
+  for (std::size_t i = mark * payload_mark_stride; i < this->kinds.size();
+       i++) {
+    if (i % payload_mark_stride == 0) {
+      this->payload_marks.push_back(payload);
+    }
+    payload += fixed_lengths[this->kinds[i]] == payload_text;
+  }
+}
+
+std::size_t TokenStream::size() const noexcept { return this->kinds.size(); }
+
+void TokenStream::extend_source(std::string_view source) noexcept {
+  this->source = source;
+}
+
+std::string_view TokenStream::source_view() const noexcept {
+  return this->source;
+}
+
+Token TokenStream::kind(std::size_t i) const noexcept {
+  if (i >= this->kinds.size()) {
+    return Token::END;
+  }
+  return token_kind_from_byte(this->kinds[i]);
+}
+
+std::size_t TokenStream::offset(std::size_t i) const {
+  std::size_t high =
+      std::upper_bound(this->wraps.begin(), this->wraps.end(), i) -
+      this->wraps.begin();
+  return (high << 32) | this->offsets.at(i);
+}
+
+std::size_t TokenStream::payload_index(std::size_t i) const {
+  if (i >= this->kinds.size()) {
+    return this->payloads.size();
+  }
+  std::size_t mark = i / payload_mark_stride;
+  std::size_t payload = this->payload_marks.at(mark);
+  for (std::size_t j = mark * payload_mark_stride; j < i; j++) {
+    payload += token_has_payload(token_kind_from_byte(this->kinds[j]));
+  }
+  return payload;
+}
+
+TokenChunk TokenStream::token(std::size_t i, std::size_t payload) const {
+  TokenChunk tok;
+  tok.type = this->kind(i);
+  if (i >= this->kinds.size()) {
+    tok.value = std::string_view();
+    tok.offset = this->source.size();
+    return tok;
+  }
+  tok.offset = this->offset(i);
+  std::uint8_t fixed = fixed_lengths[this->kinds[i]];
+  if (fixed != payload_text) {
+    tok.value = this->source.substr(tok.offset, fixed);
+    return tok;
+  }
+  const TokenPayload &entry = this->payloads[payload];
+  if (tok.type == Token::INT) {
+    tok.value = static_cast<int>(entry.data);
+  } else if (tok.type == Token::CHAR) {
+    tok.value = static_cast<char>(entry.data);
+  } else if (tok.type == Token::DOUBLE) {
+    tok.value = this->reals[entry.data];
+  } else if (entry.len == no_text) {
+    tok.value = 0;
+  } else {
+    tok.value = this->source.substr(tok.offset + text_skip(tok.type),
+                                    entry.len);
+    tok.sym = entry.data;
+  }
+  return tok;
+}
+
+TokenChunk TokenStream::token(std::size_t i) const {
+  return this->token(i, this->payload_index(i));
+}
+
+std::size_t TokenStream::memory_bytes() const noexcept {
+  return this->kinds.capacity() * sizeof(std::uint8_t) +
+         this->offsets.capacity() * sizeof(std::uint32_t) +
+         this->wraps.capacity() * sizeof(std::size_t) +
+         this->payloads.capacity() * sizeof(TokenPayload) +
+         this->reals.capacity() * sizeof(double) +
+         this->payload_marks.capacity() * sizeof(std::size_t);
+}
@@ -0,0 +1,72 @@
+#ifndef TOKEN_STREAM_H
+#define TOKEN_STREAM_H
+
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// a token's literal value, kept apart from the per-token arrays. text tokens
+// store their length and interned id, INT and CHAR their value, DOUBLE an
+// index into the pool of doubles
+struct TokenPayload {
+  std::uint32_t len;
+  std::uint32_t data;
+};
+
+// compact structure-of-arrays token storage: one byte of kind and four bytes
+// of source offset per token. keywords and punctuation are rebuilt from
+// their offset, only literals and names have an entry in the payload pool,
+// in token order, so a reader walking the tokens front to back keeps a
+// running payload index instead of storing one per token. offsets past
+// 4 GB are kept as the low 32 bits plus the token indices where they wrap
+class TokenStream {
+public:
+  TokenStream() = default;
+  explicit TokenStream(std::string_view source);
+  void reserve(std::size_t tokens);
+  // drops what reserve() over-estimated once every token is in
+  void shrink_to_fit();
+  // replaces tokens [first, last) with part, which was lexed from an edited
+  // copy of the source. the stream views part's source afterwards and the
+  // tokens from last on move by the difference in source size. streams
+  // with offsets past 4 GB can't be spliced
+  void splice(std::size_t first, std::size_t last, const TokenStream &part);
+  // tok.value has to view the source this stream was created with
+  void push(TokenChunk &&tok);
+  // a streamed source is lexed while it is still being decompressed, source
+  // starts where the old one did and goes on past it
+  void extend_source(std::string_view source) noexcept;
+
+  std::size_t size() const noexcept;
+  std::string_view source_view() const noexcept;
+  // END past the last token, like reading the END sentinel again
+  Token kind(std::size_t i) const noexcept;
+  std::size_t offset(std::size_t i) const;
+  // payload index of token i, found from the nearest mark
+  std::size_t payload_index(std::size_t i) const;
+  // payload is the running index the caller kept for token i
+  TokenChunk token(std::size_t i, std::size_t payload) const;
+  TokenChunk token(std::size_t i) const;
+  std::size_t memory_bytes() const noexcept;
+
+private:
+  std::string_view source;
+  std::vector<std::uint8_t> kinds;
+  std::vector<std::uint32_t> offsets;
+  std::vector<std::size_t> wraps;
+  std::vector<TokenPayload> payloads;
+  std::vector<double> reals;
+  // payload index at every payload_mark_stride-th token
+  std::vector<std::size_t> payload_marks;
+};
+
+// whether tokens of this kind have an entry in the payload pool
+bool token_has_payload(Token kind) noexcept;
+
+inline Token token_kind_from_byte(std::uint8_t kind) noexcept {
+  return static_cast<Token>(static_cast<std::int8_t>(kind));
+}
+
+#endif // !TOKEN_STREAM_H
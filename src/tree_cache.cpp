@@ -0,0 +1,454 @@
+#include "tree_cache.h"
+#include "fd_writer.h"
+#include "flat_tree.h"
+#include "helper.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <variant>
+#include <vector>
+
+namespace {
+
+// bumped whenever the layout below changes
+constexpr std::uint32_t image_format = 1;
+constexpr char image_magic[8] = {'S', 'N', 'I', 'P', 'T', 'R', 'E', 'E'};
+// reads back differently on a machine of the other byte order
+constexpr std::uint32_t image_byte_order = 0x01020304;
+constexpr const char *image_suffix = ".tree";
+
+// offsets are from the start of the image, every section starts on an
+// 8 byte boundary
+struct ImageHeader {
+  char magic[8];
+  std::uint32_t byte_order;
+  std::uint32_t format;
+  std::uint64_t source_hash;
+  std::uint64_t source_size;
+  std::uint32_t nodes;
+  std::uint32_t payload_count;
+  // one byte of kind and five 32-bit links per node
+  std::uint64_t kinds;
+  std::uint64_t depths;
+  std::uint64_t parents;
+  std::uint64_t first_children;
+  std::uint64_t next_siblings;
+  std::uint64_t payloads;
+  // a ValueRecord per payload, string values point into strings
+  std::uint64_t values;
+  std::uint64_t strings;
+  std::uint64_t strings_size;
+  std::uint64_t length;
+};
+
+// index is the TokenVariant alternative. data holds the int, double, bool
+// or char, or for a string its offset into the strings section in the low
+// half and its length in the high half
+struct ValueRecord {
+  std::uint8_t index;
+  std::uint8_t unused[3];
+  std::uint32_t sym;
+  std::uint64_t data;
+};
+
+static_assert(sizeof(ValueRecord) == 16, "records are read in place");
+
+std::size_t align8(std::size_t offset) {
+  return (offset + 7) & ~std::size_t{7};
+}
+
+// appends size bytes as the next section, returns its offset
+std::uint64_t add_section(std::string &image, const void *data,
+                          std::size_t size) {
+  image.resize(align8(image.size()));
+  std::uint64_t offset = image.size();
+  image.append(static_cast<const char *>(data), size);
+  return offset;
+}
+
+bool section_fits(const ImageHeader &header, std::uint64_t offset,
+                  std::uint64_t size) {
+  return offset % 8 == 0 && offset <= header.length &&
+         size <= header.length - offset;
+}
+
+bool has_payload(const ParserTokenChunk &tok) {
+  const std::string_view *text = std::get_if<std::string_view>(&tok.value);
+  return tok.sym != no_symbol || text == nullptr || !text->empty();
+}
+
+std::uint64_t rotate(std::uint64_t x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+std::uint64_t finish(std::uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDull;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ull;
+  h ^= h >> 33;
+  return h;
+}
+
+} // namespace
+
+std::string TreeImage::encode(const FlatTree &tree,
+                              std::uint64_t source_hash,
+                              std::uint64_t source_size) {
+  std::uint32_t nodes = static_cast<std::uint32_t>(tree.size());
+  std::vector<std::uint8_t> kinds(nodes);
+  std::vector<std::uint32_t> links[5];
+  for (std::vector<std::uint32_t> &link : links) {
+    link.resize(nodes);
+  }
+  std::vector<ValueRecord> values;
+  std::string strings;
+  for (std::uint32_t i = 0; i < nodes; i++) {
+    ParserTokenChunk tok = tree.token(i);
+    kinds[i] = static_cast<std::uint8_t>(tok.type);
+    links[0][i] = tree.depth(i);
+    links[1][i] = tree.parent(i);
+    links[2][i] = tree.first_child(i);
+    links[3][i] = tree.next_sibling(i);
+    links[4][i] = none;
+    if (!has_payload(tok)) {
+      continue;
+    }
+    links[4][i] = static_cast<std::uint32_t>(values.size());
+    ValueRecord record{};
+    record.index = static_cast<std::uint8_t>(tok.value.index());
+    record.sym = tok.sym;
+    if (const int *n = std::get_if<int>(&tok.value)) {
+      record.data = static_cast<std::uint32_t>(*n);
+    } else if (const std::string_view *text =
+                   std::get_if<std::string_view>(&tok.value)) {
+      record.data = static_cast<std::uint64_t>(text->size()) << 32 |
+                    static_cast<std::uint32_t>(strings.size());
+      strings.append(*text);
+    } else if (const double *d = std::get_if<double>(&tok.value)) {
+      std::memcpy(&record.data, d, sizeof(*d));
+    } else if (const bool *b = std::get_if<bool>(&tok.value)) {
+      record.data = *b;
+    } else {
+      record.data = static_cast<unsigned char>(std::get<char>(tok.value));
+    }
+    values.push_back(record);
+  }
+
+  ImageHeader header{};
+  std::memcpy(header.magic, image_magic, sizeof(image_magic));
+  header.byte_order = image_byte_order;
+  header.format = image_format;
+  header.source_hash = source_hash;
+  header.source_size = source_size;
+  header.nodes = nodes;
+  header.payload_count = static_cast<std::uint32_t>(values.size());
+  std::string image(sizeof(header), '\0');
+  header.kinds = add_section(image, kinds.data(), kinds.size());
+  std::uint64_t *link_offsets[5] = {&header.depths, &header.parents,
+                                    &header.first_children,
+                                    &header.next_siblings, &header.payloads};
+  for (int i = 0; i < 5; i++) {
+    *link_offsets[i] =
+        add_section(image, links[i].data(), nodes * sizeof(std::uint32_t));
+  }
+  header.values = add_section(image, values.data(),
+                              values.size() * sizeof(ValueRecord));
+  header.strings = add_section(image, strings.data(), strings.size());
+  header.strings_size = strings.size();
+  header.length = image.size();
+  std::memcpy(&image[0], &header, sizeof(header));
+  return image;
+}
+
+// the header and the section bounds are checked, and then every node, so
+// a corrupt or foreign file of the right length is a miss and not a read
+// out of bounds
+std::unique_ptr<TreeImage> TreeImage::open(const std::string &path,
+                                           std::uint64_t source_hash,
+                                           std::uint64_t source_size) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (::fstat(fd, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) < sizeof(ImageHeader)) {
+    ::close(fd);
+    return nullptr;
+  }
+  std::size_t length = static_cast<std::size_t>(st.st_size);
+  void *mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (mapping == MAP_FAILED) {
+    return nullptr;
+  }
+  std::unique_ptr<TreeImage> image(new TreeImage());
+  image->mapping = mapping;
+  image->length = length;
+  image->base = static_cast<const char *>(mapping);
+
+  ImageHeader header;
+  std::memcpy(&header, image->base, sizeof(header));
+  std::uint64_t links = std::uint64_t{header.nodes} * sizeof(std::uint32_t);
+  bool valid =
+      std::memcmp(header.magic, image_magic, sizeof(image_magic)) == 0 &&
+      header.byte_order == image_byte_order &&
+      header.format == image_format && header.source_hash == source_hash &&
+      header.source_size == source_size && header.length == length &&
+      section_fits(header, header.kinds, header.nodes) &&
+      section_fits(header, header.depths, links) &&
+      section_fits(header, header.parents, links) &&
+      section_fits(header, header.first_children, links) &&
+      section_fits(header, header.next_siblings, links) &&
+      section_fits(header, header.payloads, links) &&
+      section_fits(header, header.values,
+                   std::uint64_t{header.payload_count} *
+                       sizeof(ValueRecord)) &&
+      section_fits(header, header.strings, header.strings_size);
+  if (!valid) {
+    return nullptr;
+  }
+  const char *base = image->base;
+  image->nodes = header.nodes;
+  image->kinds = reinterpret_cast<const std::uint8_t *>(base + header.kinds);
+  image->depths =
+      reinterpret_cast<const std::uint32_t *>(base + header.depths);
+  image->parents =
+      reinterpret_cast<const std::uint32_t *>(base + header.parents);
+  image->first_children =
+      reinterpret_cast<const std::uint32_t *>(base + header.first_children);
+  image->next_siblings =
+      reinterpret_cast<const std::uint32_t *>(base + header.next_siblings);
+  image->payloads =
+      reinterpret_cast<const std::uint32_t *>(base + header.payloads);
+  image->values = base + header.values;
+  image->strings = base + header.strings;
+  if (!image->valid_nodes(header.payload_count, header.strings_size)) {
+    return nullptr;
+  }
+  return image;
+}
+
+// nodes are in pre-order, so a parent comes before its children and a
+// node's depth is its parent's plus one. a link is a node or none, and a
+// string payload lies inside the strings section
+bool TreeImage::valid_nodes(std::uint32_t payload_count,
+                            std::uint64_t strings_size) const noexcept {
+  for (std::uint32_t i = 0; i < this->nodes; i++) {
+    int kind = static_cast<std::int8_t>(this->kinds[i]);
+    if (kind < static_cast<int>(ParserToken::FORMAL) ||
+        kind > static_cast<int>(ParserToken::LAZYBODY)) {
+      return false;
+    }
+    std::uint32_t parent = this->parents[i];
+    if (parent == none ? this->depths[i] != 0
+                       : parent >= i || this->depths[i] !=
+                                            this->depths[parent] + 1) {
+      return false;
+    }
+    std::uint32_t first_child = this->first_children[i];
+    std::uint32_t next_sibling = this->next_siblings[i];
+    if ((first_child != none && first_child >= this->nodes) ||
+        (next_sibling != none && next_sibling >= this->nodes)) {
+      return false;
+    }
+    std::uint32_t payload = this->payloads[i];
+    if (payload == none) {
+      continue;
+    }
+    if (payload >= payload_count) {
+      return false;
+    }
+    ValueRecord record;
+    std::memcpy(&record, this->values + payload * sizeof(ValueRecord),
+                sizeof(record));
+    std::uint64_t offset = static_cast<std::uint32_t>(record.data);
+    if (record.index > 4 ||
+        (record.index == 1 && offset + (record.data >> 32) > strings_size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+TreeImage::~TreeImage() {
+  if (this->mapping != nullptr) {
+    ::munmap(this->mapping, this->length);
+  }
+}
+
+std::size_t TreeImage::size() const noexcept { return this->nodes; }
+
+ParserToken TreeImage::kind(std::uint32_t node) const noexcept {
+  // kinds below 0 are stored as their two's complement byte
+  return static_cast<ParserToken>(static_cast<std::int8_t>(this->kinds[node]));
+}
+
+std::uint32_t TreeImage::depth(std::uint32_t node) const noexcept {
+  return this->depths[node];
+}
+
+std::uint32_t TreeImage::parent(std::uint32_t node) const noexcept {
+  return this->parents[node];
+}
+
+std::uint32_t TreeImage::first_child(std::uint32_t node) const noexcept {
+  return this->first_children[node];
+}
+
+std::uint32_t TreeImage::next_sibling(std::uint32_t node) const noexcept {
+  return this->next_siblings[node];
+}
+
+ParserTokenChunk TreeImage::token(std::uint32_t node) const {
+  std::uint32_t payload = this->payloads[node];
+  if (payload == none) {
+    return {this->kind(node), ""};
+  }
+  ValueRecord record;
+  std::memcpy(&record, this->values + payload * sizeof(ValueRecord),
+              sizeof(record));
+  ParserTokenChunk tok{this->kind(node), "", record.sym};
+  switch (record.index) {
+  case 0:
+    tok.value = static_cast<int>(static_cast<std::uint32_t>(record.data));
+    break;
+  case 1:
+    tok.value = std::string_view(
+        this->strings + static_cast<std::uint32_t>(record.data),
+        record.data >> 32);
+    break;
+  case 2: {
+    double d;
+    std::memcpy(&d, &record.data, sizeof(d));
+    tok.value = d;
+    break;
+  }
+  case 3:
+    tok.value = record.data != 0;
+    break;
+  default:
+    tok.value = static_cast<char>(record.data);
+    break;
+  }
+  return tok;
+}
+
+std::string TreeImage::output() const {
+  std::string out;
+  for (std::uint32_t i = 0; i < this->nodes; i++) {
+    out.append(2 * this->depths[i], ' ');
+    out += token_to_string(this->kind(i));
+    out += '\n';
+  }
+  return out;
+}
+
+void TreeImage::write(FdWriter &out) const {
+  for (std::uint32_t i = 0; i < this->nodes; i++) {
+    out.fill(' ', 2 * this->depths[i]);
+    out.write(token_to_string(this->kind(i)));
+    out.put(' ');
+    write_token_value(out, this->token(i).value);
+    out.put('\n');
+  }
+}
+
+TreeCache::TreeCache(std::string dir) : dir(std::move(dir)) {}
+
+// eight bytes a step, the key only has to tell sources apart, not stand
+// up to someone crafting collisions
+std::uint64_t TreeCache::hash(std::string_view source) noexcept {
+  constexpr std::uint64_t k1 = 0x87C37B91114253D5ull;
+  constexpr std::uint64_t k2 = 0x4CF5AD432745937Full;
+  std::uint64_t h = 0xCBF29CE484222325ull;
+  for (const char *c = snip_version; *c != '\0'; c++) {
+    h = (h ^ static_cast<unsigned char>(*c)) * 0x100000001B3ull;
+  }
+  h = (h ^ tree_schema) * 0x100000001B3ull;
+  h ^= source.size() * k2;
+  std::size_t i = 0;
+  for (; i + 8 <= source.size(); i += 8) {
+    std::uint64_t word;
+    std::memcpy(&word, source.data() + i, 8);
+    h = rotate(h ^ rotate(word * k1, 31) * k2, 27) * 5 + 0x52DCE729;
+  }
+  std::uint64_t tail = 0;
+  std::memcpy(&tail, source.data() + i, source.size() - i);
+  h ^= rotate(tail * k1, 31) * k2;
+  return finish(h);
+}
+
+std::string TreeCache::path(std::uint64_t source_hash) const {
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016llx",
+                static_cast<unsigned long long>(source_hash));
+  return this->dir + "/" + name + image_suffix;
+}
+
+std::unique_ptr<TreeImage> TreeCache::load(std::string_view source) const {
+  std::uint64_t source_hash = TreeCache::hash(source);
+  return TreeImage::open(this->path(source_hash), source_hash, source.size());
+}
+
+// written under a name of its own and renamed over the entry, rename()
+// replaces it in one step. not synced to disk, a lost entry is only a miss
+bool TreeCache::store(std::string_view source, const FlatTree &tree) const {
+  std::error_code error;
+  std::filesystem::create_directories(this->dir, error);
+  if (error) {
+    return false;
+  }
+  std::uint64_t source_hash = TreeCache::hash(source);
+  std::string image = TreeImage::encode(tree, source_hash, source.size());
+  std::string target = this->path(source_hash);
+  std::string temp = target + ".XXXXXX";
+  int fd = ::mkstemp(&temp[0]);
+  if (fd < 0) {
+    return false;
+  }
+  std::size_t done = 0;
+  while (done < image.size()) {
+    ssize_t put = ::write(fd, image.data() + done, image.size() - done);
+    if (put < 0 && errno == EINTR) {
+      continue;
+    }
+    if (put <= 0) {
+      break;
+    }
+    done += static_cast<std::size_t>(put);
+  }
+  bool written = ::close(fd) == 0 && done == image.size();
+  if (!written || ::rename(temp.c_str(), target.c_str()) != 0) {
+    ::unlink(temp.c_str());
+    return false;
+  }
+  return true;
+}
+
+// temporary files left by a store() that didn't finish go as well
+std::size_t TreeCache::clear() const {
+  std::vector<std::filesystem::path> doomed;
+  std::size_t entries = 0;
+  std::error_code error;
+  for (std::filesystem::directory_iterator it(this->dir, error), end;
+       !error && it != end; it.increment(error)) {
+    std::string name = it->path().filename().string();
+    std::size_t at = name.find(image_suffix);
+    if (at == std::string::npos) {
+      continue;
+    }
+    entries += at + 5 == name.size();
+    doomed.push_back(it->path());
+  }
+  for (const std::filesystem::path &path : doomed) {
+    std::filesystem::remove(path, error);
+  }
+  return entries;
+}
@@ -0,0 +1,96 @@
+#ifndef TREE_CACHE_H
+#define TREE_CACHE_H
+
+#include "globals.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+class FdWriter;
+class FlatTree;
+
+// a parse tree as one relocatable block of bytes: a header, then the node
+// arrays of a FlatTree and the text of its payloads, all found by offsets
+// from the start. there are no pointers in it, so a file holding one is
+// mapped and read in place. the header records the hash and size of the
+// source the tree was parsed from
+class TreeImage {
+public:
+  static constexpr std::uint32_t none = UINT32_MAX;
+
+  // the image of tree, parsed from a source with that hash and size
+  static std::string encode(const FlatTree &tree, std::uint64_t source_hash,
+                            std::uint64_t source_size);
+  // maps the file at path. nullptr when it can't be read, or isn't a
+  // complete and well-formed image for a source with that hash and size
+  static std::unique_ptr<TreeImage> open(const std::string &path,
+                                         std::uint64_t source_hash,
+                                         std::uint64_t source_size);
+  TreeImage(const TreeImage &) = delete;
+  TreeImage &operator=(const TreeImage &) = delete;
+  ~TreeImage();
+
+  // the same accessors as FlatTree
+  std::size_t size() const noexcept;
+  ParserToken kind(std::uint32_t node) const noexcept;
+  std::uint32_t depth(std::uint32_t node) const noexcept;
+  std::uint32_t parent(std::uint32_t node) const noexcept;
+  std::uint32_t first_child(std::uint32_t node) const noexcept;
+  std::uint32_t next_sibling(std::uint32_t node) const noexcept;
+  // string values are views into the mapping
+  ParserTokenChunk token(std::uint32_t node) const;
+
+  // the text PTNode::output() and PTNode::write() give for the tree
+  std::string output() const;
+  void write(FdWriter &out) const;
+
+private:
+  TreeImage() = default;
+  bool valid_nodes(std::uint32_t payload_count,
+                   std::uint64_t strings_size) const noexcept;
+  void *mapping = nullptr;
+  std::size_t length = 0;
+  const char *base = nullptr;
+  std::uint32_t nodes = 0;
+  const std::uint8_t *kinds = nullptr;
+  const std::uint32_t *depths = nullptr;
+  const std::uint32_t *parents = nullptr;
+  const std::uint32_t *first_children = nullptr;
+  const std::uint32_t *next_siblings = nullptr;
+  const std::uint32_t *payloads = nullptr;
+  const char *values = nullptr;
+  const char *strings = nullptr;
+};
+
+// parse trees kept in a directory, one file per source named by a hash of
+// the source bytes, snip_version and tree_schema. a changed source, a new
+// release or a parser building other trees looks for a different file,
+// and a file that doesn't match the source it is looked up for, or is cut
+// short, is ignored and written again.
+// entries are written to a temporary file and renamed into place, so a
+// reader never maps a half-written one
+class TreeCache {
+public:
+  // the directory is created on the first store()
+  explicit TreeCache(std::string dir);
+
+  // 64-bit hash of the source bytes, seeded with snip_version and
+  // tree_schema
+  static std::uint64_t hash(std::string_view source) noexcept;
+  std::string path(std::uint64_t source_hash) const;
+
+  // the cached tree for source, nullptr on a miss
+  std::unique_ptr<TreeImage> load(std::string_view source) const;
+  // false when the entry couldn't be written, the cache is only an
+  // optimisation and a failure isn't an error
+  bool store(std::string_view source, const FlatTree &tree) const;
+  // removes every entry, returns how many there were
+  std::size_t clear() const;
+
+private:
+  std::string dir;
+};
+
+#endif // !TREE_CACHE_H
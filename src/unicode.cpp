@@ -0,0 +1,301 @@
+#include "unicode.h"
+#include "scan.h"
+#include "unicode_tables.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SNIP_UTF8_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline unsigned char byte_at(const char *text, std::size_t i) noexcept {
+  return static_cast<unsigned char>(text[i]);
+}
+
+inline bool is_continuation(unsigned char c) noexcept {
+  return (c & 0xC0) == 0x80;
+}
+
+// length of the well-formed sequence starting with a non-ASCII byte at pos,
+// 0 when it is not one (RFC 3629: no overlongs, surrogates or code points
+// past U+10FFFF)
+std::size_t sequence_length(const char *text, std::size_t pos,
+                            std::size_t len) noexcept {
+  unsigned char lead = byte_at(text, pos);
+  std::size_t need;
+  unsigned char low = 0x80;
+  unsigned char high = 0xBF;
+  if (lead >= 0xC2 && lead <= 0xDF) {
+    need = 2;
+  } else if (lead >= 0xE0 && lead <= 0xEF) {
+    need = 3;
+    low = lead == 0xE0 ? 0xA0 : 0x80;
+    high = lead == 0xED ? 0x9F : 0xBF;
+  } else if (lead >= 0xF0 && lead <= 0xF4) {
+    need = 4;
+    low = lead == 0xF0 ? 0x90 : 0x80;
+    high = lead == 0xF4 ? 0x8F : 0xBF;
+  } else {
+    return 0;
+  }
+  if (len - pos < need) {
+    return 0;
+  }
+  unsigned char second = byte_at(text, pos + 1);
+  if (second < low || second > high) {
+    return 0;
+  }
+  for (std::size_t i = 2; i < need; i++) {
+    if (!is_continuation(byte_at(text, pos + i))) {
+      return 0;
+    }
+  }
+  return need;
+}
+
+// ASCII is skipped eight bytes at a time
+std::size_t skip_ascii_scalar(const char *text, std::size_t pos,
+                              std::size_t len) noexcept {
+  while (pos + 8 <= len) {
+    std::uint64_t word;
+    std::memcpy(&word, text + pos, sizeof(word));
+    if ((word & 0x8080808080808080ull) != 0) {
+      break;
+    }
+    pos += 8;
+  }
+  while (pos < len && byte_at(text, pos) < 0x80) {
+    pos++;
+  }
+  return pos;
+}
+
+template <std::size_t (*skip_ascii)(const char *, std::size_t, std::size_t)>
+std::size_t find_invalid_with(const char *text, std::size_t len) noexcept {
+  std::size_t pos = 0;
+  for (;;) {
+    pos = skip_ascii(text, pos, len);
+    if (pos == len) {
+      return len;
+    }
+    std::size_t step = sequence_length(text, pos, len);
+    if (step == 0) {
+      return pos;
+    }
+    pos += step;
+  }
+}
+
+#ifdef SNIP_UTF8_X86
+
+std::size_t skip_ascii_sse2(const char *text, std::size_t pos,
+                            std::size_t len) noexcept {
+  while (pos + 16 <= len) {
+    unsigned mask = _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + pos)));
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
+    pos += 16;
+  }
+  return skip_ascii_scalar(text, pos, len);
+}
+
+// the lookup algorithm from Keiser and Lemire, "Validating UTF-8 in less
+// than one instruction per byte", as used by simdjson. every byte is
+// checked against the one before it with three nibble lookups, each giving
+// the set of errors the pair could be part of; what all three agree on is
+// an error. sequences longer than two bytes are checked by whether a
+// continuation byte is expected two or three bytes after a lead
+namespace lookup {
+
+constexpr std::uint8_t TOO_SHORT = 1 << 0;
+constexpr std::uint8_t TOO_LONG = 1 << 1;
+constexpr std::uint8_t OVERLONG_3 = 1 << 2;
+constexpr std::uint8_t TOO_LARGE = 1 << 3;
+constexpr std::uint8_t SURROGATE = 1 << 4;
+constexpr std::uint8_t OVERLONG_2 = 1 << 5;
+constexpr std::uint8_t TOO_LARGE_1000 = 1 << 6;
+constexpr std::uint8_t OVERLONG_4 = 1 << 6;
+constexpr std::uint8_t TWO_CONTS = 1 << 7;
+constexpr std::uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+__attribute__((target("avx2"))) inline __m256i
+table(std::uint8_t t0, std::uint8_t t1, std::uint8_t t2, std::uint8_t t3,
+      std::uint8_t t4, std::uint8_t t5, std::uint8_t t6, std::uint8_t t7,
+      std::uint8_t t8, std::uint8_t t9, std::uint8_t t10, std::uint8_t t11,
+      std::uint8_t t12, std::uint8_t t13, std::uint8_t t14,
+      std::uint8_t t15) noexcept {
+  return _mm256_setr_epi8(t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11,
+                          t12, t13, t14, t15, t0, t1, t2, t3, t4, t5, t6, t7,
+                          t8, t9, t10, t11, t12, t13, t14, t15);
+}
+
+__attribute__((target("avx2"))) inline __m256i
+high_nibbles(__m256i input) noexcept {
+  return _mm256_and_si256(_mm256_srli_epi16(input, 4), _mm256_set1_epi8(0x0F));
+}
+
+// the vector shifted by n bytes, with the last n bytes of prev in front
+template <int n>
+__attribute__((target("avx2"))) inline __m256i prev(__m256i input,
+                                                    __m256i prev) noexcept {
+  return _mm256_alignr_epi8(
+      input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - n);
+}
+
+__attribute__((target("avx2"))) inline __m256i
+special_cases(__m256i input, __m256i prev1) noexcept {
+  const __m256i byte_1_high_table =
+      table(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+            TOO_LONG, TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+            TOO_SHORT | OVERLONG_2, TOO_SHORT,
+            TOO_SHORT | OVERLONG_3 | SURROGATE,
+            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m256i byte_1_low_table =
+      table(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2,
+            CARRY, CARRY, CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+            CARRY | TOO_LARGE | TOO_LARGE_1000,
+            CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m256i byte_2_high_table = table(
+      TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+          OVERLONG_4,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+      TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, TOO_SHORT,
+      TOO_SHORT, TOO_SHORT, TOO_SHORT);
+  __m256i byte_1_high =
+      _mm256_shuffle_epi8(byte_1_high_table, high_nibbles(prev1));
+  __m256i byte_1_low = _mm256_shuffle_epi8(
+      byte_1_low_table, _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+  __m256i byte_2_high =
+      _mm256_shuffle_epi8(byte_2_high_table, high_nibbles(input));
+  return _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low),
+                          byte_2_high);
+}
+
+__attribute__((target("avx2"))) inline __m256i
+check_block(__m256i input, __m256i prev_input) noexcept {
+  __m256i special = special_cases(input, prev<1>(input, prev_input));
+  // only 111_____ two bytes back and 1111____ three bytes back reach 0x80
+  __m256i third = _mm256_subs_epu8(prev<2>(input, prev_input),
+                                   _mm256_set1_epi8(0xE0 - 0x80));
+  __m256i fourth = _mm256_subs_epu8(prev<3>(input, prev_input),
+                                    _mm256_set1_epi8(0xF0 - 0x80));
+  __m256i must_continue = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                           _mm256_set1_epi8(char(0x80)));
+  return _mm256_xor_si256(must_continue, special);
+}
+
+// a lead byte in the last three positions still waits for continuations
+__attribute__((target("avx2"))) inline __m256i
+incomplete(__m256i input) noexcept {
+  const __m256i max_value = _mm256_setr_epi8(
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, char(0xF0 - 1),
+      char(0xE0 - 1), char(0xC0 - 1));
+  return _mm256_subs_epu8(input, max_value);
+}
+
+__attribute__((target("avx2"))) bool valid(const char *text,
+                                           std::size_t len) noexcept {
+  __m256i error = _mm256_setzero_si256();
+  __m256i prev_input = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  alignas(32) char tail[64];
+  for (std::size_t pos = 0; pos < len; pos += 64) {
+    const char *block = text + pos;
+    if (len - pos < 64) {
+      // zeros are ASCII, so a sequence cut off by the end still fails
+      std::memset(tail, 0, sizeof(tail));
+      std::memcpy(tail, block, len - pos);
+      block = tail;
+    }
+    __m256i first =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block));
+    __m256i second =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + 32));
+    if (_mm256_movemask_epi8(_mm256_or_si256(first, second)) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+      continue;
+    }
+    error = _mm256_or_si256(error, check_block(first, prev_input));
+    error = _mm256_or_si256(error, check_block(second, first));
+    prev_incomplete = incomplete(second);
+    prev_input = second;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+} // namespace lookup
+
+#endif // SNIP_UTF8_X86
+
+bool in_ranges(const UnicodeRange *first, const UnicodeRange *last,
+               char32_t cp) noexcept {
+  const UnicodeRange *range = std::upper_bound(
+      first, last, cp,
+      [](char32_t c, const UnicodeRange &r) { return c < r.first; });
+  return range != first && cp <= (range - 1)->last;
+}
+
+} // namespace
+
+std::size_t find_invalid_utf8(const char *text, std::size_t len) noexcept {
+  switch (get_scan_backend()) {
+#ifdef SNIP_UTF8_X86
+  case ScanBackend::AVX2:
+    // the lookup check only says whether there is an error, finding it
+    // again is left to the scalar path
+    if (lookup::valid(text, len)) {
+      return len;
+    }
+    return find_invalid_with<skip_ascii_sse2>(text, len);
+  case ScanBackend::SSE2:
+    return find_invalid_with<skip_ascii_sse2>(text, len);
+#endif
+  default:
+    return find_invalid_with<skip_ascii_scalar>(text, len);
+  }
+}
+
+char32_t decode_utf8(const char *text, std::size_t &i) noexcept {
+  unsigned char lead = byte_at(text, i);
+  if (lead < 0x80) {
+    i++;
+    return lead;
+  }
+  std::size_t need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : 2;
+  char32_t cp = lead & (0x7F >> need);
+  for (std::size_t k = 1; k < need; k++) {
+    cp = (cp << 6) | (byte_at(text, i + k) & 0x3F);
+  }
+  i += need;
+  return cp;
+}
+
+bool is_xid_start(char32_t cp) noexcept {
+  return in_ranges(std::begin(xid_start_ranges), std::end(xid_start_ranges),
+                   cp);
+}
+
+bool is_xid_continue(char32_t cp) noexcept {
+  return in_ranges(std::begin(xid_continue_ranges),
+                   std::end(xid_continue_ranges), cp);
+}
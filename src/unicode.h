@@ -0,0 +1,21 @@
+#ifndef UNICODE_H
+#define UNICODE_H
+
+#include <cstddef>
+
+// offset of the first byte in [0, len) that is not part of well-formed
+// UTF-8, or len when all of it is. runs of ASCII are skipped a vector at a
+// time, the AVX2 backend (see scan.h) checks multi-byte text with nibble
+// lookup tables instead of decoding it
+std::size_t find_invalid_utf8(const char *text, std::size_t len) noexcept;
+
+// code point at text[i], which has to start a well-formed sequence, i is
+// moved past it
+char32_t decode_utf8(const char *text, std::size_t &i) noexcept;
+
+// UAX #31 identifier properties of code points past ASCII, see
+// tools/gen_unicode_tables.py
+bool is_xid_start(char32_t cp) noexcept;
+bool is_xid_continue(char32_t cp) noexcept;
+
+#endif // !UNICODE_H
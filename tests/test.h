@@ -18,4 +18,6 @@ private:
   std::string result_recieved;
 };
 
+void run_lexer_tests();
+
 #endif // !TEST_LEXER
@@ -0,0 +1,708 @@
+#include "../src/helper.h"
+#include "../src/interner.h"
+#include "../src/lexer.h"
+#include "../src/scan.h"
+#include "../src/source.h"
+#include "../src/thread_pool.h"
+#include "../src/token_buffer.h"
+#include "../src/token_stream.h"
+#include "../src/unicode.h"
+#include "./test.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+std::string dump_tokens(Lexer &lex) {
+  TokenArray token_stack = nullptr;
+  lex.tokenize(token_stack);
+  std::stringstream ss;
+  int i{0};
+  while (token_stack[i].type != Token::END) {
+    ss << token_to_string(token_stack[i].type);
+    if (token_stack[i].type == Token::INT) {
+      ss << " " << std::get<int>(token_stack[i].value);
+    }
+    ss << std::endl;
+    i++;
+  }
+  return ss.str();
+}
+
+// token types plus integer values, so both recognizers are compared on
+// everything the parser consumes
+std::string lex_with_mode(const std::string &input, LexMode mode) {
+  Lexer lex(input, mode);
+  return dump_tokens(lex);
+}
+
+void test_keyword_table_matches_state_machine() {
+  // inputs the original State switch handles correctly, each word is
+  // terminated by every kind of delimiter the lexer knows about
+  const std::string inputs[] = {
+      "int a = 1; ",
+      "char c = 'c'; ",
+      "str s = \"text\"; ",
+      "bool b = t; bool c = f; ",
+      "if (a == b) { x = 10; } else { y = 20; } ",
+      "fn add : int (int a, int b) { !print(a); } ",
+      "iff in els elsee boolean chars fnx strs _a1 a_b_c Z9 ",
+      "9a 12 70 a$ if$ \n",
+      "x=1;y\ty\nz{w}(v)a,b:c.d*e+f-g/h;",
+      "# comment only\nint x = 3; # trailing\n ",
+  };
+  // named by index, some inputs hold newlines and tabs
+  std::size_t i{0};
+  for (const std::string &input : inputs) {
+    TestCase("keyword table matches State switch: input " + std::to_string(i++),
+             lex_with_mode(input, LexMode::STATE_MACHINE),
+             lex_with_mode(input, LexMode::TABLE))
+        .checkResult();
+  }
+}
+
+void test_keyword_table_words() {
+  // words the State switch never reached or looped on
+  std::string received =
+      lex_with_mode("while double elif < > <= >= && || ", LexMode::TABLE);
+  TestCase("keyword table recognizes every listed keyword",
+           "START\n"
+           "WHILE\n"
+           "DOUBLEK\n"
+           "ELIF\n"
+           "LESSERTHAN\n"
+           "GREATERTHAN\n"
+           "LESSTHANEQUAL\n"
+           "GREATERTHANEQUAL\n"
+           "AND\n"
+           "OR\n",
+           received)
+      .checkResult();
+  TestCase("keyword table rejects operator garbage", "START\nINVALID\n",
+           lex_with_mode("=> ", LexMode::TABLE))
+      .checkResult();
+}
+
+// every byte value at every offset of a vector, so both the SIMD body and
+// the scalar tail of each backend are exercised
+void test_scan_backends_classify_bytes() {
+  std::string buffer(80, 'a');
+  for (ScanBackend backend :
+       {ScanBackend::SCALAR, ScanBackend::SSE2, ScanBackend::AVX2}) {
+    if (!set_scan_backend(backend)) {
+      continue;
+    }
+    std::stringstream mismatches;
+    for (int c = 0; c < 256; c++) {
+      for (std::size_t pos : {0, 5, 15, 16, 31, 33, 70}) {
+        std::string scan(buffer);
+        scan[pos] = static_cast<char>(c);
+        std::size_t word_end = is_word_delimiter(scan[pos]) ? pos : scan.size();
+        if (scan_word(scan.data(), 0, scan.size()) != word_end ||
+            find_byte(scan.data(), 0, scan.size(), scan[pos]) !=
+                (c == 'a' ? 0 : pos) ||
+            count_byte(scan.data(), 1, scan.size(), scan[pos]) !=
+                (c == 'a' ? scan.size() - 1 : pos != 0)) {
+          mismatches << c << "@" << pos << " ";
+        }
+        std::string spaces(80, ' ');
+        spaces[pos] = static_cast<char>(c);
+        bool space = c == ' ' || c == '\t' || c == '\n';
+        if (scan_whitespace(spaces.data(), 0, spaces.size()) !=
+            (space ? spaces.size() : pos)) {
+          mismatches << c << "@" << pos << " ";
+        }
+      }
+    }
+    TestCase(std::string("scan backend classifies bytes: ") +
+                 scan_backend_name(backend),
+             "", mismatches.str())
+        .checkResult();
+  }
+  set_scan_backend(detect_scan_backend());
+}
+
+void test_scan_backends_same_tokens() {
+  const std::string input =
+      "int a_rather_long_identifier_that_spans_several_vectors = 1;\n"
+      "# a comment long enough to need more than one 32 byte block \"{\n"
+      "str s = \"a string literal with spaces ; { } # and more text\";\n"
+      "\t\t    \n\n      char c = 'x'; fn f : int () { }\n"
+      "x\"y\" trailing_word";
+  set_scan_backend(ScanBackend::SCALAR);
+  std::string expected = lex_with_mode(input, LexMode::TABLE);
+  for (ScanBackend backend : {ScanBackend::SSE2, ScanBackend::AVX2}) {
+    if (!set_scan_backend(backend)) {
+      continue;
+    }
+    TestCase(std::string("scan backend token stream: ") +
+                 scan_backend_name(backend),
+             expected, lex_with_mode(input, LexMode::TABLE))
+        .checkResult();
+  }
+  set_scan_backend(detect_scan_backend());
+}
+
+// every field of every token, or the error lexing stopped at
+std::string lex_every_field(const std::string &input) {
+  std::stringstream ss;
+  try {
+    TokenArray token_stack = nullptr;
+    Lexer lex(input);
+    lex.tokenize(token_stack);
+    for (std::size_t i = 0; token_stack[i].type != Token::END; i++) {
+      ss << token_to_string(token_stack[i].type) << " "
+         << token_stack[i].value << " " << token_stack[i].offset << "\n";
+    }
+  } catch (const std::exception &e) {
+    ss << "error: " << e.what();
+  }
+  return ss.str();
+}
+
+// random inputs built from pieces of the language, runs of whitespace and
+// words long enough to cross vectors, and literals and comments left open.
+// every backend has to lex them exactly like the scalar scanners
+void test_scan_backends_random_inputs() {
+  const std::string pieces[] = {
+      "int",  "x",   "a_long_identifier_name", "12",    "3.5", "if",
+      "else", "==",  "&&",  "{",  "}",  "(",  ")",  ";",   ",",   ":",
+      ".",    "*",   "+",   "-",  "/",  "!",  "!=", "'c'", "\"", "#",
+      " ",    "\t", "\n", "                                  ", "\xc3\xa9",
+  };
+  std::vector<std::string> inputs;
+  std::uint32_t seed = 3;
+  for (int i = 0; i < 400; i++) {
+    std::string input = "x";
+    seed = seed * 1103515245 + 12345;
+    int count = static_cast<int>((seed >> 16) % 80);
+    for (int j = 0; j < count; j++) {
+      seed = seed * 1103515245 + 12345;
+      input += pieces[(seed >> 16) % std::size(pieces)];
+    }
+    inputs.push_back(input);
+  }
+  set_scan_backend(ScanBackend::SCALAR);
+  std::vector<std::string> expected;
+  for (const std::string &input : inputs) {
+    expected.push_back(lex_every_field(input));
+  }
+  for (ScanBackend backend : {ScanBackend::SSE2, ScanBackend::AVX2}) {
+    if (!set_scan_backend(backend)) {
+      continue;
+    }
+    std::stringstream mismatches;
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+      if (lex_every_field(inputs[i]) != expected[i]) {
+        mismatches << i << " ";
+      }
+    }
+    TestCase(std::string("scan backend random inputs: ") +
+                 scan_backend_name(backend),
+             "", mismatches.str())
+        .checkResult();
+  }
+  set_scan_backend(detect_scan_backend());
+}
+
+void test_mapped_source() {
+  // exactly one page, so a read past the end of the mapping would fault
+  std::string input = "int x = 1;\n";
+  input += std::string(4096 - input.size() - 3, ' ') + "abc";
+  std::string path = "tests/mapped_source.snip";
+  std::ofstream(path) << input;
+  {
+    SourceBuffer source = SourceBuffer::open(path);
+    TestCase("mapped source is mapped", "1",
+             std::to_string(source.is_mapped()))
+        .checkResult();
+    Lexer lex(source);
+    TestCase("mapped source tokens", lex_with_mode(input, LexMode::TABLE),
+             dump_tokens(lex))
+        .checkResult();
+  }
+  std::remove(path.c_str());
+}
+
+void test_compressed_source() {
+  std::string input;
+  for (int i = 0; i < 20000; i++) {
+    input += "int x" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  }
+  // two members, so the output has to grow past the size the trailer gives
+  std::string path = "tests/compressed_source.snip.gz";
+  std::size_t half = input.size() / 2 + 3;
+  for (const char *mode : {"wb", "ab"}) {
+    std::string part =
+        mode[0] == 'w' ? input.substr(0, half) : input.substr(half);
+    gzFile out = gzopen(path.c_str(), mode);
+    gzwrite(out, part.data(), static_cast<unsigned>(part.size()));
+    gzclose(out);
+  }
+  {
+    SourceBuffer source = SourceBuffer::open(path);
+    TestCase("gzip source is decompressed", "true",
+             source.view() == input ? "true" : "false")
+        .checkResult();
+    Lexer lex(source);
+    TestCase("gzip source tokens", lex_with_mode(input, LexMode::TABLE),
+             dump_tokens(lex))
+        .checkResult();
+  }
+  // cut in the middle of the second member
+  std::stringstream bytes;
+  bytes << std::ifstream(path, std::ios::binary).rdbuf();
+  std::ofstream(path, std::ios::binary)
+      << bytes.str().substr(0, bytes.str().size() - 100);
+  std::string error;
+  try {
+    SourceBuffer::open(path);
+  } catch (const std::runtime_error &e) {
+    error = e.what();
+  }
+  TestCase("truncated gzip source", path + ": truncated gzip data", error)
+      .checkResult();
+  std::remove(path.c_str());
+}
+
+void test_streamed_source() {
+  // random names barely compress, so the file takes several blocks and
+  // strings with newlines in them run across the ends of blocks
+  std::string input;
+  std::uint32_t seed = 7;
+  while (input.size() < (std::size_t{6} << 20)) {
+    std::string name;
+    for (int i = 0; i < 12; i++) {
+      seed = seed * 1103515245 + 12345;
+      name += static_cast<char>('a' + (seed >> 16) % 26);
+    }
+    input += (seed >> 8) % 4 == 0 ? "str " + name + " = \"" + name + "\n" +
+                                        name + "\";\n"
+                                  : "int " + name + " = 'x';\n";
+  }
+  std::string path = "tests/streamed_source.snip.gz";
+  gzFile out = gzopen(path.c_str(), "wb");
+  gzwrite(out, input.data(), static_cast<unsigned>(input.size()));
+  gzclose(out);
+  {
+    SourceBuffer source = SourceBuffer::open_stream(path);
+    TestCase("streamed source starts partial", "false",
+             source.complete() ? "true" : "false")
+        .checkResult();
+    Lexer lex(source);
+    TestCase("streamed source tokens", lex_with_mode(input, LexMode::TABLE),
+             dump_tokens(lex))
+        .checkResult();
+    TestCase("streamed source is complete after lexing", "true",
+             source.complete() && source.view() == input ? "true" : "false")
+        .checkResult();
+  }
+  std::remove(path.c_str());
+#ifndef SNIP_HAVE_ZSTD
+  path = "tests/streamed_source.snip.zst";
+  std::ofstream(path, std::ios::binary) << "\x28\xB5\x2F\xFD"
+                                           "0000";
+  std::string error;
+  try {
+    SourceBuffer::open_stream(path);
+  } catch (const std::runtime_error &e) {
+    error = e.what();
+  }
+  TestCase("zstd source without zstd support",
+           path + ": zstd support not built, rebuild with make ZSTD=1", error)
+      .checkResult();
+  std::remove(path.c_str());
+#endif
+}
+
+void test_line_index() {
+  std::string text = "ab\n\ncd\n" + std::string(100, 'x') + "\nlast";
+  LineIndex lines(text);
+  TestCase("line index is built lazily", "false",
+           lines.built() ? "true" : "false")
+      .checkResult();
+  std::stringstream ss;
+  for (std::size_t offset : {std::size_t{0}, std::size_t{1}, std::size_t{2},
+                             std::size_t{3}, std::size_t{4}, std::size_t{106},
+                             std::size_t{108}, text.size(), text.size() + 9}) {
+    SourceLocation loc = lines.locate(offset);
+    ss << loc.line << ":" << loc.column << " ";
+  }
+  TestCase("line index resolves offsets",
+           "1:1 1:2 1:3 2:1 3:1 4:100 5:1 5:5 5:5 ", ss.str())
+      .checkResult();
+  TestCase("line index counts lines", "5 true",
+           std::to_string(lines.line_count()) + " " +
+               (lines.built() ? "true" : "false"))
+      .checkResult();
+}
+
+void test_next_token_matches_tokenize() {
+  std::string input = "int a = 12; # note\nstr s = \"x y\";\n"
+                      "if (a >= 3) { b = a * (2 + c); } char k = 'k';  w";
+  Lexer batch(input);
+  std::string expected = dump_tokens(batch);
+  Lexer stream(input);
+  std::stringstream ss;
+  TokenChunk tok = stream.next_token();
+  ss << token_to_string(tok.type) << std::endl;
+  for (tok = stream.next_token(); tok.type != Token::END;
+       tok = stream.next_token()) {
+    ss << token_to_string(tok.type);
+    if (tok.type == Token::INT) {
+      ss << " " << std::get<int>(tok.value);
+    }
+    ss << std::endl;
+  }
+  TestCase("next_token matches tokenize", expected, ss.str()).checkResult();
+  TestCase("next_token repeats END", "END",
+           token_to_string(stream.next_token().type))
+      .checkResult();
+}
+
+std::string dump_tokens_with_values(TokenArray &tokens) {
+  std::stringstream ss;
+  for (std::size_t i = 1; tokens[i].type != Token::END; i++) {
+    ss << token_to_string(tokens[i].type) << " " << tokens[i].value << " "
+       << tokens[i].sym << std::endl;
+  }
+  return ss.str();
+}
+
+void test_parallel_tokenize() {
+  // chunks start on newlines inside strings, char literals and comments,
+  // the fix-up pass has to relex those. large enough that chunks hold
+  // several checkpoints
+  std::string piece = "int a = 1;\nstr s = \"one\ntwo\n\nthree\";\n"
+                      "char c = '\n'; # \" not a string\n"
+                      "if (a >= 2) {\n  a = a + 10;\n}\n";
+  std::string input;
+  for (int i = 0; i < 400; i++) {
+    input += piece;
+  }
+  input += "x";
+  TokenArray sequential = nullptr;
+  Lexer lex(input);
+  lex.tokenize(sequential);
+  std::string expected = dump_tokens_with_values(sequential);
+  for (std::size_t threads : {2, 3, 4}) {
+    ThreadPool pool(threads);
+    for (std::size_t chunk_bytes : {1, 7, 10000}) {
+      TokenArray parallel = nullptr;
+      Lexer chunked(input);
+      chunked.tokenize(parallel, pool, chunk_bytes);
+      TestCase("parallel tokenize: " + std::to_string(threads) +
+                   " threads, " + std::to_string(chunk_bytes) + " bytes",
+               expected, dump_tokens_with_values(parallel))
+          .checkResult();
+    }
+  }
+}
+
+void test_interned_symbols() {
+  Interner names;
+  std::uint32_t a = names.intern("alpha");
+  std::uint32_t b = names.intern("beta");
+  std::string long_name(100000, 'x');
+  std::uint32_t c = names.intern(long_name);
+  TestCase("interner ids are dense", "0 1 2 3",
+           std::to_string(a) + " " + std::to_string(b) + " " +
+               std::to_string(c) + " " + std::to_string(names.size()))
+      .checkResult();
+  TestCase("interner returns the same id", std::to_string(a),
+           std::to_string(names.intern(std::string("alpha"))))
+      .checkResult();
+  TestCase("interner keeps names", "beta " + long_name,
+           std::string(names.name(b)) + " " + std::string(names.name(c)))
+      .checkResult();
+
+  std::string input = "int count = 1; str s = \"count\"; count = other; x";
+  TokenArray token_stack = nullptr;
+  Lexer lex(input);
+  lex.tokenize(token_stack);
+  std::stringstream ss;
+  for (std::size_t i = 1; token_stack[i].type != Token::END; i++) {
+    if (token_stack[i].sym != no_symbol) {
+      ss << token_to_string(token_stack[i].type) << " "
+         << token_stack[i].sym << std::endl;
+    }
+  }
+  TestCase("lexer interns identifiers and strings",
+           "IDENTIFIER 0\nIDENTIFIER 1\nSTRING 0\nIDENTIFIER 0\n"
+           "IDENTIFIER 2\n",
+           ss.str())
+      .checkResult();
+}
+
+void test_token_buffer() {
+  TokenBuffer buffer(estimate_token_count(std::size_t{1} << 30));
+  TestCase("token estimate is capped", "1048576",
+           std::to_string(buffer.capacity()))
+      .checkResult();
+  for (int i = 0; i < 100; i++) {
+    buffer.push({Token::INT, i, no_symbol, static_cast<std::size_t>(i)});
+  }
+  buffer.shrink_to_fit();
+  TestCase("token buffer shrinks to its size", "100",
+           std::to_string(buffer.capacity()))
+      .checkResult();
+  TokenArray tokens = buffer.release();
+  TestCase("token buffer keeps tokens when shrunk", "0 99 99",
+           std::to_string(buffer.size()) + " " +
+               std::to_string(std::get<int>(tokens[99].value)) + " " +
+               std::to_string(tokens[99].offset))
+      .checkResult();
+}
+
+void test_token_stream() {
+  std::string input = "int a = 1; double d = 2.5; str s = \"hi there\";\n"
+                      "char c = 'x'; if (a != 3) { a = a + 1; } bool b = t;\n"
+                      "# comment\nfn f : int (int x) { ret x; } ab\"q\" z";
+  TokenArray token_stack = nullptr;
+  Lexer array_lex(input);
+  array_lex.tokenize(token_stack);
+  TokenStream tokens;
+  Lexer stream_lex(input);
+  stream_lex.tokenize(tokens);
+
+  std::stringstream expected, received, random_access;
+  std::size_t payload{0};
+  for (std::size_t i = 0; i < tokens.size(); i++) {
+    TokenChunk tok = tokens.token(i, payload);
+    payload += token_has_payload(tok.type);
+    received << token_to_string(tok.type) << " " << tok.value << " "
+             << tok.sym << " " << tok.offset << std::endl;
+    TokenChunk again = tokens.token(i);
+    random_access << token_to_string(again.type) << " " << again.value << " "
+                  << again.sym << " " << again.offset << std::endl;
+  }
+  for (std::size_t i = 0;; i++) {
+    expected << token_to_string(token_stack[i].type) << " "
+             << token_stack[i].value << " " << token_stack[i].sym << " "
+             << token_stack[i].offset << std::endl;
+    if (token_stack[i].type == Token::END) {
+      break;
+    }
+  }
+  TestCase("token stream decodes the lexed tokens", expected.str(),
+           received.str())
+      .checkResult();
+  TestCase("token stream random access", expected.str(), random_access.str())
+      .checkResult();
+  TestCase("token stream reads END past the end", "END",
+           token_to_string(tokens.kind(tokens.size() + 5)))
+      .checkResult();
+
+  std::size_t count = tokens.size();
+  TestCase("token stream is smaller than the token array", "true",
+           tokens.memory_bytes() * 3 < count * sizeof(TokenChunk) ? "true"
+                                                                  : "false")
+      .checkResult();
+
+  // offsets are stored as 32 bits plus the places where they wrap
+  TokenStream far;
+  std::size_t gb4 = std::size_t{1} << 32;
+  std::size_t offsets[] = {0, 7, gb4 - 1, gb4 + 3, 3 * gb4 + 9, 3 * gb4 + 9};
+  std::stringstream far_expected, far_received;
+  for (std::size_t offset : offsets) {
+    far.push({Token::INT, 1, no_symbol, offset});
+    far_expected << offset << " ";
+  }
+  for (std::size_t i = 0; i < far.size(); i++) {
+    far_received << far.offset(i) << " ";
+  }
+  TestCase("token stream offsets past 4 GB", far_expected.str(),
+           far_received.str())
+      .checkResult();
+}
+
+std::string dump_stream(const TokenStream &tokens) {
+  std::stringstream ss;
+  for (std::size_t i = 0; i < tokens.size(); i++) {
+    TokenChunk tok = tokens.token(i);
+    ss << token_to_string(tok.type) << " " << tok.value << " " << tok.sym
+       << " " << tok.offset << std::endl;
+  }
+  return ss.str();
+}
+
+void test_relex() {
+  std::string piece = "int a = 1;\nstr s = \"one two\";\ndouble d = 2.5;\n"
+                      "# a \" comment\nif (a >= 2) {\n  a = a + 10;\n}\n";
+  std::string source;
+  for (int i = 0; i < 200; i++) {
+    source += piece;
+  }
+  // an edit inside a word, one opening a string and one closing it again,
+  // a comment swallowing a line, and edits at both ends
+  std::size_t middle = source.size() / 2;
+  SourceEdit edits[] = {{4, 1, "abc"},
+                        {middle, 0, "\""},
+                        {middle + 40, 0, "\""},
+                        {middle, 0, "# "},
+                        {0, 3, "char"},
+                        {source.size() - 3, 3, " x = 3.25;\n"}};
+  std::vector<std::unique_ptr<Lexer>> versions;
+  versions.push_back(std::make_unique<Lexer>(source));
+  TokenStream tokens;
+  versions.back()->tokenize(tokens);
+  std::shared_ptr<Interner> names = versions.back()->get_interner();
+  std::size_t edit_number{0};
+  for (const SourceEdit &edit : edits) {
+    source = apply_edit(source, edit);
+    versions.push_back(std::make_unique<Lexer>(source));
+    versions.back()->set_interner(names);
+    std::size_t lexed = versions.back()->relex(tokens, edit);
+    Lexer full(source);
+    full.set_interner(names);
+    TokenStream expected;
+    full.tokenize(expected);
+    std::string name = "relex edit " + std::to_string(edit_number++);
+    TestCase(name, dump_stream(expected), dump_stream(tokens)).checkResult();
+    TestCase(name + " stays local", "true",
+             lexed * 10 < expected.size() ? "true" : "false")
+        .checkResult();
+  }
+}
+
+void test_utf8_validation() {
+  struct Utf8Case {
+    std::string text;
+    std::size_t invalid; // npos when well-formed
+  };
+  const std::size_t ok = std::string::npos;
+  const Utf8Case cases[] = {
+      {"gr\xC3\xB6\xC3\x9F" "e", ok},        {"\xE2\x82\xAC", ok},
+      {"\xF0\x9F\x98\x80", ok},              {"\xF4\x8F\xBF\xBF", ok},
+      {"\xED\x9F\xBF", ok},                  {"\xC0\xAF", 0},
+      {"\xC1\xBF", 0},                       {"\xE0\x80\xAF", 0},
+      {"\xF0\x80\x80\xAF", 0},               {"\xED\xA0\x80", 0},
+      {"\xF4\x90\x80\x80", 0},               {"\xF5\x80\x80\x80", 0},
+      {"\x80", 0},                           {"a\xBF", 1},
+      {"\xC3" "a", 0},                       {"\xE2\x82" "a", 0},
+      {"\xF0\x9F\x98" "a", 0},               {"\xC3\xA9\xA9", 2},
+      {"\xF8\x88\x80\x80\x80", 0},           {"\xFF", 0},
+  };
+  // the same cases at every offset around the 32 and 64 byte blocks
+  std::string pad(130, 'x');
+  std::stringstream mismatches;
+  std::vector<std::string> inputs;
+  std::vector<std::size_t> expected;
+  for (const Utf8Case &c : cases) {
+    for (std::size_t at : {0, 1, 29, 30, 31, 32, 62, 63, 64, 100, 127}) {
+      for (bool tail : {false, true}) {
+        inputs.push_back(pad.substr(0, at) + c.text +
+                         (tail ? pad.substr(0, 40) : ""));
+        expected.push_back(c.invalid == ok ? inputs.back().size()
+                                           : at + c.invalid);
+      }
+    }
+  }
+  // and random mixes of ASCII, well-formed and broken sequences, checked
+  // against the scalar backend
+  const char *pieces[] = {"a", " ", "\xC3\xA9", "\xE2\x82\xAC",
+                          "\xF0\x9F\x98\x80", "\xE0", "\x80", "\xED\xA0"};
+  std::uint64_t seed = 7;
+  for (int i = 0; i < 400; i++) {
+    std::string text;
+    while (text.size() < 200) {
+      seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+      // mostly well-formed, so the errors land at different depths
+      std::size_t pick = (seed >> 33) % 64;
+      text += pieces[pick < 60 ? pick % 5 : pick - 55];
+    }
+    inputs.push_back(text);
+    set_scan_backend(ScanBackend::SCALAR);
+    expected.push_back(find_invalid_utf8(text.data(), text.size()));
+  }
+  for (ScanBackend backend :
+       {ScanBackend::SCALAR, ScanBackend::SSE2, ScanBackend::AVX2}) {
+    if (!set_scan_backend(backend)) {
+      continue;
+    }
+    for (std::size_t i = 0; i < inputs.size(); i++) {
+      if (find_invalid_utf8(inputs[i].data(), inputs[i].size()) !=
+          expected[i]) {
+        mismatches << scan_backend_name(backend) << "#" << i << " ";
+      }
+    }
+  }
+  set_scan_backend(detect_scan_backend());
+  TestCase("utf-8 validation on every backend", "", mismatches.str())
+      .checkResult();
+}
+
+void test_unicode_identifiers() {
+  const std::string input = "int gr\xC3\xB6\xC3\x9F" "e = 1;\n"
+                            "str \xE5\x90\x8D\xE5\x89\x8D = \"caf\xC3\xA9 "
+                            "\xE2\x9C\x93\";\n"
+                            "\xCE\xBB_2 = x\xCC\x81 + _\xC3\xA9;\n"
+                            "\xE2\x82\xAC = 2; a\xE2\x82\xAC = 3;\n";
+  std::string expected;
+  for (LexMode mode : {LexMode::TABLE, LexMode::STATE_MACHINE}) {
+    Lexer lex(input, mode);
+    TokenStream tokens;
+    lex.tokenize(tokens);
+    std::stringstream ss;
+    for (std::size_t i = 1; i + 1 < tokens.size(); i++) {
+      TokenChunk tok = tokens.token(i);
+      if (tok.type == Token::IDENTIFIER || tok.type == Token::STRING ||
+          tok.type == Token::INVALID) {
+        ss << token_to_string(tok.type) << " " << tok.value << std::endl;
+      }
+    }
+    if (mode == LexMode::TABLE) {
+      expected = ss.str();
+      continue;
+    }
+    TestCase("unicode identifiers match in both modes", expected, ss.str())
+        .checkResult();
+  }
+  // a combining mark continues an identifier but can't start one, and a
+  // symbol like the euro sign is neither
+  TestCase("unicode identifiers",
+           "IDENTIFIER gr\xC3\xB6\xC3\x9F" "e\n"
+           "IDENTIFIER \xE5\x90\x8D\xE5\x89\x8D\n"
+           "STRING caf\xC3\xA9 \xE2\x9C\x93\n"
+           "IDENTIFIER \xCE\xBB_2\nIDENTIFIER x\xCC\x81\n"
+           "IDENTIFIER _\xC3\xA9\nINVALID \xE2\x82\xAC\n"
+           "INVALID a\xE2\x82\xAC\n",
+           expected)
+      .checkResult();
+
+  std::string error;
+  try {
+    Lexer lex("int a = 1;\nstr s = \"ok\xE2\x82\";\n");
+    TokenStream tokens;
+    lex.tokenize(tokens);
+  } catch (const std::runtime_error &e) {
+    error = e.what();
+  }
+  TestCase("invalid utf-8 is reported", "2:12: invalid UTF-8", error)
+      .checkResult();
+}
+
+void run_lexer_tests() {
+  test_keyword_table_matches_state_machine();
+  test_keyword_table_words();
+  test_scan_backends_classify_bytes();
+  test_scan_backends_same_tokens();
+  test_scan_backends_random_inputs();
+  test_utf8_validation();
+  test_unicode_identifiers();
+  test_mapped_source();
+  test_compressed_source();
+  test_streamed_source();
+  test_line_index();
+  test_next_token_matches_tokenize();
+  test_parallel_tokenize();
+  test_interned_symbols();
+  test_token_buffer();
+  test_token_stream();
+  test_relex();
+}
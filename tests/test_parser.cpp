@@ -1,35 +1,778 @@
+#include "../src/ast.h"
+#include "../src/batch.h"
+#include "../src/diagnostics.h"
+#include "../src/expr_pool.h"
+#include "../src/fd_writer.h"
+#include "../src/flat_tree.h"
 #include "../src/helper.h"
+#include "../src/interner.h"
 #include "../src/lexer.h"
+#include "../src/memory_stats.h"
 #include "../src/parser.h"
+#include "../src/semantic.h"
+#include "../src/thread_pool.h"
+#include "../src/token_stream.h"
+#include "../src/tree_cache.h"
 #include "./test.h"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <sstream>
 
 void test_parser_tree() {
   ParserTokenChunk p1 = {ParserToken::IF, 0};
   ParserTokenChunk p2 = {ParserToken::AND, 0};
   ParserTokenChunk p3 = {ParserToken::OR, 0};
   ParserTokenChunk p4 = {ParserToken::ELSE, 0};
-  PTNode pn1(p1);
-  pn1.add_child(p2);
-  pn1.add_child(p3);
-  pn1.add_child(p4);
-  std::string a = pn1.output();
+  ParseTree tree;
+  PTNode *pn1 = tree.make_node(p1);
+  pn1->add_child(tree.make_node(p2));
+  pn1->add_child(tree.make_node(p3));
+  pn1->add_child(tree.make_node(p4));
+  std::string a = pn1->output();
   TestCase("ParserTree output", a, "IF\n  AND\n  OR\n  ELSE\n").checkResult();
 }
 
 std::string lex_and_parse_input(std::string input) {
-  std::unique_ptr<TokenChunk[]> token_stack = nullptr;
+  TokenArray token_stack = nullptr;
   Lexer lex(input);
   lex.tokenize(token_stack);
 
   Parser parser(token_stack);
-  std::unique_ptr<PTNode> parsed_tokens = nullptr;
+  ParseTree parsed_tokens;
   parser.parse(parsed_tokens);
 
   return parser.output_tree_as_str();
 }
 
+void test_streaming_parse() {
+  std::string input = "int a = 1 + 2 * 3; str s = \"s\"; char c = 'c';\n"
+                      "b = a - 4 / 2; ";
+  Lexer lex(input);
+  Parser parser(lex);
+  ParseTree parsed_tokens;
+  parser.parse(parsed_tokens);
+  TestCase("streaming parse matches batch parse", lex_and_parse_input(input),
+           parser.output_tree_as_str())
+      .checkResult();
+}
+
+void test_token_stream_parse() {
+  std::string input = "int a = 1 + 2 * 3; str s = \"s\"; char c = 'c';\n"
+                      "double d = 2.5; b = a - 4 / 2; ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  Parser parser(tokens);
+  ParseTree parsed_tokens;
+  parser.parse(parsed_tokens);
+  TestCase("token stream parse matches batch parse",
+           lex_and_parse_input(input), parser.output_tree_as_str())
+      .checkResult();
+}
+
+void test_parse_error_location() {
+  std::string input = "int a = 1;\n  x y;";
+  std::string located;
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  Parser parser(tokens);
+  ParseTree parsed_tokens;
+  try {
+    parser.parse(parsed_tokens);
+  } catch (const std::runtime_error &e) {
+    located = e.what();
+  }
+  TestCase("parse errors carry line and column",
+           "2:3: parse() expects a variable declaration", located)
+      .checkResult();
+}
+
+void test_error_recovery() {
+  std::string input = "int a = 1;\n  x y;\nb = (1 + ;\n"
+                      "if (a) { c = 2 3; d = 4; }\ne = 5;\n}\ng = 6 ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree tree;
+  Parser parser(tokens);
+  DiagnosticBuffer diagnostics("e.snip");
+  std::size_t errors = parser.parse(tree, diagnostics);
+  TestCase("recovered parse reports every error",
+           "5\n"
+           "e.snip:2:3: error: parse() expects a variable declaration\n"
+           "e.snip:3:10: error: expected an expression\n"
+           "e.snip:4:16: error: Assignment expects a semicolon\n"
+           "e.snip:6:1: error: Stmt type not recognized\n"
+           "e.snip:7:7: error: unexpected end of input\n",
+           std::to_string(errors) + "\n" +
+               diagnostics.format(DiagnosticFormat::TEXT))
+      .checkResult();
+  // the broken statements are left out, the rest is parsed
+  std::string kept;
+  for (PTNode *stmt = tree.root()->get_first_child(); stmt != nullptr;
+       stmt = stmt->get_next_sibling()) {
+    kept += stmt->get_first_child()->get_type() + " ";
+  }
+  TestCase("recovered parse keeps the good statements",
+           "VARDECL IFSTMT ASSIGNSTMT ", kept)
+      .checkResult();
+  std::string json = diagnostics.format(DiagnosticFormat::JSON);
+  TestCase("diagnostics as json",
+           "{\"file\": \"e.snip\", \"line\": 2, \"column\": 3, \"severity\": "
+           "\"error\", \"message\": \"parse() expects a variable "
+           "declaration\"}\n",
+           json.substr(0, json.find('\n') + 1))
+      .checkResult();
+  // -d takes only the two formats, a typo is an error and not text
+  char arg0[] = "snip", d_flag[] = "-d", json_arg[] = "json",
+       typo_arg[] = "jsno";
+  char *json_argv[] = {arg0, d_flag, json_arg};
+  char *typo_argv[] = {arg0, d_flag, typo_arg};
+  Flags json_flags = get_flags(3, json_argv);
+  Flags typo_flags = get_flags(3, typo_argv);
+  TestCase("-d json", "1 ",
+           std::to_string(json_flags.diagnostics == DiagnosticFormat::JSON) +
+               " " + json_flags.error)
+      .checkResult();
+  TestCase("-d rejects other formats", "-d expects text or json, not jsno",
+           typo_flags.error)
+      .checkResult();
+}
+
+void test_lazy_fn_bodies() {
+  std::string input = "int a = 1;\n"
+                      "fn g : int (int x) { x = x - 1; if (x) { x = 2; } }\n"
+                      "fn h : int (int z, char y) { z = z + 1; }\n"
+                      "a = 2;\n ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree eager;
+  Parser eager_parser(tokens);
+  eager_parser.parse(eager);
+  ParseTree lazy;
+  Parser parser(tokens);
+  parser.set_lazy_fn_bodies(true);
+  parser.parse(lazy);
+  std::vector<PTNode *> fns;
+  std::size_t skipped = 0;
+  PTNodeWalk walk(lazy.root());
+  while (PTNode *node = walk.next()) {
+    if (node->get_val()->type == ParserToken::FNDECL) {
+      fns.push_back(node);
+    }
+    skipped += node->get_val()->type == ParserToken::LAZYBODY;
+  }
+  TestCase("lazy parse skips fn bodies", "2 2 44 84",
+           std::to_string(fns.size()) + " " + std::to_string(skipped) + " " +
+               std::to_string(lazy.node_count()) + " " +
+               std::to_string(eager.node_count()))
+      .checkResult();
+
+  // bodies are parsed in any order, once
+  ParseResult second = parser.parse_fn_body(fns[1]);
+  ParseResult first = parser.parse_fn_body(fns[0]);
+  ParseResult again = parser.parse_fn_body(fns[0]);
+  TestCase("bodies parsed on first use", "1",
+           std::to_string(second && first && again && *first == *again))
+      .checkResult();
+  TestCase("lazily parsed tree matches the eager one", eager.root()->output(),
+           lazy.root()->output())
+      .checkResult();
+
+  // a broken body only fails once it is parsed, a missing brace at once
+  std::string broken = "fn g : int (int x) { x = ; }\nb = 1;\n ";
+  TokenStream broken_tokens;
+  Lexer broken_lex(broken);
+  broken_lex.tokenize(broken_tokens);
+  ParseTree broken_tree;
+  Parser broken_parser(broken_tokens);
+  broken_parser.set_lazy_fn_bodies(true);
+  broken_parser.parse(broken_tree);
+  PTNode *fn = broken_tree.root()->get_first_child()->get_first_child();
+  ParseResult body = broken_parser.parse_fn_body(fn);
+  TestCase("broken fn body fails when parsed",
+           "1:26: expected an expression",
+           body ? std::string("parsed") : to_string(body.error()))
+      .checkResult();
+  std::string unclosed = "fn g : int (int x) { x = 1;\n ";
+  TokenStream unclosed_tokens;
+  Lexer unclosed_lex(unclosed);
+  unclosed_lex.tokenize(unclosed_tokens);
+  ParseTree unclosed_tree;
+  Parser unclosed_parser(unclosed_tokens);
+  unclosed_parser.set_lazy_fn_bodies(true);
+  std::string message;
+  try {
+    unclosed_parser.parse(unclosed_tree);
+  } catch (const std::runtime_error &e) {
+    message = e.what();
+  }
+  TestCase("unclosed fn body fails the lazy parse",
+           "2:2: unexpected end of input", message)
+      .checkResult();
+}
+
+void test_shared_exprs() {
+  std::string input = "a = (x + y) * 2; b = (x + y) * 2; c = x + y;\n ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ExprPool exprs;
+  ParseTree tree;
+  Parser parser(tokens);
+  parser.set_expr_pool(&exprs);
+  parser.parse(tree);
+  std::vector<ExprId> ids;
+  PTNodeWalk walk(tree.root());
+  while (PTNode *node = walk.next()) {
+    if (node->get_val()->type == ParserToken::EXPR) {
+      ids.push_back(std::get<int>(node->get_val()->value));
+    }
+  }
+  TestCase("identical expressions share an id", "3 1 27 12",
+           std::to_string(ids.size()) + " " +
+               std::to_string(ids[0] == ids[1]) + " " +
+               std::to_string(exprs.interned()) + " " +
+               std::to_string(exprs.size()))
+      .checkResult();
+  // EXPR[BINOP[group, INT, MULTIPLY]]
+  ExprId group = exprs.operand(exprs.operand(ids[0], 0), 0);
+  TestCase("shared expression output",
+           "EXPR\n  LEFTPARENTHESIS\n    BINOP\n      IDENTIFIER\n"
+           "      IDENTIFIER\n      ADD\n  RIGHTPARENTHESIS\n",
+           exprs.output(group))
+      .checkResult();
+  // x + y inside the parentheses is the same node as c's
+  TestCase("shared subexpression", "1",
+           std::to_string(exprs.operand(exprs.operand(group, 0), 0) ==
+                          exprs.operand(ids[2], 0)))
+      .checkResult();
+
+  // a pass computes once per distinct subtree
+  ExprMemo<std::size_t> nodes(exprs);
+  std::function<std::size_t(ExprId)> count = [&](ExprId id) {
+    std::size_t total = 1;
+    for (std::size_t i = 0; i < exprs.operand_count(id); i++) {
+      total += nodes.get(exprs.operand(id, i), count);
+    }
+    return total;
+  };
+  std::string sizes;
+  for (ExprId id : ids) {
+    sizes += std::to_string(nodes.get(id, count)) + " ";
+  }
+  TestCase("memoized pass over shared expressions", "11 11 5 12",
+           sizes + std::to_string(nodes.computed_count()))
+      .checkResult();
+}
+
+void test_lowering() {
+  std::string input = "int a = (1 + b) * -c; str s;\n"
+                      "while (a > 1) { a = a - 1; if (a) { !g(a, 2); } }\n"
+                      "fn g : int (int x, char y) { x = !x; }\n ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  std::string ast_text;
+  std::size_t parse_nodes = 0;
+  std::size_t ast_nodes = 0;
+  {
+    ParseTree tree;
+    Parser parser(tokens);
+    parser.parse(tree);
+    parse_nodes = tree.node_count();
+    SemanticAnalyzer analyzer(tree);
+    analyzer.analyze();
+    // the AST is all that's left once the tree is gone
+    ASTRoot ast = analyzer.get_ast();
+    ast_nodes = ast.size();
+    ast_text = ast.output();
+  }
+  TestCase("lowered AST",
+           "VAR_DECL INTK a\n"
+           "  BINARY MULTIPLY\n"
+           "    BINARY ADD\n"
+           "      LITERAL INT 1\n"
+           "      NAME b\n"
+           "    UNARY SUBTRACT\n"
+           "      NAME c\n"
+           "VAR_DECL STRINGK s\n"
+           "WHILE\n"
+           "  BINARY GREATERTHAN\n"
+           "    NAME a\n"
+           "    LITERAL INT 1\n"
+           "  ASSIGN a\n"
+           "    BINARY SUBTRACT\n"
+           "      NAME a\n"
+           "      LITERAL INT 1\n"
+           "  IF\n"
+           "    NAME a\n"
+           "    CALL g\n"
+           "      NAME a\n"
+           "      LITERAL INT 2\n"
+           "FN_DECL INTK g\n"
+           "  VAR_DECL INTK x\n"
+           "  VAR_DECL CHARK y\n"
+           "  ASSIGN x\n"
+           "    UNARY EXCLAIM\n"
+           "      NAME x\n",
+           ast_text)
+      .checkResult();
+  TestCase("lowering drops the syntax nodes", "27 96",
+           std::to_string(ast_nodes) + " " + std::to_string(parse_nodes))
+      .checkResult();
+
+  // a body left unparsed can't be lowered
+  ParseTree lazy;
+  Parser parser(tokens);
+  parser.set_lazy_fn_bodies(true);
+  parser.parse(lazy);
+  std::string message;
+  try {
+    lower(FlatTree(lazy));
+  } catch (const std::runtime_error &e) {
+    message = e.what();
+  }
+  TestCase("lowering needs parsed bodies", "lower: a fn body wasn't parsed",
+           message)
+      .checkResult();
+
+  // unless the parser is there to parse it when lowering gets to it
+  SemanticAnalyzer lazy_analyzer(lazy, parsed_fn_bodies(parser));
+  lazy_analyzer.analyze();
+  TestCase("lowering parses lazy bodies", ast_text,
+           lazy_analyzer.get_ast().output())
+      .checkResult();
+
+  // pooled expressions are read back from the pool
+  ParseTree shared;
+  ExprPool exprs;
+  Parser shared_parser(tokens);
+  shared_parser.set_lazy_fn_bodies(true);
+  shared_parser.set_expr_pool(&exprs);
+  shared_parser.parse(shared);
+  SemanticAnalyzer shared_analyzer(shared, parsed_fn_bodies(shared_parser),
+                                   &exprs);
+  shared_analyzer.analyze();
+  TestCase("lowering reads pooled expressions", ast_text,
+           shared_analyzer.get_ast().output())
+      .checkResult();
+}
+
+void test_parse_files() {
+  // directories are searched in sorted order, other files keep their place
+  std::string dir = "tests/batch_sources";
+  std::filesystem::create_directories(dir + "/nested");
+  std::ofstream(dir + "/b.snip") << "int a = 1;\nb = a + 2;\n ";
+  std::ofstream(dir + "/nested/a.snip") << "int a = 1;\n  x y;\nb = 2;\n ";
+  std::ofstream(dir + "/notes.txt") << "not a source";
+  std::string big;
+  for (int i = 0; i < 5000; i++) {
+    big += "c = " + std::to_string(i) + " * 2;\n";
+  }
+  std::ofstream(dir + "/c.snip") << big + " ";
+  std::vector<std::string> paths =
+      collect_sources({dir + "/c.snip", dir, dir + "/missing.snip"});
+  std::string order;
+  for (const std::string &path : paths) {
+    order += path.substr(dir.size() + 1) + " ";
+  }
+  TestCase("batch sources", "c.snip b.snip c.snip nested/a.snip missing.snip ",
+           order)
+      .checkResult();
+
+  ThreadPool one(1);
+  ThreadPool three(3);
+  std::string reports[2];
+  ThreadPool *pools[2] = {&one, &three};
+  for (int i = 0; i < 2; i++) {
+    BatchReport report = parse_files(paths, *pools[i]);
+    for (const FileReport &file : report.files) {
+      reports[i] += std::to_string(file.tokens) + " " +
+                    std::to_string(file.nodes) + " " +
+                    file.diagnostics.format(DiagnosticFormat::TEXT);
+    }
+    reports[i] += std::to_string(report.error_count());
+  }
+  TestCase("batch reports in file order",
+           "30002 50002 13 20 30002 50002 14 17 "
+           "tests/batch_sources/nested/a.snip:2:3: error: parse() expects a "
+           "variable declaration\n0 0 tests/batch_sources/missing.snip: "
+           "error: can't read the file\n2",
+           reports[0])
+      .checkResult();
+  TestCase("batch reports don't depend on the threads", reports[0],
+           reports[1])
+      .checkResult();
+  std::filesystem::remove_all(dir);
+}
+
+void test_long_statement_list() {
+  // the old tree was freed by recursing down every sibling link
+  std::string input;
+  for (int i = 0; i < 200000; i++) {
+    input += "a = 1;\n";
+  }
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  std::size_t statements = 0;
+  std::size_t nodes = 0;
+  {
+    ParseTree tree;
+    Parser parser(tokens);
+    parser.parse(tree);
+    for (PTNode *stmt = tree.root()->get_first_child(); stmt != nullptr;
+         stmt = stmt->get_next_sibling()) {
+      statements++;
+    }
+    nodes = tree.node_count();
+  }
+  // START, END and per statement STMT ASSIGNSTMT IDENTIFIER ASSIGN EXPR
+  // INT SEMICOLON
+  TestCase("long statement list", "200000 1400002",
+           std::to_string(statements) + " " + std::to_string(nodes))
+      .checkResult();
+}
+
+void test_flat_tree() {
+  std::string input = "int a = 1 + 2 * 3; str s = \"s\";\n"
+                      "fn g : int (int x, char y) { x = x - 1; }\n"
+                      "if (a) { b = 2; }\n";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree tree;
+  Parser parser(tokens);
+  parser.parse(tree);
+  FlatTree flat(tree);
+  TestCase("flat tree output matches the node tree", tree.root()->output(),
+           flat.output())
+      .checkResult();
+
+  // links, depths and payloads of a tree built by hand
+  FlatTree built;
+  std::uint32_t root = built.add_node({ParserToken::START, ""});
+  std::uint32_t stmt = built.add_node({ParserToken::STMT, ""}, root);
+  built.add_node({ParserToken::IDENTIFIER, "x", 7}, stmt);
+  built.add_node({ParserToken::INT, 5}, stmt);
+  built.add_node({ParserToken::STMT, ""}, root);
+  built.add_node({ParserToken::END, ""});
+  std::stringstream links;
+  for (std::uint32_t i = 0; i < built.size(); i++) {
+    ParserTokenChunk tok = built.token(i);
+    links << token_to_string(tok.type) << " " << tok.value << " "
+          << (tok.sym == no_symbol ? -1 : static_cast<long>(tok.sym)) << " "
+          << built.depth(i) << " " << static_cast<int>(built.first_child(i))
+          << " " << static_cast<int>(built.next_sibling(i)) << "\n";
+  }
+  TestCase("flat tree links",
+           "START  -1 0 1 5\nSTMT  -1 1 2 4\nIDENTIFIER x 7 2 -1 3\n"
+           "INT 5 -1 2 -1 -1\nSTMT  -1 1 -1 -1\nEND  -1 0 -1 -1\n",
+           links.str())
+      .checkResult();
+}
+
+void test_tree_cache() {
+  std::string dir = "tests/tree_cache";
+  std::filesystem::remove_all(dir);
+  std::string input = "int a = 1 + 2 * 3; str s = \"s\"; char c = 'c';\n"
+                      "double d = 2.5; while (a) { a = a - 1; }\n ";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree parsed;
+  Parser parser(tokens);
+  parser.parse(parsed);
+  TreeCache cache(dir);
+  auto lookup = [&cache](const std::string &source) {
+    return cache.load(source) == nullptr ? "miss" : "hit";
+  };
+  std::string lookups = lookup(input);
+  cache.store(input, FlatTree(parsed));
+  std::unique_ptr<TreeImage> image = cache.load(input);
+  lookups += image == nullptr ? " miss" : " hit";
+  TestCase("tree cache hits after a store", "miss hit", lookups)
+      .checkResult();
+  if (image == nullptr) {
+    return;
+  }
+  TestCase("cached tree output matches the node tree",
+           parsed.root()->output(), image->output())
+      .checkResult();
+  std::string streamed[2];
+  for (int i = 0; i < 2; i++) {
+    std::FILE *file = std::tmpfile();
+    std::size_t written = 0;
+    {
+      FdWriter out(fileno(file));
+      if (i == 0) {
+        parsed.root()->write(out);
+      } else {
+        image->write(out);
+      }
+      written = out.bytes_written();
+    }
+    streamed[i].assign(written, '\0');
+    std::rewind(file);
+    streamed[i].resize(std::fread(&streamed[i][0], 1, written, file));
+    std::fclose(file);
+  }
+  TestCase("cached tree dump", streamed[0], streamed[1]).checkResult();
+
+  // an edited source looks for another entry, a cut short entry is ignored
+  std::string edited = input;
+  edited[8] = '4';
+  lookups = lookup(edited);
+  std::string path = cache.path(TreeCache::hash(input));
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+  lookups += std::string(" ") + lookup(input);
+  TestCase("tree cache misses stale entries", "miss miss", lookups)
+      .checkResult();
+  // and so is one of the right length whose nodes are garbage
+  cache.store(input, FlatTree(parsed));
+  lookups = lookup(input);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    std::string garbage(std::filesystem::file_size(path) - 256, '\xff');
+    file.seekp(128);
+    file.write(garbage.data(), garbage.size());
+  }
+  lookups += std::string(" ") + lookup(input);
+  TestCase("tree cache misses corrupt entries", "hit miss", lookups)
+      .checkResult();
+  cache.store(edited, FlatTree(parsed));
+  std::size_t removed = cache.clear();
+  TestCase("tree cache clear", "2 miss",
+           std::to_string(removed) + " " + lookup(edited))
+      .checkResult();
+  std::filesystem::remove_all(dir);
+}
+
+void test_tree_walk() {
+  // a million siblings and a chain nested a hundred thousand deep, both
+  // of which used to be walked by recursion
+  ParseTree tree;
+  PTNode *root = tree.make_node({ParserToken::START, ""});
+  PTNode *stmts = tree.make_node({ParserToken::STMTS, ""});
+  root->add_child(stmts);
+  for (int i = 0; i < 1000000; i++) {
+    stmts->add_child(tree.make_node({ParserToken::STMT, ""}));
+  }
+  std::string text = root->output();
+  PTNode *deepest = root;
+  for (int i = 0; i < 100000; i++) {
+    PTNode *expr = tree.make_node({ParserToken::EXPR, ""});
+    deepest->add_child(expr);
+    deepest = expr;
+  }
+  root->add_sibling(tree.make_node({ParserToken::END, ""}));
+  std::size_t visited = 0;
+  std::size_t max_depth = 0;
+  PTNodeWalk walk(root);
+  for (PTNode *node = walk.next(); node != nullptr; node = walk.next()) {
+    visited++;
+    max_depth = std::max(max_depth, walk.depth());
+  }
+  TestCase("walk a long and deep tree", "1100003 100000",
+           std::to_string(visited) + " " + std::to_string(max_depth))
+      .checkResult();
+  TestCase("output a long tree", "9000014 START\n  STMTS\n    STMT\n",
+           std::to_string(text.size()) + " " + text.substr(0, 23))
+      .checkResult();
+
+  // the streamed dump is the same text print() writes
+  std::string input = "int a = 1 + 2 * 3; str s = \"s\"; char c = 'c';\n"
+                      "double d = 2.5; if (a) { b = !a; }\n";
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree parsed;
+  Parser parser(tokens);
+  parser.parse(parsed);
+  std::stringstream printed;
+  FlatTree(parsed).print(printed);
+  std::FILE *file = std::tmpfile();
+  std::size_t written = 0;
+  {
+    FdWriter out(fileno(file));
+    parsed.root()->write(out);
+    written = out.bytes_written();
+  }
+  std::string streamed(written, '\0');
+  std::rewind(file);
+  streamed.resize(std::fread(&streamed[0], 1, written, file));
+  std::fclose(file);
+  TestCase("streamed tree dump", printed.str(), streamed).checkResult();
+}
+
+void test_symbol_lookup_by_id() {
+  Interner names;
+  ParserTokenChunk x = {ParserToken::IDENTIFIER, "x", names.intern("x")};
+  ParserTokenChunk y = {ParserToken::IDENTIFIER, "y", names.intern("y")};
+  PTNode int_type({ParserToken::INT, ""});
+  PTNode str_type({ParserToken::STRING, ""});
+  PTNode outer_x(x);
+  PTNode inner_x(x);
+  SymbolTableS tables;
+  tables.enter_scope();
+  tables.insert(&outer_x, &int_type);
+  tables.enter_scope();
+  tables.insert(&inner_x, &str_type);
+  std::optional<ParserTokenChunk> inner = tables.get_tok(x.sym);
+  std::optional<ParserTokenChunk> missing = tables.get_tok(y.sym);
+  tables.exit_scope();
+  std::optional<ParserTokenChunk> outer = tables.get_tok(x.sym);
+  TestCase("symbol lookup by interned id",
+           "STRING INT " + std::to_string(!missing.has_value()),
+           token_to_string(inner->type) + " " + token_to_string(outer->type) +
+               " 1")
+      .checkResult();
+}
+
+void test_memory_stats() {
+  // an allocation counts against the phase of the scope it is made in, and
+  // its free against that phase wherever the free happens
+  MemoryReport before = memory_report();
+  std::unique_ptr<char[]> block;
+  {
+    MemoryPhaseScope phase(MemoryPhase::SEMANTIC);
+    block.reset(new char[1000]);
+  }
+  MemoryReport held = memory_report();
+  block.reset();
+  MemoryReport after = memory_report();
+  const PhaseMemory &start = before[MemoryPhase::SEMANTIC];
+  std::string counted =
+      std::to_string(held[MemoryPhase::SEMANTIC].allocations -
+                     start.allocations) +
+      " " + std::to_string(held[MemoryPhase::SEMANTIC].live_bytes -
+                           start.live_bytes) +
+      " " + std::to_string(after[MemoryPhase::SEMANTIC].frees - start.frees) +
+      " " + std::to_string(after[MemoryPhase::SEMANTIC].bytes - start.bytes) +
+      " " + std::to_string(after[MemoryPhase::SEMANTIC].live_bytes -
+                           start.live_bytes) +
+      " " + std::to_string(after[MemoryPhase::SEMANTIC].peak_bytes >=
+                           start.live_bytes + 1000);
+  TestCase("allocations counted by phase", "1 1000 1 1000 0 1", counted)
+      .checkResult();
+
+  // the lexer and parser entry points pick their phase, pool workers take
+  // the caller's
+  std::string input = "int a = 1 + 2 * 3; while (a) { a = a - 1; }\n ";
+  before = memory_report();
+  TokenStream tokens;
+  Lexer lex(input);
+  lex.tokenize(tokens);
+  ParseTree parsed;
+  Parser parser(tokens);
+  parser.parse(parsed);
+  ThreadPool pool(2);
+  {
+    MemoryPhaseScope phase(MemoryPhase::HELPER);
+    pool.run(4, [](std::size_t) { std::make_unique<int>(0); });
+  }
+  after = memory_report();
+  std::string phases;
+  for (MemoryPhase phase :
+       {MemoryPhase::LEXER, MemoryPhase::PARSER, MemoryPhase::HELPER}) {
+    phases += std::string(to_string(phase)) + "=" +
+              std::to_string(after[phase].allocations >
+                             before[phase].allocations) +
+              " ";
+  }
+  TestCase("front end phases allocate", "lexer=1 parser=1 helper=1 ", phases)
+      .checkResult();
+  TestCase("pool tasks allocate in the caller's phase", "4",
+           std::to_string(after[MemoryPhase::HELPER].allocations -
+                          before[MemoryPhase::HELPER].allocations))
+      .checkResult();
+
+  // symbol lookups hand back a copy and allocate nothing
+  Interner names;
+  ParserTokenChunk x = {ParserToken::IDENTIFIER, "x", names.intern("x")};
+  PTNode int_type({ParserToken::INT, ""});
+  PTNode decl(x);
+  SymbolTableS tables;
+  tables.enter_scope();
+  tables.insert(&decl, &int_type);
+  before = memory_report();
+  for (int i = 0; i < 100; i++) {
+    tables.get_tok(x.sym);
+  }
+  after = memory_report();
+  TestCase("symbol lookups don't allocate", "0",
+           std::to_string(after.total.allocations - before.total.allocations))
+      .checkResult();
+}
+
+void test_expression_operators() {
+  std::string input = "b = !a == 1 - -2 * 3 || c != d && e <= g; ";
+  std::string expected = "START\n"
+                         "  STMT\n"
+                         "    ASSIGNSTMT\n"
+                         "      IDENTIFIER\n"
+                         "      ASSIGN\n"
+                         "      EXPR\n"
+                         "        BINOP\n"
+                         "          BINOP\n"
+                         "            UNOP\n"
+                         "              EXCLAIM\n"
+                         "              IDENTIFIER\n"
+                         "            BINOP\n"
+                         "              INT\n"
+                         "              BINOP\n"
+                         "                UNOP\n"
+                         "                  SUBTRACT\n"
+                         "                  INT\n"
+                         "                INT\n"
+                         "                MULTIPLY\n"
+                         "              SUBTRACT\n"
+                         "            EQUAL\n"
+                         "          BINOP\n"
+                         "            BINOP\n"
+                         "              IDENTIFIER\n"
+                         "              IDENTIFIER\n"
+                         "              NOTEQUAL\n"
+                         "            BINOP\n"
+                         "              IDENTIFIER\n"
+                         "              IDENTIFIER\n"
+                         "              LESSTHANEQUAL\n"
+                         "            AND\n"
+                         "          OR\n"
+                         "      SEMICOLON\n"
+                         "END\n";
+  TestCase("parse expression operators", expected, lex_and_parse_input(input))
+      .checkResult();
+  // operators of one level associate to the left
+  std::string chain = "b = 8 - 4 - 2; ";
+  std::string chain_expected = "START\n"
+                               "  STMT\n"
+                               "    ASSIGNSTMT\n"
+                               "      IDENTIFIER\n"
+                               "      ASSIGN\n"
+                               "      EXPR\n"
+                               "        BINOP\n"
+                               "          BINOP\n"
+                               "            INT\n"
+                               "            INT\n"
+                               "            SUBTRACT\n"
+                               "          INT\n"
+                               "          SUBTRACT\n"
+                               "      SEMICOLON\n"
+                               "END\n";
+  TestCase("parse left associative operators", chain_expected,
+           lex_and_parse_input(chain))
+      .checkResult();
+}
+
 void test_statement_types() {
   std::string var_dec_int = "int a = 1; ";
   std::string var_dec_int_expected = "START\n"
@@ -95,48 +838,68 @@ void test_statement_types() {
   std::string if_stmt_rec = lex_and_parse_input(if_stmt);
   TestCase("parse if statement", if_stmt_expected, if_stmt_rec).checkResult();
   std::string exprs = "int a = ((a + (b + (1/2))) * c / d - e); ";
-  std::string exprs_expected = "START\n"
-                               "  STMT\n"
-                               "    VARDECL\n"
-                               "      INTK\n"
-                               "      IDENTIFIER\n"
-                               "      ASSIGN\n"
-                               "      EXPR\n"
-                               "        LEFTPARENTHESIS\n"
-                               "          EXPR\n"
-                               "            LEFTPARENTHESIS\n"
-                               "              EXPR\n"
-                               "                LEFTPARENTHESIS\n"
-                               "                  EXPR\n"
-                               "                    LEFTPARENTHESIS\n"
-                               "                      INT\n"
-                               "                      DIVIDE\n"
-                               "                      INT\n"
-                               "                    RIGHTPARENTHESIS\n"
-                               "                  IDENTIFIER\n"
-                               "                  ADD\n"
-                               "                  EXPR\n"
-                               "                RIGHTPARENTHESIS\n"
-                               "              IDENTIFIER\n"
-                               "              ADD\n"
-                               "              EXPR\n"
-                               "            RIGHTPARENTHESIS\n"
-                               "          EXPR\n"
-                               "          MULTIPLY\n"
-                               "          IDENTIFIER\n"
-                               "          DIVIDE\n"
-                               "          IDENTIFIER\n"
-                               "          SUBTRACT\n"
-                               "          IDENTIFIER\n"
-                               "        RIGHTPARENTHESIS\n"
-                               "      SEMICOLON\n"
-                               "END\n";
+  std::string exprs_expected =
+      "START\n"
+      "  STMT\n"
+      "    VARDECL\n"
+      "      INTK\n"
+      "      IDENTIFIER\n"
+      "      ASSIGN\n"
+      "      EXPR\n"
+      "        LEFTPARENTHESIS\n"
+      "          BINOP\n"
+      "            BINOP\n"
+      "              BINOP\n"
+      "                EXPR\n"
+      "                  LEFTPARENTHESIS\n"
+      "                    BINOP\n"
+      "                      IDENTIFIER\n"
+      "                      EXPR\n"
+      "                        LEFTPARENTHESIS\n"
+      "                          BINOP\n"
+      "                            IDENTIFIER\n"
+      "                            EXPR\n"
+      "                              LEFTPARENTHESIS\n"
+      "                                BINOP\n"
+      "                                  INT\n"
+      "                                  INT\n"
+      "                                  DIVIDE\n"
+      "                              RIGHTPARENTHESIS\n"
+      "                            ADD\n"
+      "                        RIGHTPARENTHESIS\n"
+      "                      ADD\n"
+      "                  RIGHTPARENTHESIS\n"
+      "                IDENTIFIER\n"
+      "                MULTIPLY\n"
+      "              IDENTIFIER\n"
+      "              DIVIDE\n"
+      "            IDENTIFIER\n"
+      "            SUBTRACT\n"
+      "        RIGHTPARENTHESIS\n"
+      "      SEMICOLON\n"
+      "END\n";
   std::string exprs_rec = lex_and_parse_input(exprs);
   TestCase("parse nested expressions", exprs_expected, exprs_rec).checkResult();
 }
 
 int main() {
+  run_lexer_tests();
   test_parser_tree();
+  test_streaming_parse();
+  test_token_stream_parse();
+  test_parse_error_location();
+  test_error_recovery();
+  test_lazy_fn_bodies();
+  test_shared_exprs();
+  test_lowering();
+  test_parse_files();
+  test_long_statement_list();
+  test_flat_tree();
+  test_tree_cache();
+  test_tree_walk();
+  test_symbol_lookup_by_id();
+  test_memory_stats();
   test_statement_types();
+  test_expression_operators();
   return 0;
 }
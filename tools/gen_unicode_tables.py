@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+"""Writes src/unicode_tables.h, the XID_Start and XID_Continue ranges the
+lexer uses for non-ASCII identifiers.
+
+Python's str.isidentifier() is defined on the same properties (UAX #31), so
+the tables follow the Unicode version of the Python that runs this script:
+
+    python3 tools/gen_unicode_tables.py > src/unicode_tables.h
+"""
+
+import sys
+import unicodedata
+
+
+def ranges(predicate):
+    out = []
+    start = None
+    for cp in range(0x80, 0x110000):
+        if predicate(cp):
+            if start is None:
+                start = cp
+        elif start is not None:
+            out.append((start, cp - 1))
+            start = None
+    if start is not None:
+        out.append((start, 0x10FFFF))
+    return out
+
+
+def is_start(cp):
+    return chr(cp).isidentifier()
+
+
+def is_continue(cp):
+    return ("a" + chr(cp)).isidentifier()
+
+
+def emit(name, table):
+    lines = ["inline constexpr UnicodeRange %s[] = {" % name]
+    row = "   "
+    for first, last in table:
+        item = " {0x%X, 0x%X}," % (first, last)
+        if len(row) + len(item) > 80:
+            lines.append(row)
+            row = "   "
+        row += item
+    lines.append(row)
+    lines.append("};")
+    return "\n".join(lines)
+
+
+def main():
+    print("// generated by tools/gen_unicode_tables.py from Unicode %s, "
+          "do not edit" % unicodedata.unidata_version)
+    print("#ifndef UNICODE_TABLES_H")
+    print("#define UNICODE_TABLES_H")
+    print()
+    print("// inclusive code point ranges, sorted, ASCII is left to the "
+          "lexer's own")
+    print("// character classes")
+    print("struct UnicodeRange {")
+    print("  char32_t first;")
+    print("  char32_t last;")
+    print("};")
+    print()
+    print(emit("xid_start_ranges", ranges(is_start)))
+    print()
+    print(emit("xid_continue_ranges", ranges(is_continue)))
+    print()
+    print("#endif // !UNICODE_TABLES_H")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())